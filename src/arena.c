@@ -0,0 +1,88 @@
+#include "arena.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/**
+ * @brief Round a size up to the alignment of the arena.
+ */
+static size_t align_size(size_t size)
+{
+    const size_t alignment = sizeof(max_align_t);
+    return (size + alignment - 1) / alignment * alignment;
+}
+
+arena new_arena(size_t expected_size)
+{
+    arena memory;
+    memory.current = NULL;
+    memory.block_size = expected_size > ARENA_MIN_BLOCK ? align_size(expected_size) : ARENA_MIN_BLOCK;
+    memory.last = NULL;
+    return memory;
+}
+
+void *arena_alloc(arena *memory, size_t size)
+{
+    size = align_size(size);
+    arena_block *block = memory->current;
+    if (block == NULL || block->size - block->used < size)
+    {
+        // A new block, at least twice the last one, so a growing pipeline takes few blocks
+        size_t block_size = memory->block_size;
+        while (block_size < size)
+        {
+            block_size *= 2;
+        }
+        block = malloc(sizeof(arena_block) + block_size);
+        if (block == NULL)
+        {
+            fprintf(stderr, "Error: Out of memory while compiling the regex.\n");
+            exit(EXIT_FAILURE);
+        }
+        block->previous = memory->current;
+        block->size = block_size;
+        block->used = 0;
+        memory->current = block;
+        memory->block_size = block_size * 2;
+    }
+
+    void *result = (unsigned char *)block->data + block->used;
+    block->used += size;
+    memory->last = result;
+    return result;
+}
+
+void *arena_grow(arena *memory, void *old, size_t old_size, size_t new_size)
+{
+    arena_block *block = memory->current;
+    if (old != NULL && old == memory->last)
+    {
+        // The last allocation ends where the free part of the block starts
+        size_t start = (size_t)((unsigned char *)old - (unsigned char *)block->data);
+        if (block->size - start >= align_size(new_size))
+        {
+            block->used = start + align_size(new_size);
+            return old;
+        }
+    }
+
+    void *result = arena_alloc(memory, new_size);
+    if (old != NULL)
+    {
+        memcpy(result, old, old_size);
+    }
+    return result;
+}
+
+void free_arena(arena *memory)
+{
+    arena_block *block = memory->current;
+    while (block != NULL)
+    {
+        arena_block *previous = block->previous;
+        free(block);
+        block = previous;
+    }
+    memory->current = NULL;
+    memory->last = NULL;
+}
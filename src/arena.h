@@ -0,0 +1,73 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stddef.h>
+
+/* Smallest size of a block of an arena, in bytes */
+#define ARENA_MIN_BLOCK (64 * 1024)
+
+/**
+ * @brief Struct to represent a block of memory of an arena.
+ */
+struct arena_block
+{
+    /* The block allocated before this one, or NULL */
+    struct arena_block *previous;
+    /* Number of bytes of the block */
+    size_t size;
+    /* Number of bytes of the block already handed out */
+    size_t used;
+    /* The bytes of the block */
+    max_align_t data[];
+};
+typedef struct arena_block arena_block;
+
+/**
+ * @brief Struct to represent an arena: memory handed out in order from large blocks and released
+ * all at once. It suits the compile pipeline, where every intermediate array dies together.
+ */
+struct arena
+{
+    /* The block memory is handed out from, or NULL before the first allocation */
+    arena_block *current;
+    /* Size of the next block, which doubles every time a block fills up */
+    size_t block_size;
+    /* Start of the last allocation, which can grow in place */
+    void *last;
+};
+typedef struct arena arena;
+
+/**
+ * @brief Create an empty arena. No memory is allocated until the first request.
+ * @param expected_size The number of bytes the arena is expected to hand out in total
+ * @return The arena. Release it with free_arena
+ */
+arena new_arena(size_t expected_size);
+
+/**
+ * @brief Take memory from an arena. It is aligned for any type. The program exits if there is
+ * no memory left.
+ * @param memory Pointer to the arena
+ * @param size The number of bytes
+ * @return The memory, valid until the arena is released
+ */
+void *arena_alloc(arena *memory, size_t size);
+
+/**
+ * @brief Grow an allocation of an arena. The last allocation grows in place when its block has
+ * room, and any other one is copied to new memory.
+ * @param memory Pointer to the arena
+ * @param old The allocation, or NULL
+ * @param old_size The number of bytes of the allocation
+ * @param new_size The number of bytes it needs, at least old_size
+ * @return The grown allocation
+ */
+void *arena_grow(arena *memory, void *old, size_t old_size, size_t new_size);
+
+/**
+ * @brief Release every block of an arena at once.
+ * @param memory Pointer to the arena
+ */
+void free_arena(arena *memory);
+
+#endif // ARENA_H
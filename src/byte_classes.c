@@ -0,0 +1,38 @@
+#include "byte_classes.h"
+
+byte_classes new_byte_classes(void)
+{
+    byte_classes classes;
+    memset(classes.class_of, 0, sizeof(classes.class_of));
+    classes.count = 1;
+    return classes;
+}
+
+void split_byte_classes(byte_classes *classes, const byte_set *set)
+{
+    // New class for the bytes of each old class that are inside the set.
+    // -1 means the old class has no bytes inside the set (yet).
+    int inside[256];
+    // New class for the bytes of each old class that are outside the set.
+    int outside[256];
+    for (int c = 0; c < classes->count; c++)
+    {
+        inside[c] = -1;
+        outside[c] = -1;
+    }
+
+    // Classes are renumbered in order of their first byte, so the
+    // result does not depend on the order of the splits.
+    int count = 0;
+    for (int byte = 0; byte < 256; byte++)
+    {
+        int old_class = classes->class_of[byte];
+        int *target = byte_set_contains(set, (unsigned char)byte) ? &inside[old_class] : &outside[old_class];
+        if (*target == -1)
+        {
+            *target = count++;
+        }
+        classes->class_of[byte] = (uint8_t)*target;
+    }
+    classes->count = count;
+}
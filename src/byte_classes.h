@@ -0,0 +1,123 @@
+#ifndef BYTE_CLASSES_H
+#define BYTE_CLASSES_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+/**
+ * @brief Struct to represent a set of bytes as a 256-bit bitset. Transitions of the
+ * automata are labelled with byte sets.
+ */
+struct byte_set
+{
+    /* Bit (byte % 64) of word (byte / 64) is set when the byte is in the set */
+    uint64_t bits[4];
+};
+typedef struct byte_set byte_set;
+
+/**
+ * @brief Struct to represent a partition of the 256 byte values into equivalence classes.
+ * Two bytes are in the same class when no transition label tells them apart, so
+ * automata only need one column per class instead of one per byte.
+ */
+struct byte_classes
+{
+    /* Class of each byte */
+    uint8_t class_of[256];
+    /* Number of classes */
+    int count;
+};
+typedef struct byte_classes byte_classes;
+
+/**
+ * @brief Create an empty byte set.
+ * @return A byte set with no bytes
+ */
+static inline byte_set empty_byte_set(void)
+{
+    byte_set set;
+    memset(set.bits, 0, sizeof(set.bits));
+    return set;
+}
+
+/**
+ * @brief Add a byte to a byte set.
+ * @param set Pointer to the byte set
+ * @param byte The byte to add
+ */
+static inline void byte_set_add(byte_set *set, unsigned char byte)
+{
+    set->bits[byte / 64] |= (1ULL << (byte % 64));
+}
+
+/**
+ * @brief Check whether a byte belongs to a byte set.
+ * @param set Pointer to the byte set
+ * @param byte The byte to check
+ * @return true if the byte is in the set, false otherwise
+ */
+static inline bool byte_set_contains(const byte_set *set, unsigned char byte)
+{
+    return (set->bits[byte / 64] & (1ULL << (byte % 64))) != 0;
+}
+
+/**
+ * @brief Add a range of bytes to a byte set.
+ * @param set Pointer to the byte set
+ * @param first The first byte of the range
+ * @param last The last byte of the range, included
+ */
+static inline void byte_set_add_range(byte_set *set, unsigned char first, unsigned char last)
+{
+    for (int byte = first; byte <= last; byte++)
+    {
+        byte_set_add(set, (unsigned char)byte);
+    }
+}
+
+/**
+ * @brief Replace a byte set with the bytes that are not in it.
+ * @param set Pointer to the byte set
+ */
+static inline void byte_set_complement(byte_set *set)
+{
+    for (int word = 0; word < 4; word++)
+    {
+        set->bits[word] = ~set->bits[word];
+    }
+}
+
+/**
+ * @brief Count the bytes of a byte set.
+ * @param set Pointer to the byte set
+ * @return The number of bytes in the set
+ */
+static inline int byte_set_count(const byte_set *set)
+{
+    int count = 0;
+    for (int word = 0; word < 4; word++)
+    {
+        for (uint64_t bits = set->bits[word]; bits != 0; bits &= bits - 1)
+        {
+            count++;
+        }
+    }
+    return count;
+}
+
+/**
+ * @brief Create a partition with all the bytes in a single class.
+ * @return The byte classes struct
+ */
+byte_classes new_byte_classes(void);
+
+/**
+ * @brief Refine the partition so that the given byte set is a union of classes.
+ * Every class that has bytes both inside and outside of the set is split in two.
+ * @param classes Pointer to the byte classes to refine
+ * @param set The byte set that must be distinguished
+ */
+void split_byte_classes(byte_classes *classes, const byte_set *set);
+
+#endif // BYTE_CLASSES_H
@@ -0,0 +1,150 @@
+#include "codegen.h"
+
+/**
+ * @brief Write the regex inside a C comment. Bytes that are not printable are written as \xHH,
+ * and the comment is never closed early by a `*` followed by `/`.
+ */
+static void write_regex_comment(FILE *file, const char *regex_str)
+{
+    fputs(" * Regex: ", file);
+    for (const char *c = regex_str; *c != '\0'; c++)
+    {
+        unsigned char byte = (unsigned char)*c;
+        if (byte == '/' && c > regex_str && c[-1] == '*')
+        {
+            fputs("\\/", file);
+        }
+        else if (byte < 0x20 || byte >= 0x7F)
+        {
+            fprintf(file, "\\x%02X", byte);
+        }
+        else
+        {
+            fputc(byte, file);
+        }
+    }
+    fputc('\n', file);
+}
+
+/**
+ * @brief Write the entries of a table, 16 per line.
+ * @param file Output file
+ * @param values The entries
+ * @param count Number of entries
+ * @param indent Indentation of every line
+ */
+static void write_table_rows(FILE *file, const int32_t *values, size_t count, const char *indent)
+{
+    for (size_t i = 0; i < count; i++)
+    {
+        if (i % 16 == 0)
+        {
+            fputs(indent, file);
+        }
+        fprintf(file, "%d", values[i]);
+        if (i + 1 < count)
+        {
+            fputs(i % 16 == 15 ? ",\n" : ", ", file);
+        }
+    }
+    fputc('\n', file);
+}
+
+bool dfa_to_c(const dfa *automaton, const char *regex_str, const char *file_path)
+{
+    if (automaton == NULL || file_path == NULL || automaton->states == 0)
+    {
+        return false;
+    }
+
+    FILE *file = fopen(file_path, "w");
+    if (file == NULL)
+    {
+        return false;
+    }
+
+    const uint32_t states = automaton->states;
+    const int columns = automaton->columns;
+    // Smallest type that holds every state id
+    const char *state_type = states <= 256 ? "uint8_t" : (states <= 65536 ? "uint16_t" : "uint32_t");
+
+    fputs("/*\n * Generated by regex_to_nfa -c. Do not edit.\n", file);
+    write_regex_comment(file, regex_str);
+    fprintf(file, " * Minimal DFA: %u states, %d byte classes.\n */\n", states, columns);
+    fputs("#include <stdbool.h>\n#include <stddef.h>\n#include <stdint.h>\n\n", file);
+    fputs("#ifndef REGEX_MATCH_NAME\n#define REGEX_MATCH_NAME regex_match\n#endif\n\n", file);
+
+    fputs("/* Column of each byte, or -1 for the bytes that no transition accepts */\n", file);
+    fputs("static const int16_t regex_char_to_col[256] = {\n", file);
+    int32_t char_to_col[256];
+    for (int c = 0; c < 256; c++)
+    {
+        char_to_col[c] = automaton->char_to_col[c];
+    }
+    write_table_rows(file, char_to_col, 256, "    ");
+    fputs("};\n\n", file);
+
+    fputs("/* regex_transitions[state][column] is the state reached from state on a byte of the column */\n", file);
+    fprintf(file, "static const %s regex_transitions[%u][%d] = {\n", state_type, states, columns);
+    for (uint32_t state = 0; state < states; state++)
+    {
+        const int32_t *row = automaton->transitions + (size_t)state * columns;
+        if (columns <= 16)
+        {
+            // Short rows fit on one line
+            fputs("    {", file);
+            for (int col = 0; col < columns; col++)
+            {
+                fprintf(file, col == 0 ? "%d" : ", %d", row[col]);
+            }
+            fputs(state + 1 < states ? "},\n" : "}\n", file);
+            continue;
+        }
+        fputs("    {\n", file);
+        write_table_rows(file, row, (size_t)columns, "        ");
+        fputs(state + 1 < states ? "    },\n" : "    }\n", file);
+    }
+    fputs("};\n\n", file);
+
+    fputs("/* 1 for the accept states, 0 otherwise */\n", file);
+    fprintf(file, "static const uint8_t regex_accepting[%u] = {\n", states);
+    int32_t *accepting = malloc(states * sizeof(int32_t));
+    if (accepting == NULL)
+    {
+        fprintf(stderr, "Error: Out of memory while generating the matcher.\n");
+        exit(EXIT_FAILURE);
+    }
+    for (uint32_t state = 0; state < states; state++)
+    {
+        accepting[state] = automaton->accepting[state] != 0;
+    }
+    write_table_rows(file, accepting, states, "    ");
+    free(accepting);
+    fputs("};\n\n", file);
+
+    fputs("/**\n * @brief Check whether the whole input matches the regex.\n", file);
+    fputs(" * @param input The input string to check\n * @param length The length of the input string\n", file);
+    fputs(" * @return true if the input matches, false otherwise\n */\n", file);
+    fputs("bool REGEX_MATCH_NAME(const char *input, size_t length)\n{\n", file);
+    fputs("    const unsigned char *bytes = (const unsigned char *)input;\n", file);
+    fprintf(file, "    %s state = %u;\n\n", state_type, automaton->start_state);
+    fputs("    for (size_t i = 0; i < length; i++)\n    {\n", file);
+    fputs("        int col = regex_char_to_col[bytes[i]];\n", file);
+    fputs("        if (col < 0)\n        {\n            return false;\n        }\n", file);
+    fputs("        state = regex_transitions[state][col];\n", file);
+    if (automaton->dead_state != -1)
+    {
+        fputs("\n        // No accept state can be reached from here\n", file);
+        fprintf(file, "        if (state == %d)\n        {\n            return false;\n        }\n",
+                automaton->dead_state);
+    }
+    fputs("    }\n\n", file);
+    fputs("    return regex_accepting[state] != 0;\n}\n", file);
+
+    bool ok = !ferror(file);
+    if (fclose(file) != 0)
+    {
+        return false;
+    }
+    return ok;
+}
@@ -0,0 +1,20 @@
+#ifndef CODEGEN_H
+#define CODEGEN_H
+
+#include "dfa.h"
+
+/**
+ * @brief Write a self-contained C source file that matches the language of a DFA. The file holds
+ * the byte-to-column map, the transition table and the accepting flags as static const tables,
+ * stored with the smallest integer type that fits the state ids, and a function
+ * `bool regex_match(const char *input, size_t length)` that runs the DFA over the input with one
+ * table lookup per byte. The function name can be changed by defining REGEX_MATCH_NAME when the
+ * file is compiled, so several generated matchers can live in one program.
+ * @param automaton Pointer to the DFA, usually minimized
+ * @param regex_str The regex the DFA was built from, quoted in a comment of the file
+ * @param file_path Output file path
+ * @return true if the file was written successfully, false otherwise
+ */
+bool dfa_to_c(const dfa *automaton, const char *regex_str, const char *file_path);
+
+#endif // CODEGEN_H
@@ -0,0 +1,198 @@
+#include "compile_cache.h"
+#include <errno.h>
+
+#if defined(_WIN32)
+#include <direct.h>
+#include <process.h>
+#define make_directory(path) _mkdir(path)
+#define process_id() _getpid()
+#else
+#include <sys/stat.h>
+#include <unistd.h>
+#define make_directory(path) mkdir(path, 0777)
+#define process_id() getpid()
+#endif
+
+/**
+ * @brief Struct to represent the key of a cache entry: what the automaton is, the compile
+ * options that change it, and the regex text.
+ */
+struct cache_key
+{
+    /* The bytes of the key */
+    char *bytes;
+    /* Number of bytes of the key */
+    size_t length;
+    /* Path of the entry inside the cache directory */
+    char *path;
+};
+typedef struct cache_key cache_key;
+
+/**
+ * @brief 64-bit FNV-1a hash of a block of bytes.
+ */
+static uint64_t fnv1a_64(const char *bytes, size_t length)
+{
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    for (size_t i = 0; i < length; i++)
+    {
+        hash ^= (unsigned char)bytes[i];
+        hash *= 0x100000001b3ULL;
+    }
+    return hash;
+}
+
+/**
+ * @brief Build the key and the path of the entry of a regex.
+ * @param cache_dir Directory of the cache
+ * @param kind "nfa" or "dfa", also used as the extension of the entry
+ * @param options The compile options that change the automaton
+ * @param regex_str The regex
+ * @return The key. Release it with free_cache_key
+ */
+static cache_key new_cache_key(const char *cache_dir, const char *kind, const char *options, const char *regex_str)
+{
+    cache_key key;
+    int header_length = snprintf(NULL, 0, "%s %d %s\n", kind, COMPILE_CACHE_VERSION, options);
+    size_t regex_length = strlen(regex_str);
+    key.length = (size_t)header_length + regex_length;
+    key.bytes = malloc(key.length + 1);
+    // Room for the directory, a separator, 16 hex digits, a dot and the kind
+    size_t path_size = strlen(cache_dir) + strlen(kind) + 20;
+    key.path = malloc(path_size);
+    if (key.bytes == NULL || key.path == NULL)
+    {
+        fprintf(stderr, "Error: Out of memory while looking up the cache.\n");
+        exit(EXIT_FAILURE);
+    }
+
+    snprintf(key.bytes, (size_t)header_length + 1, "%s %d %s\n", kind, COMPILE_CACHE_VERSION, options);
+    memcpy(key.bytes + header_length, regex_str, regex_length);
+    snprintf(key.path, path_size, "%s/%016llx.%s", cache_dir, (unsigned long long)fnv1a_64(key.bytes, key.length),
+             kind);
+    return key;
+}
+
+/**
+ * @brief Release the memory owned by a key.
+ */
+static void free_cache_key(cache_key *key)
+{
+    free(key->bytes);
+    free(key->path);
+    key->bytes = NULL;
+    key->path = NULL;
+}
+
+/**
+ * @brief Get the temporary path an entry is written to before it is renamed into place. It is
+ * unique for each process and write, so concurrent writers never share a temporary file.
+ * @return The path. The caller owns it
+ */
+static char *temporary_path(const cache_key *key)
+{
+    static unsigned counter = 0;
+    size_t size = strlen(key->path) + 48;
+    char *path = malloc(size);
+    if (path == NULL)
+    {
+        fprintf(stderr, "Error: Out of memory while writing the cache.\n");
+        exit(EXIT_FAILURE);
+    }
+    snprintf(path, size, "%s.tmp.%ld.%u", key->path, (long)process_id(), counter++);
+    return path;
+}
+
+/**
+ * @brief Move a written temporary file to its final path. A failed entry only costs a compile
+ * next time, so errors are not reported.
+ */
+static void publish_entry(const char *temporary, bool written, const cache_key *key)
+{
+    if (!written || rename(temporary, key->path) != 0)
+    {
+        remove(temporary);
+    }
+}
+
+/**
+ * @brief Create the cache directory if it does not exist yet.
+ */
+static void ensure_cache_dir(const char *cache_dir)
+{
+    if (make_directory(cache_dir) != 0 && errno != EEXIST)
+    {
+        fprintf(stderr, "Warning: Could not create the cache directory '%s'.\n", cache_dir);
+    }
+}
+
+/**
+ * @brief Compile a regex into an NFA without the cache.
+ */
+static nfa build_nfa(const char *regex_str)
+{
+    regex r = parse_regex(regex_str);
+    nfa result = regex_to_nfa(r);
+    free_regex(r);
+    return result;
+}
+
+nfa compile_nfa(const char *regex_str, const char *cache_dir)
+{
+    if (cache_dir == NULL)
+    {
+        return build_nfa(regex_str);
+    }
+
+    cache_key key = new_cache_key(cache_dir, "nfa", "", regex_str);
+    nfa result;
+    if (!load_nfa_keyed(key.path, &result, key.bytes, key.length))
+    {
+        result = build_nfa(regex_str);
+
+        ensure_cache_dir(cache_dir);
+        char *temporary = temporary_path(&key);
+        publish_entry(temporary, save_nfa_keyed(&result, temporary, key.bytes, key.length), &key);
+        free(temporary);
+    }
+
+    free_cache_key(&key);
+    return result;
+}
+
+bool compile_dfa(const char *regex_str, const char *cache_dir, dfa *result)
+{
+    cache_key key = {NULL, 0, NULL};
+    if (cache_dir != NULL)
+    {
+        // The budget decides which regexes get a DFA at all
+        char options[32];
+        snprintf(options, sizeof(options), "minimal %d", DFA_MAX_BUDGET);
+        key = new_cache_key(cache_dir, "dfa", options, regex_str);
+        if (load_dfa(key.path, result, key.bytes, key.length))
+        {
+            free_cache_key(&key);
+            return true;
+        }
+    }
+
+    nfa automaton = compile_nfa(regex_str, cache_dir);
+    bool ok = nfa_to_dfa(&automaton, result);
+    free_nfa(&automaton);
+    if (ok)
+    {
+        minimize_dfa(result);
+    }
+
+    if (cache_dir != NULL)
+    {
+        if (ok)
+        {
+            char *temporary = temporary_path(&key);
+            publish_entry(temporary, save_dfa(result, temporary, key.bytes, key.length), &key);
+            free(temporary);
+        }
+        free_cache_key(&key);
+    }
+    return ok;
+}
@@ -0,0 +1,33 @@
+#ifndef COMPILE_CACHE_H
+#define COMPILE_CACHE_H
+
+#include "nfa.h"
+#include "dfa.h"
+
+/* Version of the compiler as seen by the cache. Change it whenever the same regex starts
+compiling into a different automaton, so entries written by older builds are not used */
+#define COMPILE_CACHE_VERSION 7
+
+/**
+ * @brief Compile a regex into an NFA, as parse_regex followed by regex_to_nfa. When a cache
+ * directory is given, the NFA is looked up there first under a hash of the regex text and the
+ * compile options, and it is saved there after compiling it. Entries are written to a temporary
+ * file and renamed into place, so processes sharing the directory never see a partial entry.
+ * Every entry also stores its full key, so a hash collision is a miss and not a wrong automaton.
+ * @param regex_str The regex
+ * @param cache_dir Directory of the cache, or NULL to always compile. It is created if missing
+ * @return The NFA of the regex
+ */
+nfa compile_nfa(const char *regex_str, const char *cache_dir);
+
+/**
+ * @brief Compile a regex into a minimal DFA, using the cache like compile_nfa. On a hit neither
+ * the NFA nor the subset construction are built.
+ * @param regex_str The regex
+ * @param cache_dir Directory of the cache, or NULL to always compile
+ * @param result Output for the DFA
+ * @return true on success, false if the DFA does not fit in DFA_MAX_BUDGET bytes
+ */
+bool compile_dfa(const char *regex_str, const char *cache_dir, dfa *result);
+
+#endif // COMPILE_CACHE_H
@@ -0,0 +1,753 @@
+#include "dfa.h"
+#include "lazy_dfa.h"
+#include "record_io.h"
+
+/* Magic number of DFA files, "DFA1" read as a little-endian integer */
+#define DFA_FILE_MAGIC 0x31414644
+/* Version of the format written by save_dfa */
+#define DFA_FILE_VERSION 1
+/* Written as is, so a file saved on a machine with another byte order is rejected */
+#define DFA_FILE_BYTE_ORDER 0x01020304
+
+/**
+ * @brief Header at the start of a DFA file. It is followed by char_to_col as 256 int32_t, the
+ * transition table, one accepting byte per state and the key.
+ */
+struct dfa_file_header
+{
+    uint32_t magic;
+    uint32_t version;
+    uint32_t byte_order;
+    uint32_t start_state;
+    int32_t dead_state;
+    uint32_t states;
+    int32_t columns;
+    uint32_t key_length;
+};
+typedef struct dfa_file_header dfa_file_header;
+
+/**
+ * @brief Find the dead state of a DFA: a non accepting state whose transitions all loop back
+ * to itself. In a minimized DFA every state that cannot reach an accept state ends up there.
+ * @param automaton Pointer to the DFA
+ * @return The dead state, or -1 if the DFA has none
+ */
+static int32_t find_dead_state(const dfa *automaton)
+{
+    for (uint32_t state = 0; state < automaton->states; state++)
+    {
+        if (automaton->accepting[state])
+        {
+            continue;
+        }
+
+        const int32_t *row = automaton->transitions + (size_t)state * automaton->columns;
+        int col = 0;
+        while (col < automaton->columns && row[col] == (int32_t)state)
+        {
+            col++;
+        }
+        if (col == automaton->columns)
+        {
+            return (int32_t)state;
+        }
+    }
+    return -1;
+}
+
+/**
+ * @brief Merge the columns of a DFA that no state tells apart, so that the transition table
+ * has one column per byte equivalence class of the DFA. Columns whose transitions all go to
+ * the dead state are dropped, and their bytes are rejected straight away by char_to_col.
+ * @param automaton Pointer to the DFA
+ */
+static void merge_equivalent_columns(dfa *automaton)
+{
+    const uint32_t n = automaton->states;
+    const int k = automaton->columns;
+
+    int col_map[256];
+    int first_col[256];
+    uint64_t hash[256];
+
+    // Hash every column so that only columns with the same hash are compared
+    for (int col = 0; col < k; col++)
+    {
+        hash[col] = 1469598103934665603ULL;
+        for (uint32_t state = 0; state < n; state++)
+        {
+            hash[col] ^= (uint64_t)(uint32_t)automaton->transitions[(size_t)state * k + col];
+            hash[col] *= 1099511628211ULL;
+        }
+    }
+
+    int merged_columns = 0;
+    for (int col = 0; col < k; col++)
+    {
+        col_map[col] = -2;
+
+        // A column that only leads to the dead state accepts nothing
+        if (automaton->dead_state != -1)
+        {
+            uint32_t state = 0;
+            while (state < n && automaton->transitions[(size_t)state * k + col] == automaton->dead_state)
+            {
+                state++;
+            }
+            if (state == n)
+            {
+                col_map[col] = -1;
+                continue;
+            }
+        }
+
+        for (int other = 0; other < col && col_map[col] == -2; other++)
+        {
+            if (col_map[other] < 0 || hash[other] != hash[col])
+            {
+                continue;
+            }
+
+            uint32_t state = 0;
+            while (state < n && automaton->transitions[(size_t)state * k + col] ==
+                                    automaton->transitions[(size_t)state * k + other])
+            {
+                state++;
+            }
+            if (state == n)
+            {
+                col_map[col] = col_map[other];
+            }
+        }
+
+        if (col_map[col] == -2)
+        {
+            first_col[merged_columns] = col;
+            col_map[col] = merged_columns++;
+        }
+    }
+
+    if (merged_columns == k)
+    {
+        return;
+    }
+
+    int32_t *transitions = malloc(((size_t)n * merged_columns + 1) * sizeof(int32_t));
+    if (transitions == NULL)
+    {
+        // Keeping the wider table is still correct
+        return;
+    }
+    for (uint32_t state = 0; state < n; state++)
+    {
+        for (int col = 0; col < merged_columns; col++)
+        {
+            transitions[(size_t)state * merged_columns + col] = automaton->transitions[(size_t)state * k + first_col[col]];
+        }
+    }
+    for (int c = 0; c < 256; c++)
+    {
+        int col = automaton->char_to_col[c];
+        automaton->char_to_col[c] = col == -1 ? -1 : col_map[col];
+    }
+
+    free(automaton->transitions);
+    automaton->transitions = transitions;
+    automaton->columns = merged_columns;
+}
+
+bool nfa_to_dfa(const nfa *automaton, dfa *result)
+{
+    // The subset construction is the lazy DFA with every transition computed.
+    // If the cache ever has to be flushed the DFA does not fit in the budget.
+    lazy_dfa *cache = new_lazy_dfa(automaton, DFA_MAX_BUDGET, false);
+    if (cache == NULL)
+    {
+        return false;
+    }
+
+    // The epsilon column (0) is not an input symbol, so the DFA column of
+    // an NFA column is col - 1.
+    const int columns = automaton->nfa_alphabet.symbol_count - 1;
+
+    for (uint32_t state = 0; state < cache->count && cache->flushes == 0; state++)
+    {
+        for (int col = 1; col <= columns && cache->flushes == 0; col++)
+        {
+            int32_t from = (int32_t)state;
+            lazy_dfa_next(cache, automaton, &from, col);
+        }
+    }
+
+    if (cache->flushes != 0)
+    {
+        free_lazy_dfa(cache);
+        return false;
+    }
+
+    // Number the states reachable from the start state in breadth first order,
+    // so that unreachable states (such as an unused dead state) are dropped.
+    int32_t *order = malloc(cache->count * sizeof(int32_t));
+    int32_t *number = malloc(cache->count * sizeof(int32_t));
+    if (order == NULL || number == NULL)
+    {
+        free(order);
+        free(number);
+        free_lazy_dfa(cache);
+        return false;
+    }
+    memset(number, -1, cache->count * sizeof(int32_t));
+
+    uint32_t reachable = 0;
+    order[reachable] = cache->start;
+    number[cache->start] = (int32_t)reachable++;
+    for (uint32_t i = 0; i < reachable; i++)
+    {
+        const int32_t *row = cache->next + (size_t)order[i] * cache->columns;
+        for (int col = 1; col <= columns; col++)
+        {
+            if (number[row[col]] == -1)
+            {
+                order[reachable] = row[col];
+                number[row[col]] = (int32_t)reachable++;
+            }
+        }
+    }
+
+    result->states = reachable;
+    result->start_state = 0;
+    result->columns = columns;
+    for (int c = 0; c < 256; c++)
+    {
+        int col = automaton->nfa_alphabet.char_to_col[c];
+        result->char_to_col[c] = col > 0 ? col - 1 : -1;
+    }
+
+    result->transitions = malloc(((size_t)reachable * columns + 1) * sizeof(int32_t));
+    result->accepting = malloc(reachable * sizeof(uint8_t));
+    if (result->transitions == NULL || result->accepting == NULL)
+    {
+        free(order);
+        free(number);
+        free_lazy_dfa(cache);
+        free_dfa(result);
+        return false;
+    }
+
+    for (uint32_t state = 0; state < reachable; state++)
+    {
+        const int32_t *row = cache->next + (size_t)order[state] * cache->columns;
+        for (int col = 1; col <= columns; col++)
+        {
+            result->transitions[(size_t)state * columns + col - 1] = number[row[col]];
+        }
+        result->accepting[state] = cache->accepting[order[state]];
+    }
+    result->dead_state = find_dead_state(result);
+    merge_equivalent_columns(result);
+
+    free(order);
+    free(number);
+    free_lazy_dfa(cache);
+    return true;
+}
+
+/**
+ * @brief Struct to hold the partition of the DFA states during Hopcroft's algorithm. The states
+ * of each block are stored contiguously in `elements`, in the range [first, end) of the block.
+ */
+struct partition
+{
+    /* States ordered by block */
+    int32_t *elements;
+    /* Position of each state in elements */
+    int32_t *location;
+    /* Block of each state */
+    int32_t *block_of;
+    /* First position of each block in elements */
+    int32_t *first;
+    /* One past the last position of each block in elements */
+    int32_t *end;
+    /* Number of marked states of each block, kept at the start of the block */
+    int32_t *marked;
+    /* Number of blocks */
+    int32_t count;
+};
+typedef struct partition partition;
+
+/**
+ * @brief Mark a state of the partition, moving it to the marked part of its block.
+ * @param p Pointer to the partition
+ * @param state The state to mark
+ * @param touched List of blocks with marked states, updated if the block had none
+ * @param touched_count Pointer to the number of blocks in the touched list
+ */
+static void mark_state(partition *p, int32_t state, int32_t *touched, int32_t *touched_count)
+{
+    int32_t block = p->block_of[state];
+    int32_t position = p->location[state];
+    int32_t target = p->first[block] + p->marked[block];
+
+    // Swap the state with the first unmarked state of the block
+    int32_t other = p->elements[target];
+    p->elements[target] = state;
+    p->location[state] = target;
+    p->elements[position] = other;
+    p->location[other] = position;
+
+    if (p->marked[block]++ == 0)
+    {
+        touched[(*touched_count)++] = block;
+    }
+}
+
+/**
+ * @brief Add a (block, column) splitter to the worklist unless it is already there.
+ */
+static void push_splitter(int32_t *worklist, int32_t *worklist_size, uint8_t *in_worklist, int columns, int32_t block, int col)
+{
+    if (!in_worklist[(size_t)block * columns + col])
+    {
+        in_worklist[(size_t)block * columns + col] = 1;
+        worklist[(*worklist_size)++] = block;
+        worklist[(*worklist_size)++] = col;
+    }
+}
+
+void minimize_dfa(dfa *automaton)
+{
+    const int32_t n = (int32_t)automaton->states;
+    const int k = automaton->columns;
+    if (n <= 1 || k == 0)
+    {
+        return;
+    }
+
+    // Inverse transitions: for every column, the predecessors of each state
+    // in compressed form. The predecessors of `state` on `col` are
+    // predecessors[pred_start[col * (n + 1) + state] .. pred_start[col * (n + 1) + state + 1]).
+    int32_t *pred_start = calloc((size_t)k * (n + 1), sizeof(int32_t));
+    int32_t *predecessors = malloc((size_t)k * n * sizeof(int32_t));
+
+    partition p;
+    p.elements = malloc(n * sizeof(int32_t));
+    p.location = malloc(n * sizeof(int32_t));
+    p.block_of = malloc(n * sizeof(int32_t));
+    p.first = malloc(n * sizeof(int32_t));
+    p.end = malloc(n * sizeof(int32_t));
+    p.marked = calloc(n, sizeof(int32_t));
+
+    // Each (block, column) pair is in the worklist at most once
+    int32_t *worklist = malloc(2 * (size_t)n * k * sizeof(int32_t));
+    uint8_t *in_worklist = calloc((size_t)n * k, sizeof(uint8_t));
+    int32_t *splitter = malloc(n * sizeof(int32_t));
+    int32_t *touched = malloc(n * sizeof(int32_t));
+
+    if (pred_start == NULL || predecessors == NULL || p.elements == NULL || p.location == NULL ||
+        p.block_of == NULL || p.first == NULL || p.end == NULL || p.marked == NULL ||
+        worklist == NULL || in_worklist == NULL || splitter == NULL || touched == NULL)
+    {
+        fprintf(stderr, "Error: Out of memory while minimizing the DFA.\n");
+        exit(EXIT_FAILURE);
+    }
+
+    // Count the predecessors, turn the counts into offsets, then fill them in.
+    for (int32_t state = 0; state < n; state++)
+    {
+        for (int col = 0; col < k; col++)
+        {
+            int32_t target = automaton->transitions[(size_t)state * k + col];
+            pred_start[(size_t)col * (n + 1) + target + 1]++;
+        }
+    }
+    for (int col = 0; col < k; col++)
+    {
+        int32_t *starts = pred_start + (size_t)col * (n + 1);
+        for (int32_t state = 0; state < n; state++)
+        {
+            starts[state + 1] += starts[state];
+        }
+    }
+    int32_t *fill = malloc((size_t)k * (n + 1) * sizeof(int32_t));
+    if (fill == NULL)
+    {
+        fprintf(stderr, "Error: Out of memory while minimizing the DFA.\n");
+        exit(EXIT_FAILURE);
+    }
+    memcpy(fill, pred_start, (size_t)k * (n + 1) * sizeof(int32_t));
+    for (int32_t state = 0; state < n; state++)
+    {
+        for (int col = 0; col < k; col++)
+        {
+            int32_t target = automaton->transitions[(size_t)state * k + col];
+            predecessors[(size_t)col * n + fill[(size_t)col * (n + 1) + target]++] = state;
+        }
+    }
+    free(fill);
+
+    // Initial partition: accept states first, then the rest.
+    int32_t accepting_count = 0;
+    for (int32_t state = 0; state < n; state++)
+    {
+        if (automaton->accepting[state])
+        {
+            accepting_count++;
+        }
+    }
+    int32_t next_accepting = 0;
+    int32_t next_rejecting = accepting_count;
+    for (int32_t state = 0; state < n; state++)
+    {
+        int32_t position = automaton->accepting[state] ? next_accepting++ : next_rejecting++;
+        p.elements[position] = state;
+        p.location[state] = position;
+    }
+
+    p.count = 0;
+    if (accepting_count > 0)
+    {
+        p.first[p.count] = 0;
+        p.end[p.count] = accepting_count;
+        p.count++;
+    }
+    if (accepting_count < n)
+    {
+        p.first[p.count] = accepting_count;
+        p.end[p.count] = n;
+        p.count++;
+    }
+    for (int32_t block = 0; block < p.count; block++)
+    {
+        for (int32_t i = p.first[block]; i < p.end[block]; i++)
+        {
+            p.block_of[p.elements[i]] = block;
+        }
+    }
+
+    // Only the smaller of the two initial blocks needs to be used as a splitter
+    int32_t worklist_size = 0;
+    if (p.count == 2)
+    {
+        int32_t smaller = (p.end[0] - p.first[0]) <= (p.end[1] - p.first[1]) ? 0 : 1;
+        for (int col = 0; col < k; col++)
+        {
+            push_splitter(worklist, &worklist_size, in_worklist, k, smaller, col);
+        }
+    }
+
+    while (worklist_size > 0)
+    {
+        int col = worklist[--worklist_size];
+        int32_t block = worklist[--worklist_size];
+        in_worklist[(size_t)block * k + col] = 0;
+
+        // Copy the splitter block, since marking may reorder its states
+        int32_t splitter_size = 0;
+        for (int32_t i = p.first[block]; i < p.end[block]; i++)
+        {
+            splitter[splitter_size++] = p.elements[i];
+        }
+
+        // Mark every state that goes into the splitter on this column
+        int32_t touched_count = 0;
+        const int32_t *starts = pred_start + (size_t)col * (n + 1);
+        const int32_t *preds = predecessors + (size_t)col * n;
+        for (int32_t i = 0; i < splitter_size; i++)
+        {
+            int32_t target = splitter[i];
+            for (int32_t j = starts[target]; j < starts[target + 1]; j++)
+            {
+                mark_state(&p, preds[j], touched, &touched_count);
+            }
+        }
+
+        // Split every block that has both marked and unmarked states
+        for (int32_t i = 0; i < touched_count; i++)
+        {
+            int32_t split = touched[i];
+            int32_t marked = p.marked[split];
+            p.marked[split] = 0;
+
+            if (marked == p.end[split] - p.first[split])
+            {
+                continue;
+            }
+
+            // The marked states become a new block
+            int32_t created = p.count++;
+            p.first[created] = p.first[split];
+            p.end[created] = p.first[split] + marked;
+            p.first[split] = p.end[created];
+            for (int32_t j = p.first[created]; j < p.end[created]; j++)
+            {
+                p.block_of[p.elements[j]] = created;
+            }
+
+            // If the old block was waiting as a splitter both halves must be used,
+            // otherwise the smaller half is enough.
+            int32_t created_size = p.end[created] - p.first[created];
+            int32_t split_size = p.end[split] - p.first[split];
+            int32_t smaller = created_size <= split_size ? created : split;
+            for (int c = 0; c < k; c++)
+            {
+                if (in_worklist[(size_t)split * k + c])
+                {
+                    push_splitter(worklist, &worklist_size, in_worklist, k, created, c);
+                }
+                else
+                {
+                    push_splitter(worklist, &worklist_size, in_worklist, k, smaller, c);
+                }
+            }
+        }
+    }
+
+    // Build the minimized DFA, with one state per block. The start
+    // state is renumbered to 0 by swapping its block with block 0.
+    int32_t start_block = p.block_of[automaton->start_state];
+    int32_t *number = malloc(p.count * sizeof(int32_t));
+    int32_t *transitions = malloc(((size_t)p.count * k + 1) * sizeof(int32_t));
+    uint8_t *accepting = malloc(p.count * sizeof(uint8_t));
+    if (number == NULL || transitions == NULL || accepting == NULL)
+    {
+        fprintf(stderr, "Error: Out of memory while minimizing the DFA.\n");
+        exit(EXIT_FAILURE);
+    }
+    for (int32_t block = 0; block < p.count; block++)
+    {
+        number[block] = block;
+    }
+    number[start_block] = 0;
+    number[0] = start_block;
+
+    for (int32_t block = 0; block < p.count; block++)
+    {
+        int32_t representative = p.elements[p.first[block]];
+        int32_t state = number[block];
+        for (int c = 0; c < k; c++)
+        {
+            int32_t target = automaton->transitions[(size_t)representative * k + c];
+            transitions[(size_t)state * k + c] = number[p.block_of[target]];
+        }
+        accepting[state] = automaton->accepting[representative];
+    }
+
+    free(automaton->transitions);
+    free(automaton->accepting);
+    automaton->transitions = transitions;
+    automaton->accepting = accepting;
+    automaton->states = (uint32_t)p.count;
+    automaton->start_state = 0;
+    automaton->dead_state = find_dead_state(automaton);
+    merge_equivalent_columns(automaton);
+
+    free(number);
+    free(pred_start);
+    free(predecessors);
+    free(p.elements);
+    free(p.location);
+    free(p.block_of);
+    free(p.first);
+    free(p.end);
+    free(p.marked);
+    free(worklist);
+    free(in_worklist);
+    free(splitter);
+    free(touched);
+}
+
+bool match_dfa(const dfa *automaton, const char *input, size_t input_length)
+{
+    const int32_t *transitions = automaton->transitions;
+    const int columns = automaton->columns;
+    const int32_t dead_state = automaton->dead_state;
+    int32_t state = (int32_t)automaton->start_state;
+
+    // Process each input character.
+    for (size_t i = 0; i < input_length; i++)
+    {
+        int col = automaton->char_to_col[(unsigned char)input[i]];
+
+        // If the symbol is not in the alphabet, no transitions are possible.
+        if (col == -1)
+        {
+            return false;
+        }
+
+        state = transitions[(size_t)state * columns + col];
+
+        // Once in the dead state the input can no longer be accepted.
+        if (state == dead_state)
+        {
+            return false;
+        }
+    }
+
+    return automaton->accepting[state] != 0;
+}
+
+bool save_dfa(const dfa *automaton, const char *file_path, const char *key, size_t key_length)
+{
+    if (automaton == NULL || file_path == NULL || automaton->states == 0 || key_length > UINT32_MAX)
+    {
+        return false;
+    }
+
+    dfa_file_header header;
+    header.magic = DFA_FILE_MAGIC;
+    header.version = DFA_FILE_VERSION;
+    header.byte_order = DFA_FILE_BYTE_ORDER;
+    header.start_state = automaton->start_state;
+    header.dead_state = automaton->dead_state;
+    header.states = automaton->states;
+    header.columns = automaton->columns;
+    header.key_length = (uint32_t)key_length;
+
+    int32_t char_to_col[256];
+    for (int c = 0; c < 256; c++)
+    {
+        char_to_col[c] = automaton->char_to_col[c];
+    }
+
+    FILE *file = fopen(file_path, "wb");
+    if (file == NULL)
+    {
+        return false;
+    }
+
+    const size_t entries = (size_t)automaton->states * (size_t)automaton->columns;
+    bool ok = fwrite(&header, sizeof(header), 1, file) == 1 &&
+              fwrite(char_to_col, sizeof(char_to_col), 1, file) == 1 &&
+              fwrite(automaton->transitions, sizeof(int32_t), entries, file) == entries &&
+              fwrite(automaton->accepting, 1, automaton->states, file) == automaton->states &&
+              (key_length == 0 || fwrite(key, 1, key_length, file) == key_length);
+
+    if (fclose(file) != 0)
+    {
+        return false;
+    }
+    return ok;
+}
+
+/**
+ * @brief Check the header and the tables of a DFA file before they are copied.
+ * @param data The bytes of the file
+ * @param length Size of the file
+ * @param header Output for the header
+ * @return true if the file describes a valid DFA, false otherwise
+ */
+static bool validate_dfa_file(const char *data, size_t length, dfa_file_header *header)
+{
+    if (length < sizeof(*header))
+    {
+        return false;
+    }
+    memcpy(header, data, sizeof(*header));
+
+    if (header->magic != DFA_FILE_MAGIC || header->version != DFA_FILE_VERSION ||
+        header->byte_order != DFA_FILE_BYTE_ORDER || header->states == 0 || header->columns < 1 ||
+        header->columns > 257 || header->start_state >= header->states || header->dead_state < -1 ||
+        header->dead_state >= (int64_t)header->states)
+    {
+        return false;
+    }
+
+    // Sizes fit in 64 bits: states and key_length are 32-bit and columns is at most 257
+    const uint64_t entries = (uint64_t)header->states * (uint64_t)header->columns;
+    const uint64_t expected = sizeof(*header) + 256 * sizeof(int32_t) + entries * sizeof(int32_t) +
+                              header->states + header->key_length;
+    if (expected != length)
+    {
+        return false;
+    }
+
+    const char *tables = data + sizeof(*header);
+    for (int c = 0; c < 256; c++)
+    {
+        int32_t col;
+        memcpy(&col, tables + (size_t)c * sizeof(int32_t), sizeof(col));
+        if (col < -1 || col >= header->columns)
+        {
+            return false;
+        }
+    }
+    tables += 256 * sizeof(int32_t);
+    for (uint64_t i = 0; i < entries; i++)
+    {
+        int32_t target;
+        memcpy(&target, tables + i * sizeof(int32_t), sizeof(target));
+        if (target < 0 || (uint32_t)target >= header->states)
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool load_dfa(const char *file_path, dfa *automaton, const char *key, size_t key_length)
+{
+    mapped_input input;
+    if (!map_input(file_path, &input))
+    {
+        return false;
+    }
+
+    // The key is at the end of the file
+    dfa_file_header header;
+    if (!validate_dfa_file(input.data, input.length, &header) ||
+        (key != NULL && (header.key_length != key_length ||
+                         memcmp(input.data + input.length - key_length, key, key_length) != 0)))
+    {
+        unmap_input(&input);
+        return false;
+    }
+
+    const size_t entries = (size_t)header.states * (size_t)header.columns;
+    dfa result;
+    result.start_state = header.start_state;
+    result.dead_state = header.dead_state;
+    result.states = header.states;
+    result.columns = header.columns;
+    result.transitions = malloc((entries + 1) * sizeof(int32_t));
+    result.accepting = malloc(header.states);
+    if (result.transitions == NULL || result.accepting == NULL)
+    {
+        fprintf(stderr, "Error: Out of memory while loading the DFA.\n");
+        exit(EXIT_FAILURE);
+    }
+
+    const char *tables = input.data + sizeof(header);
+    for (int c = 0; c < 256; c++)
+    {
+        int32_t col;
+        memcpy(&col, tables + (size_t)c * sizeof(int32_t), sizeof(col));
+        result.char_to_col[c] = col;
+    }
+    tables += 256 * sizeof(int32_t);
+    memcpy(result.transitions, tables, entries * sizeof(int32_t));
+    tables += entries * sizeof(int32_t);
+    for (uint32_t state = 0; state < header.states; state++)
+    {
+        result.accepting[state] = tables[state] != 0;
+    }
+
+    unmap_input(&input);
+    *automaton = result;
+    return true;
+}
+
+void free_dfa(dfa *automaton)
+{
+    if (automaton == NULL)
+    {
+        return;
+    }
+
+    free(automaton->transitions);
+    free(automaton->accepting);
+
+    automaton->transitions = NULL;
+    automaton->accepting = NULL;
+    automaton->states = 0;
+    automaton->columns = 0;
+}
@@ -0,0 +1,86 @@
+#ifndef DFA_H
+#define DFA_H
+
+#include "nfa.h"
+
+/* Maximum memory used by the subset construction while determinizing an NFA, in bytes */
+#ifndef DFA_MAX_BUDGET
+#define DFA_MAX_BUDGET (256 << 20)
+#endif
+
+/**
+ * @brief Struct to represent a deterministic finite automaton (DFA). The DFA is complete: every
+ * state has exactly one transition per column, and the states from which no accept state can be
+ * reached are merged into a single dead state. The transition table is a dense
+ * states x columns matrix of state ids.
+ */
+struct DFA
+{
+    /* State id for the start state */
+    uint32_t start_state;
+    /* State id of the dead state, or -1 if every state can still reach an accept state */
+    int32_t dead_state;
+    /* Number of states in the DFA */
+    uint32_t states;
+    /* Number of columns in the transition table */
+    int columns;
+    /* Mapping from character to column, -1 for characters that no transition accepts */
+    int char_to_col[256];
+    /* Transition table. Entry `state * columns + col` is the target state */
+    int32_t *transitions;
+    /* 1 for accept states, 0 otherwise */
+    uint8_t *accepting;
+};
+typedef struct DFA dfa;
+
+/**
+ * @brief Convert an NFA into an equivalent DFA using the subset construction.
+ * @param automaton Pointer to the NFA to determinize
+ * @param result Output for the DFA
+ * @return true on success, false if the DFA does not fit in DFA_MAX_BUDGET bytes
+ */
+bool nfa_to_dfa(const nfa *automaton, dfa *result);
+
+/**
+ * @brief Minimize a DFA in place using Hopcroft's partition refinement algorithm.
+ * @param automaton Pointer to the DFA to minimize
+ */
+void minimize_dfa(dfa *automaton);
+
+/**
+ * @brief Function to check if a given input string is accepted by the DFA.
+ * @param automaton Pointer to the DFA
+ * @param input The input string to check
+ * @param input_length The length of the input string
+ * @return true if the DFA accepts the input string, false otherwise
+ */
+bool match_dfa(const dfa *automaton, const char *input, size_t input_length);
+
+/**
+ * @brief Serialize a DFA to a binary file (format DFA1), together with a key such as the text the
+ * DFA was built from.
+ * @param automaton Pointer to the DFA to serialize
+ * @param file_path Output file path
+ * @param key The bytes of the key
+ * @param key_length Number of bytes of the key
+ * @return true if the file was written successfully, false otherwise
+ */
+bool save_dfa(const dfa *automaton, const char *file_path, const char *key, size_t key_length);
+
+/**
+ * @brief Load a DFA saved by save_dfa. The file is validated before it is used.
+ * @param file_path Path of the file
+ * @param automaton Output for the DFA. Release it with free_dfa
+ * @param key The bytes of the expected key, or NULL to accept any key
+ * @param key_length Number of bytes of the key
+ * @return true if the file holds a valid DFA saved under the key, false otherwise
+ */
+bool load_dfa(const char *file_path, dfa *automaton, const char *key, size_t key_length);
+
+/**
+ * @brief Release heap memory owned by a DFA.
+ * @param automaton Pointer to the DFA to free
+ */
+void free_dfa(dfa *automaton);
+
+#endif // DFA_H
@@ -0,0 +1,309 @@
+#include "glushkov.h"
+#include <stdlib.h>
+#include <string.h>
+
+/**
+ * @brief Struct to represent a subexpression while building the Glushkov automaton. It keeps
+ * the sets of positions that can start and end a match of the subexpression, and whether the
+ * subexpression accepts the empty string.
+ */
+struct glushkov_fragment
+{
+    /* Positions that can match the first byte */
+    uint64_t first;
+    /* Positions that can match the last byte */
+    uint64_t last;
+    /* Whether the subexpression accepts the empty string */
+    bool nullable;
+    /* First position of the subexpression. Its positions go from here to the last one created */
+    int first_position;
+};
+typedef struct glushkov_fragment g_fragment;
+
+/**
+ * @brief Add a set of positions to the follow set of every position in another set.
+ * @param follow Array with the follow set of each position
+ * @param from The positions whose follow sets grow
+ * @param to The positions to add
+ */
+static void add_follow(uint64_t *follow, uint64_t from, uint64_t to)
+{
+    for (int position = 0; position < 64; position++)
+    {
+        if ((from & (1ULL << position)) != 0)
+        {
+            follow[position] |= to;
+        }
+    }
+}
+
+/**
+ * @brief Concatenate two subexpressions.
+ * @param follow Array with the follow set of each position
+ * @param a The first subexpression
+ * @param b The second subexpression
+ * @return The concatenation
+ */
+static g_fragment concatenate_fragments(uint64_t *follow, const g_fragment *a, const g_fragment *b)
+{
+    g_fragment fragment;
+
+    // The last positions of a are followed by the first positions of b
+    add_follow(follow, a->last, b->first);
+    fragment.first = a->first | (a->nullable ? b->first : 0);
+    fragment.last = b->last | (b->nullable ? a->last : 0);
+    fragment.nullable = a->nullable && b->nullable;
+    fragment.first_position = a->first_position;
+    return fragment;
+}
+
+/**
+ * @brief Repeat a subexpression as x{min,max}, which is the same language as min copies of x
+ * followed by max - min copies of x?, or by x* when there is no upper bound. The copies are new
+ * positions with the labels and the inner follow sets of the original ones.
+ * @param follow Array with the follow set of each position
+ * @param labels Array with the label of each position
+ * @param positions Pointer to the number of positions so far
+ * @param a The subexpression, whose positions are the last ones created
+ * @param min The least number of copies
+ * @param max The largest number of copies, or -1 when unbounded
+ * @param result Output for the repetition
+ * @return true on success, false if the copies do not fit in GLUSHKOV_MAX_POSITIONS
+ */
+static bool repeat_fragment(uint64_t *follow, byte_set *labels, int *positions, const g_fragment *a, int min,
+                            int max, g_fragment *result)
+{
+    const int count = *positions - a->first_position;
+    const int copies = max != -1 ? max : (min > 0 ? min : 1);
+    if (copies > 1 && *positions + (copies - 1) * count > GLUSHKOV_MAX_POSITIONS + 1)
+    {
+        return false;
+    }
+
+    // Make every copy before any follow set points out of the original positions. Until then,
+    // positions are only followed by positions of the same subexpression, so shifting the follow
+    // sets moves them to the copy.
+    g_fragment parts[GLUSHKOV_MAX_POSITIONS];
+    for (int copy = 0; copy < copies; copy++)
+    {
+        parts[copy] = *a;
+        if (copy > 0)
+        {
+            const int offset = *positions - a->first_position;
+            for (int position = a->first_position; position < a->first_position + count; position++)
+            {
+                labels[position + offset] = labels[position];
+                follow[position + offset] = follow[position] << offset;
+            }
+            parts[copy].first <<= offset;
+            parts[copy].last <<= offset;
+            *positions += count;
+        }
+    }
+
+    // Start from the empty string, which concatenates with anything
+    g_fragment repeated;
+    repeated.first = 0;
+    repeated.last = 0;
+    repeated.nullable = true;
+    repeated.first_position = a->first_position;
+
+    for (int copy = 0; copy < copies; copy++)
+    {
+        if (max == -1 && copy == copies - 1)
+        {
+            // The last positions loop back to the first ones
+            add_follow(follow, parts[copy].last, parts[copy].first);
+        }
+        parts[copy].nullable = parts[copy].nullable || copy >= min;
+        repeated = concatenate_fragments(follow, &repeated, &parts[copy]);
+    }
+
+    *result = repeated;
+    return true;
+}
+
+bool regex_to_glushkov(const regex r, glushkov *result)
+{
+    uint64_t follow[64];
+    byte_set labels[64];
+    memset(follow, 0, sizeof(follow));
+
+    g_fragment *stack = malloc((r.size > 0 ? r.size : 1) * sizeof(g_fragment));
+    if (stack == NULL)
+    {
+        return false;
+    }
+    int stack_top = -1;
+    int positions = 1;
+    bool valid = true;
+
+    for (int i = 0; i < r.size && valid; i++)
+    {
+        item current_item = r.items[i];
+
+        if (current_item.type == OPERAND)
+        {
+            if (positions > GLUSHKOV_MAX_POSITIONS)
+            {
+                valid = false;
+                break;
+            }
+
+            // Every operand is a new position
+            labels[positions] = current_item.bytes;
+
+            g_fragment fragment;
+            fragment.first = 1ULL << positions;
+            fragment.last = 1ULL << positions;
+            fragment.nullable = false;
+            fragment.first_position = positions;
+            stack[++stack_top] = fragment;
+            positions++;
+            continue;
+        }
+
+        int operands = (current_item.type == CONCATENATION || current_item.type == ALTERNATION) ? 2 : 1;
+        if (stack_top + 1 < operands)
+        {
+            valid = false;
+            break;
+        }
+
+        if (current_item.type == CONCATENATION)
+        {
+            g_fragment b = stack[stack_top--];
+            g_fragment a = stack[stack_top--];
+            stack[++stack_top] = concatenate_fragments(follow, &a, &b);
+        }
+        else if (current_item.type == ALTERNATION)
+        {
+            g_fragment b = stack[stack_top--];
+            g_fragment a = stack[stack_top--];
+            g_fragment fragment;
+
+            fragment.first = a.first | b.first;
+            fragment.last = a.last | b.last;
+            fragment.nullable = a.nullable || b.nullable;
+            fragment.first_position = a.first_position;
+            stack[++stack_top] = fragment;
+        }
+        else if (current_item.type == POSITIVE_CLOSURE || current_item.type == KLEENE_STAR)
+        {
+            // The last positions loop back to the first ones
+            g_fragment *fragment = &stack[stack_top];
+            add_follow(follow, fragment->last, fragment->first);
+            if (current_item.type == KLEENE_STAR)
+            {
+                fragment->nullable = true;
+            }
+        }
+        else if (current_item.type == OPTIONAL)
+        {
+            stack[stack_top].nullable = true;
+        }
+        else if (current_item.type == REPETITION)
+        {
+            g_fragment a = stack[stack_top];
+            valid = repeat_fragment(follow, labels, &positions, &a, current_item.min, current_item.max,
+                                    &stack[stack_top]);
+        }
+    }
+
+    if (!valid || stack_top != 0)
+    {
+        free(stack);
+        return false;
+    }
+
+    g_fragment root = stack[0];
+    free(stack);
+
+    // The initial position is followed by the first positions of the regex
+    follow[0] = root.first;
+
+    memset(result, 0, sizeof(glushkov));
+    result->positions = positions;
+    result->accept_mask = root.last | (root.nullable ? 1ULL : 0);
+
+    for (int position = 1; position < positions; position++)
+    {
+        for (int byte = 0; byte < 256; byte++)
+        {
+            if (byte_set_contains(&labels[position], (unsigned char)byte))
+            {
+                result->byte_masks[byte] |= 1ULL << position;
+            }
+        }
+    }
+
+    // Split each follow set into the shift edge p -> p + 1, if present, and the rest
+    uint64_t rest[64];
+    for (int position = 0; position < positions; position++)
+    {
+        rest[position] = follow[position];
+        if (position + 1 < 64 && (follow[position] & (1ULL << (position + 1))) != 0)
+        {
+            result->shift_mask |= 1ULL << position;
+            rest[position] &= ~(1ULL << (position + 1));
+        }
+    }
+
+    // Tabulate the remaining edges by chunks of 8 positions
+    for (int chunk = 0; chunk * 8 < positions; chunk++)
+    {
+        bool used = false;
+        for (int bits = 0; bits < 256; bits++)
+        {
+            uint64_t set = 0;
+            for (int i = 0; i < 8; i++)
+            {
+                int position = chunk * 8 + i;
+                if ((bits & (1 << i)) != 0 && position < positions)
+                {
+                    set |= rest[position];
+                }
+            }
+            result->follow_tables[chunk][bits] = set;
+            used = used || set != 0;
+        }
+        if (used)
+        {
+            result->table_chunks[result->table_chunk_count++] = (uint8_t)chunk;
+        }
+    }
+
+    return true;
+}
+
+bool match_glushkov(const glushkov *automaton, const char *input, size_t input_length)
+{
+    const uint64_t shift_mask = automaton->shift_mask;
+    const int table_chunk_count = automaton->table_chunk_count;
+
+    // Start at the initial position
+    uint64_t active = 1;
+
+    // Process each input character.
+    for (size_t i = 0; i < input_length; i++)
+    {
+        // Positions that follow the active ones: shift edges first, then the tables
+        uint64_t next = (active & shift_mask) << 1;
+        for (int k = 0; k < table_chunk_count; k++)
+        {
+            int chunk = automaton->table_chunks[k];
+            next |= automaton->follow_tables[chunk][(active >> (chunk * 8)) & 0xFF];
+        }
+
+        // Keep only the positions whose symbol is the input byte
+        active = next & automaton->byte_masks[(unsigned char)input[i]];
+
+        // If there are no active positions, the input is rejected.
+        if (active == 0)
+        {
+            return false;
+        }
+    }
+
+    return (active & automaton->accept_mask) != 0;
+}
@@ -0,0 +1,59 @@
+#ifndef GLUSHKOV_H
+#define GLUSHKOV_H
+
+#include "regex.h"
+#include "byte_classes.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* Maximum number of symbol positions of a Glushkov automaton. Bit 0 is the initial position */
+#define GLUSHKOV_MAX_POSITIONS 63
+/* Number of 8-bit chunks in a 64-bit set of positions */
+#define GLUSHKOV_CHUNKS 8
+
+/**
+ * @brief Struct to represent a Glushkov (position) automaton simulated with bit-parallelism.
+ * Each operand of the regex is a position, numbered from 1 in the order it appears, and
+ * position 0 is the initial state. The automaton has no epsilon transitions: reading a byte
+ * moves from the active positions to the positions that follow them and accept the byte.
+ * Sets of positions are 64-bit masks, so each input byte costs a handful of word operations.
+ */
+struct glushkov
+{
+    /* Positions p such that p + 1 follows p. Those follow edges are taken with a shift */
+    uint64_t shift_mask;
+    /** Follow sets of the edges that are not shifts, grouped by 8-bit chunks of positions:
+     * follow_tables[k][b] is the union of the follow sets of the positions 8k+i for each bit i of b */
+    uint64_t follow_tables[GLUSHKOV_CHUNKS][256];
+    /* Chunks of positions that have follow edges that are not shifts */
+    uint8_t table_chunks[GLUSHKOV_CHUNKS];
+    /* Number of entries in table_chunks */
+    int table_chunk_count;
+    /* For each byte, the positions whose symbol accepts it */
+    uint64_t byte_masks[256];
+    /* Positions where a match can end, including position 0 if the regex accepts the empty string */
+    uint64_t accept_mask;
+    /* Number of positions, including the initial one */
+    int positions;
+};
+typedef struct glushkov glushkov;
+
+/**
+ * @brief Build the Glushkov automaton of a regular expression in postfix notation.
+ * @param r The input regular expression as a regex struct
+ * @param result Output for the Glushkov automaton
+ * @return true on success, false if the regex has more than GLUSHKOV_MAX_POSITIONS operands
+ */
+bool regex_to_glushkov(const regex r, glushkov *result);
+
+/**
+ * @brief Function to check if a given input string is accepted by the Glushkov automaton.
+ * @param automaton Pointer to the Glushkov automaton
+ * @param input The input string to check
+ * @param input_length The length of the input string
+ * @return true if the input string is accepted, false otherwise
+ */
+bool match_glushkov(const glushkov *automaton, const char *input, size_t input_length);
+
+#endif // GLUSHKOV_H
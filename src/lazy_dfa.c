@@ -0,0 +1,339 @@
+#include "lazy_dfa.h"
+
+/* Number of DFA states the cache has room for right after creation */
+#define LAZY_DFA_INITIAL_CAPACITY 16
+
+/**
+ * @brief Hash a state set with FNV-1a over its words.
+ * @param set The state set
+ * @param words Number of words in the set
+ * @return The hash of the set
+ */
+static uint64_t hash_state_set(const uint64_t *set, size_t words)
+{
+    uint64_t hash = 1469598103934665603ULL;
+    for (size_t w = 0; w < words; w++)
+    {
+        hash ^= set[w];
+        hash *= 1099511628211ULL;
+    }
+    return hash ^ (hash >> 32);
+}
+
+/**
+ * @brief Find the DFA state for a state set.
+ * @param cache Pointer to the lazy DFA cache
+ * @param set The state set to look for
+ * @param bucket Output for the bucket where the set is, or where it should be inserted
+ * @return The DFA state, or -1 if the set is not in the cache
+ */
+static int32_t find_state(const lazy_dfa *cache, const uint64_t *set, uint32_t *bucket)
+{
+    uint32_t mask = cache->bucket_count - 1;
+    uint32_t index = (uint32_t)hash_state_set(set, cache->words) & mask;
+
+    while (cache->buckets[index] != -1)
+    {
+        int32_t state = cache->buckets[index];
+        if (state_set_equal(cache->sets + (size_t)state * cache->words, set, cache->words))
+        {
+            *bucket = index;
+            return state;
+        }
+        index = (index + 1) & mask;
+    }
+
+    *bucket = index;
+    return -1;
+}
+
+/**
+ * @brief Resize the cache arrays to hold the given number of DFA states, and rebuild the hash table.
+ * @param cache Pointer to the lazy DFA cache
+ * @param capacity The new number of DFA states
+ * @return true on success, false if the memory could not be allocated
+ */
+static bool resize_cache(lazy_dfa *cache, uint32_t capacity)
+{
+    uint64_t *sets = realloc(cache->sets, (size_t)capacity * cache->words * sizeof(uint64_t));
+    if (sets == NULL)
+    {
+        return false;
+    }
+    cache->sets = sets;
+
+    int32_t *next = realloc(cache->next, (size_t)capacity * cache->columns * sizeof(int32_t));
+    if (next == NULL)
+    {
+        return false;
+    }
+    cache->next = next;
+
+    uint8_t *accepting = realloc(cache->accepting, capacity * sizeof(uint8_t));
+    if (accepting == NULL)
+    {
+        return false;
+    }
+    cache->accepting = accepting;
+
+    // Keep the hash table at most half full
+    uint32_t bucket_count = 1;
+    while (bucket_count < capacity * 2)
+    {
+        bucket_count *= 2;
+    }
+    int32_t *buckets = malloc(bucket_count * sizeof(int32_t));
+    if (buckets == NULL)
+    {
+        return false;
+    }
+    free(cache->buckets);
+    cache->buckets = buckets;
+    cache->bucket_count = bucket_count;
+    cache->capacity = capacity;
+
+    // Re-insert the existing states
+    memset(cache->buckets, -1, bucket_count * sizeof(int32_t));
+    for (uint32_t state = 0; state < cache->count; state++)
+    {
+        uint32_t bucket;
+        find_state(cache, cache->sets + (size_t)state * cache->words, &bucket);
+        cache->buckets[bucket] = (int32_t)state;
+    }
+
+    return true;
+}
+
+/**
+ * @brief Add a state set to the cache as a new DFA state, with all its transitions unknown.
+ * @param cache Pointer to the lazy DFA cache
+ * @param automaton Pointer to the NFA
+ * @param set The state set of the new DFA state
+ * @return The new DFA state, or -1 if the cache is full
+ */
+static int32_t add_state(lazy_dfa *cache, const nfa *automaton, const uint64_t *set)
+{
+    if (cache->count == cache->capacity)
+    {
+        uint32_t capacity = cache->capacity * 2;
+        if (capacity > cache->max_states)
+        {
+            capacity = cache->max_states;
+        }
+        if (capacity <= cache->capacity || !resize_cache(cache, capacity))
+        {
+            return -1;
+        }
+    }
+
+    int32_t state = (int32_t)cache->count++;
+    state_set_copy(cache->sets + (size_t)state * cache->words, set, cache->words);
+    memset(cache->next + (size_t)state * cache->columns, -1, cache->columns * sizeof(int32_t));
+    cache->accepting[state] = state_set_intersects(set, automaton->accept_states, cache->words) ? 1 : 0;
+
+    uint32_t bucket;
+    find_state(cache, set, &bucket);
+    cache->buckets[bucket] = state;
+
+    return state;
+}
+
+/**
+ * @brief Get the DFA state for a state set, adding it to the cache if needed.
+ * @param cache Pointer to the lazy DFA cache
+ * @param automaton Pointer to the NFA
+ * @param set The state set
+ * @return The DFA state, or -1 if the set is new and the cache is full
+ */
+static int32_t intern_state(lazy_dfa *cache, const nfa *automaton, const uint64_t *set)
+{
+    uint32_t bucket;
+    int32_t state = find_state(cache, set, &bucket);
+    if (state != -1)
+    {
+        return state;
+    }
+    return add_state(cache, automaton, set);
+}
+
+/**
+ * @brief Drop every cached DFA state and add back the start and dead states.
+ * @param cache Pointer to the lazy DFA cache
+ * @param automaton Pointer to the NFA
+ */
+static void flush_cache(lazy_dfa *cache, const nfa *automaton)
+{
+    cache->count = 0;
+    memset(cache->buckets, -1, cache->bucket_count * sizeof(int32_t));
+    cache->flushes++;
+
+    uint64_t *empty = cache->scratch + 2 * (size_t)cache->words;
+    state_set_clear(empty, cache->words);
+    cache->dead = add_state(cache, automaton, empty);
+    cache->start = add_state(cache, automaton, automaton->start_states);
+}
+
+lazy_dfa *new_lazy_dfa(const nfa *automaton, size_t budget, bool unanchored)
+{
+    lazy_dfa *cache = calloc(1, sizeof(lazy_dfa));
+    if (cache == NULL)
+    {
+        return NULL;
+    }
+    cache->unanchored = unanchored;
+
+    cache->words = automaton->words;
+    cache->columns = automaton->nfa_alphabet.symbol_count;
+
+    // Every DFA state costs its state set, its row of transitions,
+    // its accepting flag and (at most) two hash buckets.
+    size_t state_cost = cache->words * sizeof(uint64_t) + cache->columns * sizeof(int32_t) +
+                        sizeof(uint8_t) + 2 * sizeof(int32_t);
+    size_t max_states = budget / state_cost;
+    if (max_states > INT32_MAX / 2)
+    {
+        max_states = INT32_MAX / 2;
+    }
+
+    // The start and dead states are always present, so a cache with room for
+    // only a few more states would do nothing but flush.
+    if (max_states < 8)
+    {
+        free(cache);
+        return NULL;
+    }
+    cache->max_states = (uint32_t)max_states;
+
+    cache->scratch = malloc(3 * (size_t)cache->words * sizeof(uint64_t));
+    uint32_t capacity = LAZY_DFA_INITIAL_CAPACITY < cache->max_states ? LAZY_DFA_INITIAL_CAPACITY : cache->max_states;
+    if (cache->scratch == NULL || !resize_cache(cache, capacity))
+    {
+        free_lazy_dfa(cache);
+        return NULL;
+    }
+
+    flush_cache(cache, automaton);
+    cache->flushes = 0;
+
+    return cache;
+}
+
+/**
+ * @brief Compute a missing transition and store it in the cache. If the target state set is
+ * new and the cache is full, the cache is flushed first, which renumbers the DFA states.
+ * @param cache Pointer to the lazy DFA cache
+ * @param automaton Pointer to the NFA
+ * @param from Pointer to the source DFA state, updated if the cache is flushed
+ * @param col The column of the input symbol
+ * @return The target DFA state
+ */
+static int32_t compute_transition(lazy_dfa *cache, const nfa *automaton, int32_t *from, int col)
+{
+    uint64_t *target = cache->scratch;
+    uint64_t *source = cache->scratch + cache->words;
+
+    nfa_step(automaton, cache->sets + (size_t)*from * cache->words, col, target);
+
+    // Searching: a new match may start right after this byte
+    if (cache->unanchored)
+    {
+        state_set_or(target, automaton->start_states, cache->words);
+    }
+
+    int32_t to = intern_state(cache, automaton, target);
+    if (to == -1)
+    {
+        // The cache is full: keep the source set, start over with an empty
+        // cache, and add both the source and the target sets again.
+        state_set_copy(source, cache->sets + (size_t)*from * cache->words, cache->words);
+        flush_cache(cache, automaton);
+        *from = intern_state(cache, automaton, source);
+        to = intern_state(cache, automaton, target);
+    }
+
+    cache->next[(size_t)*from * cache->columns + col] = to;
+    return to;
+}
+
+int32_t lazy_dfa_next(lazy_dfa *cache, const nfa *automaton, int32_t *state, int col)
+{
+    int32_t next = cache->next[(size_t)*state * cache->columns + col];
+    if (next == -1)
+    {
+        next = compute_transition(cache, automaton, state, col);
+    }
+    return next;
+}
+
+int32_t lazy_dfa_state(lazy_dfa *cache, const nfa *automaton, const uint64_t *set)
+{
+    uint64_t *copy = cache->scratch + cache->words;
+    state_set_copy(copy, set, cache->words);
+
+    int32_t state = intern_state(cache, automaton, copy);
+    if (state == -1)
+    {
+        flush_cache(cache, automaton);
+        state = intern_state(cache, automaton, copy);
+    }
+    return state;
+}
+
+bool match_lazy_dfa(lazy_dfa *cache, const nfa *automaton, const char *input, size_t input_length)
+{
+    const int *char_to_col = automaton->nfa_alphabet.char_to_col;
+    const int columns = cache->columns;
+    uint64_t flushes_at_start = cache->flushes;
+
+    int32_t state = cache->start;
+
+    // Process each input character.
+    for (size_t i = 0; i < input_length; i++)
+    {
+        int col = char_to_col[(unsigned char)input[i]];
+
+        // If the symbol is not in the alphabet, no transitions are possible.
+        if (col == -1)
+        {
+            return false;
+        }
+
+        int32_t next = cache->next[(size_t)state * columns + col];
+        if (next == -1)
+        {
+            // The cache is thrashing on this input: continue with the plain
+            // simulation from the current set of NFA states.
+            if (cache->flushes - flushes_at_start >= LAZY_DFA_MAX_FLUSHES)
+            {
+                state_set_copy(cache->scratch, cache->sets + (size_t)state * cache->words, cache->words);
+                return simulate_nfa(automaton, cache->scratch, input + i, input_length - i);
+            }
+            next = compute_transition(cache, automaton, &state, col);
+        }
+        state = next;
+
+        // If there are no current states, the input is rejected.
+        if (state == cache->dead)
+        {
+            return false;
+        }
+    }
+
+    // Check if any of the current states are accept states.
+    return cache->accepting[state] != 0;
+}
+
+void free_lazy_dfa(lazy_dfa *cache)
+{
+    if (cache == NULL)
+    {
+        return;
+    }
+
+    free(cache->sets);
+    free(cache->next);
+    free(cache->accepting);
+    free(cache->buckets);
+    free(cache->scratch);
+    free(cache);
+}
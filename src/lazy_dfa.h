@@ -0,0 +1,113 @@
+#ifndef LAZY_DFA_H
+#define LAZY_DFA_H
+
+#include "nfa.h"
+
+/* Default memory budget of a lazy DFA cache, in bytes */
+#ifndef LAZY_DFA_DEFAULT_BUDGET
+#define LAZY_DFA_DEFAULT_BUDGET (1 << 20)
+#endif
+/* Number of cache flushes allowed while matching one input before falling back to the NFA simulation */
+#define LAZY_DFA_MAX_FLUSHES 8
+
+/**
+ * @brief Struct to represent a lazy DFA. It builds the DFA of an NFA on the fly: each DFA state
+ * is a set of NFA states, and the transition (state, column) is only computed the first time
+ * the matcher needs it. Known transitions are cached, so in steady state matching is one table
+ * lookup per input byte. The cache never grows beyond its memory budget; when it is full it is
+ * flushed and rebuilt from the current state.
+ */
+struct lazy_dfa
+{
+    /* Number of 64-bit words in each state set (same as the NFA) */
+    uint32_t words;
+    /* Number of columns in the transition table (the NFA symbol count) */
+    int columns;
+
+    /* Number of DFA states currently in the cache */
+    uint32_t count;
+    /* Number of DFA states the arrays below have room for */
+    uint32_t capacity;
+    /* Maximum number of DFA states allowed by the memory budget */
+    uint32_t max_states;
+
+    /* State set of each DFA state, `words` words per state */
+    uint64_t *sets;
+    /* Transition table, `columns` entries per state. -1 means "not computed yet" */
+    int32_t *next;
+    /* 1 if the DFA state contains an accept state of the NFA, 0 otherwise */
+    uint8_t *accepting;
+
+    /* Open addressing hash table from state sets to DFA states. -1 marks empty buckets */
+    int32_t *buckets;
+    /* Number of buckets, always a power of two */
+    uint32_t bucket_count;
+
+    /* DFA state for the epsilon closure of the NFA start state */
+    int32_t start;
+    /* DFA state for the empty set, where every input is rejected */
+    int32_t dead;
+
+    /* Scratch state sets used while computing transitions */
+    uint64_t *scratch;
+
+    /* Number of times the cache has been flushed */
+    uint64_t flushes;
+
+    /* True for search caches: the start state is added back after every step,
+    so a match can begin at any offset */
+    bool unanchored;
+};
+typedef struct lazy_dfa lazy_dfa;
+
+/**
+ * @brief Create an empty lazy DFA cache for the given NFA.
+ * @param automaton Pointer to the NFA the cache is built from
+ * @param budget Maximum number of bytes the cache may use
+ * @param unanchored true to build the DFA of the NFA with an implicit `.*` prefix, used for searching
+ * @return A pointer to the new cache, or NULL if the budget is too small to be useful
+ */
+lazy_dfa *new_lazy_dfa(const nfa *automaton, size_t budget, bool unanchored);
+
+/**
+ * @brief Check if an input string is accepted, using and extending the lazy DFA cache.
+ * If the cache keeps overflowing while matching the input, the rest of the input is
+ * handled by the plain NFA simulation.
+ * @param cache Pointer to the lazy DFA cache of the NFA
+ * @param automaton Pointer to the NFA the cache was created for
+ * @param input The input string to check
+ * @param input_length The length of the input string
+ * @return true if the NFA accepts the input string, false otherwise
+ */
+bool match_lazy_dfa(lazy_dfa *cache, const nfa *automaton, const char *input, size_t input_length);
+
+/**
+ * @brief Get the target of a DFA transition, computing and caching it if it is not known yet.
+ * Computing it may flush the cache, which renumbers the DFA states; in that case the source
+ * state is updated to its new number (cache->flushes tells when that happened).
+ * @param cache Pointer to the lazy DFA cache
+ * @param automaton Pointer to the NFA the cache was created for
+ * @param state Pointer to the source DFA state
+ * @param col The column of the input symbol
+ * @return The target DFA state
+ */
+int32_t lazy_dfa_next(lazy_dfa *cache, const nfa *automaton, int32_t *state, int col);
+
+/**
+ * @brief Get the DFA state for a set of NFA states, adding it to the cache if needed. This is
+ * how a matcher gets back into the cache after it was flushed by someone else. Adding the state
+ * may flush the cache too.
+ * @param cache Pointer to the lazy DFA cache
+ * @param automaton Pointer to the NFA the cache was created for
+ * @param set The set of NFA states
+ * @return The DFA state of the set
+ */
+int32_t lazy_dfa_state(lazy_dfa *cache, const nfa *automaton, const uint64_t *set);
+
+/**
+ * @brief Release the memory owned by a lazy DFA cache.
+ * @param cache Pointer to the cache to free
+ */
+void free_lazy_dfa(lazy_dfa *cache);
+
+#endif // LAZY_DFA_H
@@ -1,40 +1,859 @@
 #include "regex.h"
 #include "nfa.h"
+#include "dfa.h"
+#include "search.h"
+#include "regex_set.h"
+#include "stream.h"
+#include "lazy_dfa.h"
+#include "record_io.h"
+#include "compile_cache.h"
+#include "codegen.h"
+#include "pike_vm.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <getopt.h>
+#include <pthread.h>
+
+/**
+ * @brief Print one byte of a character class, escaping the bytes that are special inside it and
+ * writing the bytes that are not printable as \xHH.
+ */
+static void print_class_byte(int byte)
+{
+    if (byte == RIGHT_BRACKET_SYMBOL || byte == RANGE_SYMBOL || byte == NEGATION_SYMBOL || byte == ESCAPE_SYMBOL)
+    {
+        printf("%c%c", ESCAPE_SYMBOL, byte);
+    }
+    else if (byte < 0x20 || byte >= 0x7F)
+    {
+        printf("\\x%02X", byte);
+    }
+    else
+    {
+        putchar(byte);
+    }
+}
+
+/**
+ * @brief Print a class operand as the ranges of its bytes. Classes with more than half of the
+ * bytes are printed negated, so the wildcard is printed as [^\x0A].
+ */
+static void print_class(const byte_set *bytes)
+{
+    bool negated = byte_set_count(bytes) > 128;
+    putchar(LEFT_BRACKET_SYMBOL);
+    if (negated)
+    {
+        putchar(NEGATION_SYMBOL);
+    }
+
+    int byte = 0;
+    while (byte < 256)
+    {
+        if (byte_set_contains(bytes, (unsigned char)byte) == negated)
+        {
+            byte++;
+            continue;
+        }
+        int last = byte;
+        while (last + 1 < 256 && byte_set_contains(bytes, (unsigned char)(last + 1)) != negated)
+        {
+            last++;
+        }
+        print_class_byte(byte);
+        if (last > byte)
+        {
+            // Two bytes in a row are clearer without the range symbol
+            if (last > byte + 1)
+            {
+                putchar(RANGE_SYMBOL);
+            }
+            print_class_byte(last);
+        }
+        byte = last + 1;
+    }
+    putchar(RIGHT_BRACKET_SYMBOL);
+}
 
 void print_postfix(regex r)
 {
     for (int i = 0; i < r.size; i++)
     {
-        printf("%c", r.items[i].value);
+        if (r.items[i].type == OPERAND && byte_set_count(&r.items[i].bytes) != 1)
+        {
+            print_class(&r.items[i].bytes);
+        }
+        else if (r.items[i].type == OPERAND && (unsigned char)r.items[i].value >= 0x80)
+        {
+            // A byte of a UTF-8 sequence is not printable on its own
+            printf("\\x%02X", (unsigned char)r.items[i].value);
+        }
+        else if (r.items[i].type == REPETITION && r.items[i].max == r.items[i].min)
+        {
+            printf("{%d}", r.items[i].min);
+        }
+        else if (r.items[i].type == REPETITION)
+        {
+            printf(r.items[i].max == -1 ? "{%d,}" : "{%d,%d}", r.items[i].min, r.items[i].max);
+        }
+        else
+        {
+            printf("%c", r.items[i].value);
+        }
     }
     printf("\n");
 }
 
-void test_strings_stdin(const char *regex_str)
+/* Number of lines matched together in one call to match_nfa_batch */
+#define BATCH_LINES 1024
+/* Size of the buffer used to read each line */
+#define LINE_SIZE 1024
+/* Number of bytes read from stdin for each thread in the parallel -t mode */
+#define CHUNK_SIZE (4 << 20)
+
+/**
+ * @brief Match a batch of lines and write one result character per line.
+ * @param automaton Pointer to the NFA
+ * @param inputs The lines of the batch
+ * @param lens The length of each line
+ * @param count Number of lines in the batch
+ * @param writer The writer that receives the results
+ */
+static void write_batch_results(const nfa *automaton, const char **inputs, const size_t *lens, size_t count,
+                                output_writer *writer)
 {
-    regex r = parse_regex(regex_str);
-    nfa n = regex_to_nfa(r);
+    uint8_t results[BATCH_LINES];
 
-    char buf[1024];
-    while (fgets(buf, sizeof(buf), stdin))
+    match_nfa_batch(automaton, inputs, lens, count, results);
+    for (size_t i = 0; i < count; i++)
     {
-        buf[strcspn(buf, "\r\n")] = '\0';
-        int result = match_nfa(n, buf, strlen(buf));
-        printf("%d", result ? 1 : 0);
+        writer_put(writer, results[i] ? '1' : '0');
     }
-    printf("\n");
+}
+
+/**
+ * @brief Read a whole line of any length into a buffer that grows as needed, so that it can be
+ * reused from line to line. The line ends at its first '\r' or '\n', which is left out.
+ * @param file The file to read from
+ * @param line Pointer to the buffer, or to NULL for a new one. The caller frees it
+ * @param capacity Pointer to the size of the buffer, 0 for a new one
+ * @param length Output for the length of the line
+ * @return true if a line was read, false at the end of the file
+ */
+static bool read_line_into(FILE *file, char **line, size_t *capacity, size_t *length)
+{
+    if (*line == NULL)
+    {
+        *capacity = LINE_SIZE;
+        *line = malloc(*capacity);
+        if (*line == NULL)
+        {
+            fprintf(stderr, "Error: No hay memoria suficiente para leer la linea.\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    size_t read = 0;
+    (*line)[0] = '\0';
+    while (fgets(*line + read, (int)(*capacity - read), file))
+    {
+        read += strlen(*line + read);
+        if (read > 0 && (*line)[read - 1] == '\n')
+        {
+            break;
+        }
+        if (read + 1 == *capacity)
+        {
+            *capacity *= 2;
+            char *grown = realloc(*line, *capacity);
+            if (grown == NULL)
+            {
+                fprintf(stderr, "Error: No hay memoria suficiente para leer la linea.\n");
+                exit(EXIT_FAILURE);
+            }
+            *line = grown;
+        }
+    }
+
+    if (read == 0 && feof(file))
+    {
+        return false;
+    }
+    *length = strcspn(*line, "\r\n");
+    (*line)[*length] = '\0';
+    return true;
+}
+
+/**
+ * @brief Read a whole line of any length, such as a regex of hundreds of KB. The line ends at its
+ * first '\r' or '\n', which is left out.
+ * @param file The file to read from
+ * @return The line, which the caller frees, or NULL at the end of the file
+ */
+static char *read_line(FILE *file)
+{
+    char *line = NULL;
+    size_t capacity = 0;
+    size_t length;
+    if (!read_line_into(file, &line, &capacity, &length))
+    {
+        free(line);
+        return NULL;
+    }
+    return line;
+}
+
+/**
+ * @brief Match a line that does not fit in the line buffer, one buffer at a time, so lines of
+ * any length are matched with constant memory. The first part of the line is already in
+ * `piece`, and the buffer is reused to read the rest.
+ * @param automaton Pointer to the NFA
+ * @param piece Buffer of LINE_SIZE bytes with the first part of the line
+ * @return true if the NFA accepts the line, false otherwise
+ */
+static bool match_long_line(const nfa *automaton, char *piece)
+{
+    match_stream stream;
+    match_stream_begin(&stream, automaton);
+
+    // Like short lines, the line ends at its first '\r' or '\n'
+    bool ended = false;
+    do
+    {
+        size_t length = strcspn(piece, "\r\n");
+        if (!ended)
+        {
+            match_stream_feed(&stream, piece, length);
+            ended = piece[length] != '\0';
+        }
+        if (strchr(piece + length, '\n') != NULL)
+        {
+            break;
+        }
+    } while (fgets(piece, LINE_SIZE, stdin));
+
+    return match_stream_end(&stream);
+}
+
+void test_strings_stdin(const nfa *n)
+{
+    // Lines are read into a batch and matched together, so the
+    // automaton stays hot in cache while the whole batch is checked.
+    char *buf = malloc(BATCH_LINES * LINE_SIZE);
+    const char *inputs[BATCH_LINES];
+    size_t lens[BATCH_LINES];
+    if (buf == NULL)
+    {
+        fprintf(stderr, "Error: No hay memoria suficiente para leer las cadenas.\n");
+        exit(EXIT_FAILURE);
+    }
+    output_writer writer;
+    writer_init(&writer, stdout);
+
+    size_t count = 0;
+    bool done = false;
+    while (!done)
+    {
+        char *line = buf + count * LINE_SIZE;
+        if (fgets(line, LINE_SIZE, stdin))
+        {
+            size_t read = strlen(line);
+            if (read == LINE_SIZE - 1 && line[read - 1] != '\n')
+            {
+                // The line does not fit in its buffer: finish the batch so far to keep
+                // the output in order, then stream the line through the automaton.
+                write_batch_results(n, inputs, lens, count, &writer);
+                count = 0;
+                writer_put(&writer, match_long_line(n, line) ? '1' : '0');
+                continue;
+            }
+
+            lens[count] = strcspn(line, "\r\n");
+            line[lens[count]] = '\0';
+            inputs[count] = line;
+            count++;
+        }
+        else
+        {
+            done = true;
+        }
+
+        if (count == BATCH_LINES || (done && count > 0))
+        {
+            write_batch_results(n, inputs, lens, count, &writer);
+            count = 0;
+        }
+    }
+    writer_put(&writer, '\n');
+    writer_close(&writer);
+
+    free(buf);
+}
+
+/**
+ * @brief Struct to represent a chunk of the input matched by one thread in the parallel -t mode.
+ * The chunk holds whole records, and the thread writes one result character per record.
+ */
+struct chunk_job
+{
+    /* The NFA shared by every thread. Only its read-only parts are used */
+    const nfa *automaton;
+    /* Lazy DFA cache of this thread, or NULL */
+    lazy_dfa *cache;
+    /* The records of the chunk, either in `data` or inside a mapped input */
+    const char *records;
+    /* How the records are delimited */
+    record_format format;
+    /* Set to true when the chunk ends with a malformed record */
+    bool malformed;
+    /* Buffer with the lines of the chunk when they are read from stdin */
+    char *data;
+    /* Number of bytes of records in the chunk */
+    size_t length;
+    /* Size of the buffer */
+    size_t capacity;
+    /* One result character per line, with room for length + 1 lines */
+    char *output;
+    /* Number of result characters */
+    size_t output_length;
+    /* Thread matching the chunk */
+    pthread_t thread;
+    /* True if the chunk is matched by its own thread */
+    bool started;
+};
+typedef struct chunk_job chunk_job;
+
+/**
+ * @brief Thread entry point: match every record of a chunk, in batches.
+ * @param arg Pointer to the chunk_job
+ * @return NULL
+ */
+static void *match_chunk(void *arg)
+{
+    chunk_job *job = arg;
+    const char *inputs[BATCH_LINES];
+    size_t lens[BATCH_LINES];
+    uint8_t results[BATCH_LINES];
+    size_t count = 0;
+
+    record_reader reader;
+    record_reader_init(&reader, job->records, job->length, job->format);
+    job->output_length = 0;
+
+    bool more = true;
+    while (more)
+    {
+        more = next_record(&reader, &inputs[count], &lens[count]);
+        if (more)
+        {
+            count++;
+        }
+
+        if (count == BATCH_LINES || (!more && count > 0))
+        {
+            match_nfa_batch_with_cache(job->automaton, job->cache, inputs, lens, count, results);
+            for (size_t i = 0; i < count; i++)
+            {
+                job->output[job->output_length++] = results[i] ? '1' : '0';
+            }
+            count = 0;
+        }
+    }
+    job->malformed = reader.malformed;
+
+    return NULL;
+}
+
+/**
+ * @brief Grow the buffers of a chunk so it can hold the given number of bytes. With `with_data`
+ * false only the results are reserved, for chunks that point into a mapped input.
+ */
+static void reserve_chunk(chunk_job *job, size_t capacity, bool with_data)
+{
+    if (capacity <= job->capacity)
+    {
+        return;
+    }
+
+    char *data = with_data ? realloc(job->data, capacity) : job->data;
+    char *output = realloc(job->output, capacity + 1);
+    if ((with_data && data == NULL) || output == NULL)
+    {
+        fprintf(stderr, "Error: No hay memoria suficiente para leer las cadenas.\n");
+        exit(EXIT_FAILURE);
+    }
+    job->data = data;
+    job->output = output;
+    job->capacity = capacity;
+}
+
+/**
+ * @brief Read the next chunk of whole lines from stdin. The bytes after the last newline are
+ * kept in `pending` and go at the start of the next chunk. A line longer than a chunk makes the
+ * chunk grow until the line fits.
+ * @param job The chunk to fill
+ * @param pending The chunk that receives the bytes after the last newline
+ * @param at_eof Set to true once stdin is exhausted
+ * @return true if the chunk has at least one line, false otherwise
+ */
+static bool read_chunk(chunk_job *job, chunk_job *pending, bool *at_eof)
+{
+    // Start with the partial line left by the previous chunk
+    reserve_chunk(job, pending->length + CHUNK_SIZE, true);
+    size_t length = pending->length;
+    if (length > 0)
+    {
+        memcpy(job->data, pending->data, length);
+        pending->length = 0;
+    }
+
+    size_t last_newline = SIZE_MAX;
+    while (!*at_eof)
+    {
+        reserve_chunk(job, length + CHUNK_SIZE, true);
+        size_t read = fread(job->data + length, 1, CHUNK_SIZE, stdin);
+        *at_eof = read < CHUNK_SIZE;
+
+        for (size_t i = length + read; i > length; i--)
+        {
+            if (job->data[i - 1] == '\n')
+            {
+                last_newline = i - 1;
+                break;
+            }
+        }
+        length += read;
+
+        if (last_newline != SIZE_MAX)
+        {
+            break;
+        }
+    }
+
+    job->records = job->data;
+
+    // At the end of the input the last line does not need a newline
+    if (*at_eof)
+    {
+        job->length = length;
+        return length > 0;
+    }
+
+    job->length = last_newline + 1;
+    pending->length = length - job->length;
+    if (pending->length > 0)
+    {
+        reserve_chunk(pending, pending->length, true);
+        memcpy(pending->data, job->data + job->length, pending->length);
+    }
+    return true;
+}
+
+/**
+ * @brief Create the chunks of the parallel -t mode. Each thread gets its own lazy DFA cache, which
+ * is the only part of the automaton that changes while matching.
+ * @param automaton Pointer to the NFA shared by every thread
+ * @param threads Number of threads
+ * @param format How the records of the chunks are delimited
+ * @return threads + 1 chunks. The extra one holds the partial line between two chunks of stdin
+ */
+static chunk_job *new_chunk_jobs(const nfa *automaton, int threads, record_format format)
+{
+    chunk_job *jobs = calloc((size_t)threads + 1, sizeof(chunk_job));
+    if (jobs == NULL)
+    {
+        fprintf(stderr, "Error: No hay memoria suficiente para leer las cadenas.\n");
+        exit(EXIT_FAILURE);
+    }
+    for (int i = 0; i <= threads; i++)
+    {
+        jobs[i].automaton = automaton;
+        jobs[i].format = format;
+        if (i < threads && automaton->bit_parallel == NULL)
+        {
+            jobs[i].cache = new_lazy_dfa(automaton, LAZY_DFA_DEFAULT_BUDGET, false);
+        }
+    }
+    return jobs;
+}
+
+/**
+ * @brief Release the chunks created by new_chunk_jobs.
+ */
+static void free_chunk_jobs(chunk_job *jobs, int threads)
+{
+    for (int i = 0; i <= threads; i++)
+    {
+        free_lazy_dfa(jobs[i].cache);
+        free(jobs[i].data);
+        free(jobs[i].output);
+    }
+    free(jobs);
+}
+
+/**
+ * @brief Start matching a chunk on its own thread, or on the calling one if no thread can be
+ * created.
+ * @param job The chunk
+ */
+static void start_chunk(chunk_job *job)
+{
+    job->started = pthread_create(&job->thread, NULL, match_chunk, job) == 0;
+    if (!job->started)
+    {
+        match_chunk(job);
+    }
+}
+
+/**
+ * @brief Wait until a chunk is matched and write its results.
+ * @param job The chunk
+ * @param writer The writer that receives the results
+ * @return true if the chunk ended with a malformed record, false otherwise
+ */
+static bool finish_chunk(chunk_job *job, output_writer *writer)
+{
+    if (job->started)
+    {
+        pthread_join(job->thread, NULL);
+    }
+    writer_write(writer, job->output, job->output_length);
+    return job->malformed;
+}
+
+/**
+ * @brief Match a round of chunks at once, one per thread, and write their results in input order.
+ * The main thread matches the first chunk itself.
+ * @param jobs The chunks of the round
+ * @param used Number of chunks in the round
+ * @param writer The writer that receives the results
+ * @return true if a chunk ended with a malformed record, false otherwise
+ */
+static bool match_round(chunk_job *jobs, int used, output_writer *writer)
+{
+    for (int i = 1; i < used; i++)
+    {
+        start_chunk(&jobs[i]);
+    }
+    if (used > 0)
+    {
+        jobs[0].started = false;
+        match_chunk(&jobs[0]);
+    }
+
+    bool malformed = false;
+    for (int i = 0; i < used; i++)
+    {
+        malformed = finish_chunk(&jobs[i], writer) || malformed;
+    }
+    return malformed;
+}
+
+/**
+ * @brief Same as test_strings_stdin, but the input is split into chunks of whole lines that are
+ * matched by several threads at once. Each chunk starts on its own thread as soon as it is read,
+ * so the main thread reads the next chunks while the previous ones are matched. The chunks are
+ * used in turn, and one is only read again after its results are written, so they come out in
+ * input order.
+ * @param n Pointer to the NFA
+ * @param threads Number of threads
+ */
+void test_strings_stdin_parallel(const nfa *n, int threads)
+{
+    chunk_job *jobs = new_chunk_jobs(n, threads, RECORD_NEWLINE);
+    chunk_job *pending = &jobs[threads];
+    output_writer writer;
+    writer_init(&writer, stdout);
+
+    // The chunks being matched are the `used` ones before `next`, the oldest first
+    int next = 0;
+    int used = 0;
+    bool at_eof = false;
+    while (!at_eof)
+    {
+        if (used == threads)
+        {
+            finish_chunk(&jobs[next], &writer);
+            used--;
+        }
+        if (!read_chunk(&jobs[next], pending, &at_eof))
+        {
+            break;
+        }
+        start_chunk(&jobs[next]);
+        used++;
+        next = (next + 1) % threads;
+    }
+    for (int i = used; i > 0; i--)
+    {
+        finish_chunk(&jobs[(next - i + threads) % threads], &writer);
+    }
+    writer_put(&writer, '\n');
+    writer_close(&writer);
+
+    free_chunk_jobs(jobs, threads);
+}
+
+/**
+ * @brief Same as test_strings_stdin, but the whole input is loaded at once, mapped from a file
+ * when possible, and split into records in place. Records can hold any byte, including NUL.
+ * @param n Pointer to the NFA
+ * @param input_path Path of the input, or NULL to read the rest of stdin
+ * @param format How the records are delimited
+ * @param threads Number of threads, or 0 to match on the main thread only
+ * @return 0 on success, 1 if the input cannot be read or has a malformed record
+ */
+int test_records(const nfa *n, const char *input_path, record_format format, int threads)
+{
+    mapped_input input;
+    if (!map_input(input_path, &input))
+    {
+        fprintf(stderr, "Error: No se pudo leer la entrada '%s'.\n", input_path != NULL ? input_path : "stdin");
+        return 1;
+    }
+
+    output_writer writer;
+    writer_init(&writer, stdout);
+    bool malformed = false;
 
+    if (threads == 0)
+    {
+        const char *inputs[BATCH_LINES];
+        size_t lens[BATCH_LINES];
+        size_t count = 0;
+        record_reader reader;
+        record_reader_init(&reader, input.data, input.length, format);
+
+        bool more = true;
+        while (more)
+        {
+            more = next_record(&reader, &inputs[count], &lens[count]);
+            if (more)
+            {
+                count++;
+            }
+            if (count == BATCH_LINES || (!more && count > 0))
+            {
+                write_batch_results(n, inputs, lens, count, &writer);
+                count = 0;
+            }
+        }
+        malformed = reader.malformed;
+    }
+    else
+    {
+        // Chunks point into the input, so only their results need memory
+        chunk_job *jobs = new_chunk_jobs(n, threads, format);
+        size_t position = 0;
+        while (position < input.length && !malformed)
+        {
+            int used = 0;
+            while (used < threads && position < input.length)
+            {
+                size_t end = record_boundary(input.data, input.length, format, position, CHUNK_SIZE);
+                jobs[used].records = input.data + position;
+                jobs[used].length = end - position;
+                reserve_chunk(&jobs[used], jobs[used].length, false);
+                position = end;
+                used++;
+            }
+            malformed = match_round(jobs, used, &writer);
+        }
+        free_chunk_jobs(jobs, threads);
+    }
+    writer_put(&writer, '\n');
+    writer_close(&writer);
+
+    unmap_input(&input);
+
+    if (malformed)
+    {
+        fprintf(stderr, "Error: La entrada termina con un registro incompleto.\n");
+        return 1;
+    }
+    return 0;
+}
+
+void test_strings_stdin_dfa(const dfa *d)
+{
+    output_writer writer;
+    writer_init(&writer, stdout);
+    char *line = NULL;
+    size_t capacity = 0;
+    size_t length;
+    while (read_line_into(stdin, &line, &capacity, &length))
+    {
+        int result = match_dfa(d, line, length);
+        writer_put(&writer, result ? '1' : '0');
+    }
+    writer_put(&writer, '\n');
+    writer_close(&writer);
+    free(line);
+}
+
+/**
+ * @brief Print one match found by search_nfa as `end`, or as `start:end` when the start is known.
+ * Matches are separated by spaces.
+ */
+static bool print_match(size_t start, size_t end, void *user_data)
+{
+    size_t *printed = user_data;
+    if (*printed > 0)
+    {
+        putchar(' ');
+    }
+    if (start == SEARCH_NO_START)
+    {
+        printf("%zu", end);
+    }
+    else
+    {
+        printf("%zu:%zu", start, end);
+    }
+    (*printed)++;
+    return true;
+}
+
+void search_strings_stdin(const nfa *n, bool track_start)
+{
+    // One output line per input line, with the offsets where matches end
+    char *line = NULL;
+    size_t capacity = 0;
+    size_t length;
+    while (read_line_into(stdin, &line, &capacity, &length))
+    {
+        size_t printed = 0;
+        search_nfa(n, line, length, track_start, print_match, &printed);
+        putchar('\n');
+    }
+    free(line);
+}
+
+int capture_strings_stdin(const char *regex_str, const char *cache_dir)
+{
+    // The NFA rejects the lines that do not match, and only the matches run on the Pike VM
+    nfa n = compile_nfa(regex_str, cache_dir);
+    pike_program program = compile_pike_program(regex_str);
+    size_t *slots = malloc(program.slots * sizeof(size_t));
+    if (slots == NULL)
+    {
+        fprintf(stderr, "Error: No hay memoria suficiente para los grupos de captura.\n");
+        exit(EXIT_FAILURE);
+    }
+
+    // One output line per input line: 0, or 1 followed by the span of each group
+    char *line = NULL;
+    size_t capacity = 0;
+    size_t length;
+    while (read_line_into(stdin, &line, &capacity, &length))
+    {
+        if (!match_captures(&n, &program, line, length, slots))
+        {
+            puts("0");
+            continue;
+        }
+
+        putchar('1');
+        for (int group = 1; group <= program.groups; group++)
+        {
+            size_t start = slots[2 * group];
+            size_t end = slots[2 * group + 1];
+            if (start == PIKE_VM_UNSET || end == PIKE_VM_UNSET)
+            {
+                // The group did not take part in the match
+                fputs(" -", stdout);
+            }
+            else
+            {
+                printf(" %zu:%zu", start, end);
+            }
+        }
+        putchar('\n');
+    }
+
+    free(line);
+    free(slots);
+    free_pike_program(&program);
     free_nfa(&n);
+    return 0;
 }
 
-int serialize_nfa_from_regex(const char *regex_str, const char *output_path)
+int test_strings_stdin_set(const char *patterns_path)
 {
-    regex r = parse_regex(regex_str);
-    nfa n = regex_to_nfa(r);
+    FILE *file = fopen(patterns_path, "r");
+    if (file == NULL)
+    {
+        fprintf(stderr, "Error: No se pudo abrir el archivo de patrones '%s'.\n", patterns_path);
+        return 1;
+    }
+
+    // One pattern per line, numbered from 0 in order. Empty lines are skipped.
+    regex *patterns = NULL;
+    uint32_t count = 0;
+    uint32_t capacity = 0;
+    char *line;
+    while ((line = read_line(file)) != NULL)
+    {
+        if (line[0] == '\0')
+        {
+            free(line);
+            continue;
+        }
+
+        if (count == capacity)
+        {
+            capacity = capacity == 0 ? 64 : capacity * 2;
+            regex *grown = realloc(patterns, capacity * sizeof(regex));
+            if (grown == NULL)
+            {
+                fprintf(stderr, "Error: No hay memoria suficiente para leer los patrones.\n");
+                exit(EXIT_FAILURE);
+            }
+            patterns = grown;
+        }
+        patterns[count++] = parse_regex(line);
+        free(line);
+    }
+    fclose(file);
+
+    regex_set set = new_regex_set(patterns, count);
+    for (uint32_t i = 0; i < count; i++)
+    {
+        free_regex(patterns[i]);
+    }
+    free(patterns);
+
+    uint32_t *matches = malloc((count > 0 ? count : 1) * sizeof(uint32_t));
+    if (matches == NULL)
+    {
+        fprintf(stderr, "Error: No hay memoria suficiente para leer los patrones.\n");
+        exit(EXIT_FAILURE);
+    }
+
+    // One output line per input line, with the patterns that match it
+    char *input = NULL;
+    size_t input_capacity = 0;
+    size_t length;
+    while (read_line_into(stdin, &input, &input_capacity, &length))
+    {
+        uint32_t matched = match_regex_set(&set, input, length, matches);
+        for (uint32_t i = 0; i < matched; i++)
+        {
+            printf(i == 0 ? "%u" : " %u", matches[i]);
+        }
+        putchar('\n');
+    }
+
+    free(input);
+    free(matches);
+    free_regex_set(&set);
+    return 0;
+}
+
+int serialize_nfa_from_regex(const char *regex_str, const char *cache_dir, const char *output_path)
+{
+    nfa n = compile_nfa(regex_str, cache_dir);
 
     bool ok = save_nfa(&n, output_path);
     free_nfa(&n);
@@ -48,21 +867,49 @@ int serialize_nfa_from_regex(const char *regex_str, const char *output_path)
     return 0;
 }
 
+int generate_c_from_regex(const char *regex_str, const char *cache_dir, const char *output_path)
+{
+    dfa d;
+    if (!compile_dfa(regex_str, cache_dir, &d))
+    {
+        fprintf(stderr, "Error: El DFA de la expresion regular excede el limite de memoria.\n");
+        return 1;
+    }
+
+    bool ok = dfa_to_c(&d, regex_str, output_path);
+    free_dfa(&d);
+
+    if (!ok)
+    {
+        fprintf(stderr, "Error: No se pudo generar el codigo C en '%s'.\n", output_path);
+        return 1;
+    }
+
+    return 0;
+}
+
 int main(int argc, char *argv[])
 {
     int opt;
-    char regex_str[1024];
+    char *regex_str = NULL;
     char *output_file = NULL;
+    char *patterns_file = NULL;
     int mode = 0;
+    int threads = 0;
+    char *input_file = NULL;
+    record_format format = RECORD_NEWLINE;
+    bool whole_input = false;
+    char *nfa_file = NULL;
+    char *cache_dir = NULL;
 
-    while ((opt = getopt(argc, argv, "rto:")) != -1)
+    while ((opt = getopt(argc, argv, "rtdsSgm:o:c:j:i:f:l:C:")) != -1)
     {
         switch (opt)
         {
             case 'r':
                 if (mode != 0)
                 {
-                    fprintf(stderr, "Error: Solo puedes usar una opcion de modo entre -r, -t o -o.\n");
+                    fprintf(stderr, "Error: Solo puedes usar una opcion de modo entre -r, -t, -d, -s, -S, -g, -m, -o o -c.\n");
                     return 1;
                 }
                 mode = 'r';
@@ -70,49 +917,230 @@ int main(int argc, char *argv[])
             case 't':
                 if (mode != 0)
                 {
-                    fprintf(stderr, "Error: Solo puedes usar una opcion de modo entre -r, -t o -o.\n");
+                    fprintf(stderr, "Error: Solo puedes usar una opcion de modo entre -r, -t, -d, -s, -S, -g, -m, -o o -c.\n");
                     return 1;
                 }
                 mode = 't';
                 break;
+            case 'd':
+                if (mode != 0)
+                {
+                    fprintf(stderr, "Error: Solo puedes usar una opcion de modo entre -r, -t, -d, -s, -S, -g, -m, -o o -c.\n");
+                    return 1;
+                }
+                mode = 'd';
+                break;
+            case 's':
+            case 'S':
+                if (mode != 0)
+                {
+                    fprintf(stderr, "Error: Solo puedes usar una opcion de modo entre -r, -t, -d, -s, -S, -g, -m, -o o -c.\n");
+                    return 1;
+                }
+                mode = opt;
+                break;
+            case 'g':
+                if (mode != 0)
+                {
+                    fprintf(stderr, "Error: Solo puedes usar una opcion de modo entre -r, -t, -d, -s, -S, -g, -m, -o o -c.\n");
+                    return 1;
+                }
+                mode = 'g';
+                break;
+            case 'm':
+                if (mode != 0)
+                {
+                    fprintf(stderr, "Error: Solo puedes usar una opcion de modo entre -r, -t, -d, -s, -S, -g, -m, -o o -c.\n");
+                    return 1;
+                }
+                mode = 'm';
+                patterns_file = optarg;
+                break;
             case 'o':
                 if (mode != 0)
                 {
-                    fprintf(stderr, "Error: Solo puedes usar una opcion de modo entre -r, -t o -o.\n");
+                    fprintf(stderr, "Error: Solo puedes usar una opcion de modo entre -r, -t, -d, -s, -S, -g, -m, -o o -c.\n");
                     return 1;
                 }
                 mode = 'o';
                 output_file = optarg;
                 break;
+            case 'c':
+                if (mode != 0)
+                {
+                    fprintf(stderr, "Error: Solo puedes usar una opcion de modo entre -r, -t, -d, -s, -S, -g, -m, -o o -c.\n");
+                    return 1;
+                }
+                mode = 'c';
+                output_file = optarg;
+                break;
+            case 'j':
+                threads = atoi(optarg);
+                if (threads < 1)
+                {
+                    fprintf(stderr, "Error: El numero de hilos de -j debe ser un entero positivo.\n");
+                    return 1;
+                }
+                break;
+            case 'C':
+                cache_dir = optarg;
+                break;
+            case 'l':
+                nfa_file = optarg;
+                break;
+            case 'i':
+                input_file = optarg;
+                whole_input = true;
+                break;
+            case 'f':
+                if (!parse_record_format(optarg, &format))
+                {
+                    fprintf(stderr, "Error: El formato de registros de -f debe ser line, nul o len.\n");
+                    return 1;
+                }
+                whole_input = true;
+                break;
             default:
-                fprintf(stderr, "Usage: %s -r | -t | -o <archivo.nfa>\n", argv[0]);
+                fprintf(stderr, "Usage: %s [-l <archivo.nfa> | -C <cache>] -r | -t [-j <hilos>] [-i <entrada>] [-f line|nul|len] | -d | -s | -S | -g | -m <patrones.txt> | -o <archivo.nfa> | -c <archivo.c>\n", argv[0]);
                 return 1;
         }
     }
 
     if (mode == 0)
     {
-        fprintf(stderr, "Usage: %s -r | -t | -o <archivo.nfa>\n", argv[0]);
+        fprintf(stderr, "Usage: %s [-l <archivo.nfa> | -C <cache>] -r | -t [-j <hilos>] [-i <entrada>] [-f line|nul|len] | -d | -s | -S | -g | -m <patrones.txt> | -o <archivo.nfa> | -c <archivo.c>\n", argv[0]);
         return 1;
     }
 
-    if (!fgets(regex_str, sizeof(regex_str), stdin))
+    if (threads > 0 && mode != 't')
     {
+        fprintf(stderr, "Error: La opcion -j solo se puede usar con -t.\n");
         return 1;
     }
-    regex_str[strcspn(regex_str, "\r\n")] = '\0';
 
-    if (mode == 'r')
+    if (nfa_file != NULL && mode != 't' && mode != 'd' && mode != 's' && mode != 'S')
     {
-        print_postfix(parse_regex(regex_str));
-        return 0;
+        fprintf(stderr, "Error: La opcion -l solo se puede usar con -t, -d, -s o -S.\n");
+        return 1;
+    }
+
+    if (cache_dir != NULL && (nfa_file != NULL || mode == 'r' || mode == 'm'))
+    {
+        fprintf(stderr, "Error: La opcion -C solo se puede usar con -t, -d, -s, -S, -g, -o o -c, y no con -l.\n");
+        return 1;
+    }
+
+    if (whole_input && mode != 't')
+    {
+        fprintf(stderr, "Error: Las opciones -i y -f solo se pueden usar con -t.\n");
+        return 1;
     }
 
-    if (mode == 't')
+    // The patterns of a regex set come from a file, so stdin only has input strings
+    if (mode == 'm')
     {
-        test_strings_stdin(regex_str);
+        return test_strings_stdin_set(patterns_file);
+    }
+
+    // With -l the NFA comes from a file, so stdin only has input strings
+    if (nfa_file == NULL)
+    {
+        regex_str = read_line(stdin);
+        if (regex_str == NULL)
+        {
+            return 1;
+        }
+
+        int status = -1;
+        if (mode == 'r')
+        {
+            regex r = parse_regex(regex_str);
+            print_postfix(r);
+            free_regex(r);
+            status = 0;
+        }
+        else if (mode == 'o')
+        {
+            status = serialize_nfa_from_regex(regex_str, cache_dir, output_file);
+        }
+        else if (mode == 'c')
+        {
+            status = generate_c_from_regex(regex_str, cache_dir, output_file);
+        }
+        else if (mode == 'g')
+        {
+            status = capture_strings_stdin(regex_str, cache_dir);
+        }
+
+        if (status != -1)
+        {
+            free(regex_str);
+            return status;
+        }
+    }
+
+    nfa n;
+    if (nfa_file != NULL && !load_nfa(nfa_file, &n))
+    {
+        fprintf(stderr, "Error: No se pudo cargar el NFA de '%s'.\n", nfa_file);
+        return 1;
+    }
+
+    if (mode == 'd')
+    {
+        // With the cache, a stored DFA skips the NFA and the subset construction altogether
+        dfa d;
+        bool ok;
+        if (nfa_file != NULL)
+        {
+            ok = nfa_to_dfa(&n, &d);
+            free_nfa(&n);
+            if (ok)
+            {
+                minimize_dfa(&d);
+            }
+        }
+        else
+        {
+            ok = compile_dfa(regex_str, cache_dir, &d);
+            free(regex_str);
+        }
+
+        if (!ok)
+        {
+            fprintf(stderr, "Error: El DFA de la expresion regular excede el limite de memoria.\n");
+            return 1;
+        }
+        test_strings_stdin_dfa(&d);
+        free_dfa(&d);
         return 0;
     }
 
-    return serialize_nfa_from_regex(regex_str, output_file);
-}
\ No newline at end of file
+    if (nfa_file == NULL)
+    {
+        n = compile_nfa(regex_str, cache_dir);
+        free(regex_str);
+    }
+
+    int status = 0;
+    if (mode == 't' && whole_input)
+    {
+        // With -i or -f the records are split in place from the whole input
+        status = test_records(&n, input_file, format, threads);
+    }
+    else if (mode == 't' && threads > 0)
+    {
+        test_strings_stdin_parallel(&n, threads);
+    }
+    else if (mode == 't')
+    {
+        test_strings_stdin(&n);
+    }
+    else
+    {
+        search_strings_stdin(&n, mode == 'S');
+    }
+
+    free_nfa(&n);
+    return status;
+}
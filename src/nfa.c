@@ -1,104 +1,130 @@
 #include "nfa.h"
+#include "lazy_dfa.h"
+#include "glushkov.h"
+#include "prefilter.h"
+#include "record_io.h"
+
+/* Label of epsilon transitions. Epsilon is not a byte, so it has no byte set */
+#define EPSILON_LABEL -1
+
+/* Epsilon removal gives up, and keeps the epsilon transitions, once it has done more than this
+many times the number of transitions of the NFA in work, and at least NFA_REMOVAL_MIN_WORK. Below
+that, the NFA without epsilon transitions is at most a constant factor larger. */
+#define NFA_REMOVAL_WORK_FACTOR 8
+#define NFA_REMOVAL_MIN_WORK ((size_t)1 << 22)
 
 /**
  * @brief Struct to represent a transition in the NFA. It contains the source state,
- * the symbol for the transition, and the destination state. This struct is used as
+ * the label for the transition, and the destination state. This struct is used as
  * an intermediate representation of transitions while building the NFA.
  */
 struct temp_transition
 {
     /* Represents a transition in the NFA */
-    uint8_t from_state;
-    /* The symbol for the transition */
-    char symbol;
+    uint32_t from_state;
+    /* Index of the byte set that labels the transition, or EPSILON_LABEL */
+    int32_t label;
     /* The state to which the transition leads */
-    uint8_t to_state;
+    uint32_t to_state;
 };
 typedef struct temp_transition t_transition;
 
 /**
  * @brief Struct to represent a temporary NFA during construction. It contains the start
  * state and the end state. This struct is used as an intermediate representation while
- * building the NFA from the regex.
+ * building the NFA from the regex. The states and transitions of a subexpression are
+ * created one after the other, so the temporary NFA owns every state and transition
+ * created from its first ones onwards.
  */
 struct temp_nfa
 {
     /* Start state of the temporary NFA */
-    uint8_t start;
+    uint32_t start;
     /* End state of the temporary NFA */
-    uint8_t end;
+    uint32_t end;
+    /* First state created for the temporary NFA */
+    uint32_t first_state;
+    /* Index of the first transition created for the temporary NFA */
+    uint32_t first_transition;
 };
 typedef struct temp_nfa t_nfa;
 
 /**
  * @brief Struct to manage states and transitions during NFA construction. It keeps track
- * of the next available state ID, the list of states, the list of transitions, and the
- * alphabet used by the NFAs being constructed.
+ * of the next available state ID, the number of states, the growable list of transitions,
+ * and the byte sets that label them. States are numbered consecutively, so the state IDs
+ * are always 0..states_count-1. The alphabet is only computed once all the labels are known.
  */
 struct states_manager
 {
     /* Next available state ID */
-    uint8_t next_id;
+    uint32_t next_id;
 
-    /* List of states managed */
-    uint8_t states[MAX_STATES];
-    uint8_t states_count;
+    /* Number of states managed */
+    uint32_t states_count;
 
     /* List of transitions managed */
-    t_transition transitions[MAX_STATES * MAX_STATES];
-    uint8_t transitions_count;
-
-    /* Alphabet used by the states manager */
-    alphabet manager_alphabet;
+    t_transition *transitions;
+    uint32_t transitions_count;
+    uint32_t transitions_capacity;
+
+    /* List of byte sets used as transition labels */
+    byte_set *labels;
+    uint32_t labels_count;
+    uint32_t labels_capacity;
 };
 typedef struct states_manager states_manager;
 
 // Function prototypes for internal helper functions
 
-void epsilon_closure(nfa *automaton, uint8_t state);
-void calculate_epsilon_closure(nfa *automaton);
-nfa t_nfa_to_nfa(t_nfa temp_nfa, states_manager manager);
+nfa t_nfa_to_nfa(t_nfa temp_nfa, states_manager *manager);
+t_nfa regex_to_t_nfa(states_manager *manager, const regex r);
+static void remove_epsilon_transitions_keeping_ids(nfa *automaton, uint32_t **kept_ids);
+static bool epsilon_reaches(const nfa *automaton, uint32_t from, uint32_t to, uint64_t *visited, uint32_t *stack);
 
 /**
- * @brief Function to create a new alphabet. This function initializes an alphabet struct with
- * default values, including setting the epsilon symbol and initializing the character-to-column
- * mapping.
+ * @brief Function to create the alphabet of an NFA from the byte classes of its labels. Column 0
+ * is reserved for epsilon, and every class that appears in some label gets its own column after
+ * it. Bytes of classes that no label uses are mapped to -1, since no transition accepts them.
+ * @param classes The byte classes of the transition labels
+ * @param used The union of all the transition labels
+ * @return The alphabet of the NFA
  */
-alphabet new_alphabet()
+alphabet new_alphabet(const byte_classes *classes, const byte_set *used)
 {
     alphabet a;
 
     memset(a.char_to_col, -1, sizeof(a.char_to_col));
     memset(a.symbols, 0, sizeof(a.symbols));
 
-    // Add the epsilon symbol to the alphabet
-    // For mapping purposes, the epsilon symbol is at index 0
-    a.symbols[0] = EPSILON_SYMBOL;
-    a.char_to_col[EPSILON_SYMBOL] = 0;
-
+    // Epsilon takes column 0. It is not a byte, so no byte maps to it and every
+    // byte, 240 included, is free to be a symbol of the regex.
+    a.symbols[0] = 0;
     a.symbol_count = 1;
-    return a;
-}
 
-/**
- * @brief Function to add a symbol to the alphabet. This function checks if the symbol is already
- * in the alphabet, and if not, it adds the symbol to the symbols array and updates the
- * character-to-column mapping.
- * @param a Pointer to the alphabet struct to which the symbol should be added
- * @param symbol The symbol to add to the alphabet
- */
-void add_symbol(alphabet *a, char symbol)
-{
-    // Check if the symbol is already in the alphabet
-    if (a->char_to_col[(unsigned char)symbol] != -1 || symbol == EPSILON_SYMBOL)
+    // Column of each class, assigned the first time one of its bytes shows up
+    int class_col[256];
+    memset(class_col, -1, sizeof(class_col));
+
+    for (int byte = 0; byte < 256; byte++)
     {
-        return; // Symbol already exists, do nothing
+        if (!byte_set_contains(used, (unsigned char)byte))
+        {
+            continue;
+        }
+
+        int byte_class = classes->class_of[byte];
+        if (class_col[byte_class] == -1)
+        {
+            // The first byte of the class represents it in the symbols array
+            class_col[byte_class] = a.symbol_count;
+            a.symbols[a.symbol_count] = (char)byte;
+            a.symbol_count++;
+        }
+        a.char_to_col[byte] = class_col[byte_class];
     }
 
-    // Add the symbol to the alphabet
-    a->symbols[a->symbol_count] = symbol;
-    a->char_to_col[(unsigned char)symbol] = a->symbol_count;
-    a->symbol_count++;
+    return a;
 }
 
 /**
@@ -113,21 +139,67 @@ states_manager new_states_manager()
 
     manager.next_id = 0;
     manager.states_count = 0;
+    manager.transitions = NULL;
     manager.transitions_count = 0;
-    manager.manager_alphabet = new_alphabet();
+    manager.transitions_capacity = 0;
+    manager.labels = NULL;
+    manager.labels_count = 0;
+    manager.labels_capacity = 0;
     return manager;
 }
 
+/**
+ * @brief Function to release the memory owned by a states manager.
+ * @param manager Pointer to the states_manager struct to free
+ */
+void free_states_manager(states_manager *manager)
+{
+    free(manager->transitions);
+    manager->transitions = NULL;
+    manager->transitions_count = 0;
+    manager->transitions_capacity = 0;
+
+    free(manager->labels);
+    manager->labels = NULL;
+    manager->labels_count = 0;
+    manager->labels_capacity = 0;
+}
+
+/**
+ * @brief Function to add a byte set to the list of transition labels.
+ * @param manager Pointer to the states_manager struct that manages the labels
+ * @param set The byte set of the label
+ * @return The index of the new label
+ */
+int32_t new_label(states_manager *manager, const byte_set *set)
+{
+    // Grow the labels list when it is full
+    if (manager->labels_count == manager->labels_capacity)
+    {
+        uint32_t capacity = manager->labels_capacity == 0 ? 16 : manager->labels_capacity * 2;
+        byte_set *labels = realloc(manager->labels, capacity * sizeof(byte_set));
+        if (labels == NULL)
+        {
+            fprintf(stderr, "Error: Out of memory while building the NFA.\n");
+            exit(EXIT_FAILURE);
+        }
+        manager->labels = labels;
+        manager->labels_capacity = capacity;
+    }
+
+    manager->labels[manager->labels_count] = *set;
+    return (int32_t)manager->labels_count++;
+}
+
 /**
  * @brief Function to create a new state in the states manager. This function assigns a new state ID,
  * adds it to the list of states, and returns the new state ID.
  * @param manager Pointer to the states_manager struct that manages the states
  * @return The ID of the newly created state
  */
-uint8_t new_state(states_manager *manager)
+uint32_t new_state(states_manager *manager)
 {
-    uint8_t state = manager->next_id;
-    manager->states[manager->states_count] = state;
+    uint32_t state = manager->next_id;
     manager->states_count++;
     manager->next_id++;
 
@@ -139,14 +211,28 @@ uint8_t new_state(states_manager *manager)
  * struct and adds it to the list of transitions.
  * @param manager Pointer to the states_manager struct that manages the states and transitions
  * @param from_state The state from which the transition originates
- * @param symbol The symbol on which the transition occurs
+ * @param label The label on which the transition occurs, or EPSILON_LABEL
  * @param to_state The state to which the transition leads
  */
-void add_transition(states_manager *manager, uint8_t from_state, char symbol, uint8_t to_state)
+void add_transition(states_manager *manager, uint32_t from_state, int32_t label, uint32_t to_state)
 {
+    // Grow the transitions list when it is full
+    if (manager->transitions_count == manager->transitions_capacity)
+    {
+        uint32_t capacity = manager->transitions_capacity == 0 ? 64 : manager->transitions_capacity * 2;
+        t_transition *transitions = realloc(manager->transitions, capacity * sizeof(t_transition));
+        if (transitions == NULL)
+        {
+            fprintf(stderr, "Error: Out of memory while building the NFA.\n");
+            exit(EXIT_FAILURE);
+        }
+        manager->transitions = transitions;
+        manager->transitions_capacity = capacity;
+    }
+
     t_transition transition;
     transition.from_state = from_state;
-    transition.symbol = symbol;
+    transition.label = label;
     transition.to_state = to_state;
 
     manager->transitions[manager->transitions_count] = transition;
@@ -172,25 +258,29 @@ t_nfa concat_nfa(states_manager *manager, t_nfa *a, t_nfa *b)
     result.start = a->start;
     // The end state of the result is the end state of b
     result.end = b->end;
+    result.first_state = a->first_state;
+    result.first_transition = a->first_transition;
 
     // Add an epsilon transition from the end state of a to the start state of b
-    add_transition(manager, a->end, EPSILON_SYMBOL, b->start);
+    add_transition(manager, a->end, EPSILON_LABEL, b->start);
 
     return result;
 }
 
 /**
- * @brief Function to create a new NFA that represents a single symbol. This function creates a new NFA
- * with a start state and an end state, and adds a transition from the start state to the end state on
- * the given symbol.
+ * @brief Function to create a new NFA that represents a single operand. This function creates a new NFA
+ * with a start state and an end state, and adds a transition from the start state to the end state
+ * labelled with the bytes of the operand. A literal, a class and the wildcard all take one transition.
  * @param manager Pointer to the states_manager struct that manages the states and transitions
- * @param symbol The symbol for which the NFA should be created
- * @return A new NFA struct representing the given symbol
+ * @param bytes The bytes matched by the operand
+ * @return A new NFA struct representing the given operand
  */
-t_nfa symbol_nfa(states_manager *manager, char symbol)
+t_nfa symbol_nfa(states_manager *manager, const byte_set *bytes)
 {
     // Create a new nfa that represents the symbol.
     t_nfa result;
+    result.first_state = manager->next_id;
+    result.first_transition = manager->transitions_count;
 
     // The start state of the result is the next available state
     result.start = new_state(manager);
@@ -198,8 +288,8 @@ t_nfa symbol_nfa(states_manager *manager, char symbol)
     // The end state of the result is the next available state
     result.end = new_state(manager);
 
-    // Add a transition from the start state to the end state on the given symbol
-    add_transition(manager, result.start, symbol, result.end);
+    // Add a transition from the start state to the end state on the given bytes
+    add_transition(manager, result.start, new_label(manager, bytes), result.end);
 
     return result;
 }
@@ -218,6 +308,8 @@ t_nfa union_nfa(states_manager *manager, t_nfa *a, t_nfa *b)
 {
     // Create a new nfa that represents the union of a and b.
     t_nfa result;
+    result.first_state = a->first_state;
+    result.first_transition = a->first_transition;
 
     // The start state of the result is the next available state
     result.start = new_state(manager);
@@ -226,16 +318,16 @@ t_nfa union_nfa(states_manager *manager, t_nfa *a, t_nfa *b)
     result.end = new_state(manager);
 
     // Add an epsilon transition from the start state of the result to the start state of a
-    add_transition(manager, result.start, EPSILON_SYMBOL, a->start);
+    add_transition(manager, result.start, EPSILON_LABEL, a->start);
 
     // Add an epsilon transition from the start state of the result to the start state of b
-    add_transition(manager, result.start, EPSILON_SYMBOL, b->start);
+    add_transition(manager, result.start, EPSILON_LABEL, b->start);
 
     // Add an epsilon transition from the end state of a to the end state of the result
-    add_transition(manager, a->end, EPSILON_SYMBOL, result.end);
+    add_transition(manager, a->end, EPSILON_LABEL, result.end);
 
     // Add an epsilon transition from the end state of b to the end state of the result
-    add_transition(manager, b->end, EPSILON_SYMBOL, result.end);
+    add_transition(manager, b->end, EPSILON_LABEL, result.end);
 
     return result;
 }
@@ -254,6 +346,8 @@ t_nfa positive_closure_nfa(states_manager *manager, t_nfa *a)
 {
     // Create a new nfa that represents the positive closure of a.
     t_nfa result;
+    result.first_state = a->first_state;
+    result.first_transition = a->first_transition;
 
     // The start state of the result is the next available state
     result.start = new_state(manager);
@@ -262,13 +356,13 @@ t_nfa positive_closure_nfa(states_manager *manager, t_nfa *a)
     result.end = new_state(manager);
 
     // Add an epsilon transition from the start state of the result to the start state of a
-    add_transition(manager, result.start, EPSILON_SYMBOL, a->start);
+    add_transition(manager, result.start, EPSILON_LABEL, a->start);
 
     // Add an epsilon transition from the end state of a to the start state of a
-    add_transition(manager, a->end, EPSILON_SYMBOL, a->start);
+    add_transition(manager, a->end, EPSILON_LABEL, a->start);
 
     // Add an epsilon transition from the end state of a to the end state of the result
-    add_transition(manager, a->end, EPSILON_SYMBOL, result.end);
+    add_transition(manager, a->end, EPSILON_LABEL, result.end);
 
     return result;
 }
@@ -291,7 +385,7 @@ t_nfa kleene_closure_nfa(states_manager *manager, t_nfa *a)
     t_nfa result = positive_closure_nfa(manager, a);
 
     // Add an epsilon transition from the start state of the result to the end state of the result
-    add_transition(manager, result.start, EPSILON_SYMBOL, result.end);
+    add_transition(manager, result.start, EPSILON_LABEL, result.end);
 
     return result;
 }
@@ -307,23 +401,108 @@ t_nfa kleene_closure_nfa(states_manager *manager, t_nfa *a)
 t_nfa optional_nfa(states_manager *manager, t_nfa *a)
 {
     // Add an epsilon transition from the start state of a to the end state of a
-    add_transition(manager, a->start, EPSILON_SYMBOL, a->end);
+    add_transition(manager, a->start, EPSILON_LABEL, a->end);
 
     return *a;
 }
 
+/**
+ * @brief Function to create a copy of an NFA with new states. The transitions of the copy use
+ * the same labels as the ones of the original, so copies do not add symbols to the alphabet.
+ * @param manager Pointer to the states_manager struct that manages the states and transitions
+ * @param a Pointer to the NFA to copy
+ * @param states_end The state after the last state of the NFA
+ * @param transitions_end The index after the last transition of the NFA
+ * @return The copy of the NFA
+ */
+static t_nfa copy_nfa(states_manager *manager, const t_nfa *a, uint32_t states_end, uint32_t transitions_end)
+{
+    // The copy has the same layout as the original, shifted to the next available states
+    uint32_t offset = manager->next_id - a->first_state;
+    t_nfa result;
+    result.start = a->start + offset;
+    result.end = a->end + offset;
+    result.first_state = manager->next_id;
+    result.first_transition = manager->transitions_count;
+
+    for (uint32_t state = a->first_state; state < states_end; state++)
+    {
+        new_state(manager);
+    }
+    for (uint32_t i = a->first_transition; i < transitions_end; i++)
+    {
+        // Read by index, since adding transitions can move the list
+        t_transition transition = manager->transitions[i];
+        add_transition(manager, transition.from_state + offset, transition.label, transition.to_state + offset);
+    }
 
-nfa regex_to_nfa(const regex r)
+    return result;
+}
+
+/**
+ * @brief Function to create a new NFA that represents a bounded repetition of an NFA. The copies
+ * of the input NFA are chained one after the other, and every copy from the min-th on can skip
+ * straight to the end. Without an upper bound, the last copy loops back to its start. The input
+ * NFA is the first copy, and the others are made by copying its transitions, so the operand is
+ * only built once however many copies there are.
+ * @param manager Pointer to the states_manager struct that manages the states and transitions
+ * @param a Pointer to the input NFA
+ * @param min The least number of copies
+ * @param max The largest number of copies, or -1 when unbounded
+ * @return A new NFA struct representing the repetition of the input NFA
+ */
+t_nfa repetition_nfa(states_manager *manager, t_nfa *a, int min, int max)
 {
-    // Create a new states manager
-    states_manager manager = new_states_manager();
+    const uint32_t states_end = manager->next_id;
+    const uint32_t transitions_end = manager->transitions_count;
+    const int copies = max != -1 ? max : (min > 0 ? min : 1);
+
+    t_nfa result;
+    result.first_state = a->first_state;
+    result.first_transition = a->first_transition;
+    result.start = new_state(manager);
+    result.end = new_state(manager);
+
+    // Point reached after the copies so far
+    uint32_t point = result.start;
+    for (int copy = 0; copy < copies; copy++)
+    {
+        if (copy >= min)
+        {
+            // Enough copies were matched, so the rest can be skipped
+            add_transition(manager, point, EPSILON_LABEL, result.end);
+        }
+
+        t_nfa next = copy == 0 ? *a : copy_nfa(manager, a, states_end, transitions_end);
+        add_transition(manager, point, EPSILON_LABEL, next.start);
+        if (max == -1 && copy == copies - 1)
+        {
+            add_transition(manager, next.end, EPSILON_LABEL, next.start);
+        }
+        point = next.end;
+    }
+    add_transition(manager, point, EPSILON_LABEL, result.end);
 
-    // Initialize a stack to hold the uint8_termediate NFAs
-    t_nfa stack[MAX_STATES];
-    uint8_t stack_top = -1;
+    return result;
+}
+
+
+/**
+ * @brief Function to build the temporary NFA of a regex with a given states manager. The states
+ * and transitions of the regex are added to the manager, so several regexes can share it.
+ * @param manager Pointer to the states_manager struct that manages the states and transitions
+ * @param r The input regular expression as a regex struct
+ * @return The temporary NFA of the regex
+ */
+t_nfa regex_to_t_nfa(states_manager *manager, const regex r)
+{
+    // Initialize a stack to hold the intermediate NFAs. There can never be
+    // more NFAs on the stack than items in the regex.
+    t_nfa *stack = malloc((r.size > 0 ? r.size : 1) * sizeof(t_nfa));
+    int stack_top = -1;
 
     // Process each item in the regex
-    for (uint8_t i = 0; i < r.size; i++)
+    for (int i = 0; i < r.size; i++)
     {
         // Get the current item
         item current_item = r.items[i];
@@ -331,40 +510,50 @@ nfa regex_to_nfa(const regex r)
         // If the item is an operand, create a new NFA for the symbol and push it onto the stack
         if (current_item.type == OPERAND)
         {
-            stack[++stack_top] = symbol_nfa(&manager, current_item.value);
-            // Add the symbol to the manager's alphabet
-            add_symbol(&manager.manager_alphabet, current_item.value);
+            stack[++stack_top] = symbol_nfa(manager, &current_item.bytes);
         }
         // Else, the item is an operator, so pop the necessary NFAs from the stack, apply the
         // operator, and push the result back onto the stack
         else
         {
+            int operands = (current_item.type == CONCATENATION || current_item.type == ALTERNATION) ? 2 : 1;
+            if (stack_top + 1 < operands)
+            {
+                fprintf(stderr, "Error: Invalid regex. Operator '%c' is missing operands.\n", current_item.value);
+                exit(EXIT_FAILURE);
+            }
+
             if (current_item.type == CONCATENATION)
             {
                 t_nfa b = stack[stack_top--];
                 t_nfa a = stack[stack_top--];
-                stack[++stack_top] = concat_nfa(&manager, &a, &b);
+                stack[++stack_top] = concat_nfa(manager, &a, &b);
             }
             else if (current_item.type == ALTERNATION)
             {
                 t_nfa b = stack[stack_top--];
                 t_nfa a = stack[stack_top--];
-                stack[++stack_top] = union_nfa(&manager, &a, &b);
+                stack[++stack_top] = union_nfa(manager, &a, &b);
             }
             else if (current_item.type == POSITIVE_CLOSURE)
             {
                 t_nfa a = stack[stack_top--];
-                stack[++stack_top] = positive_closure_nfa(&manager, &a);
+                stack[++stack_top] = positive_closure_nfa(manager, &a);
             }
             else if (current_item.type == KLEENE_STAR)
             {
                 t_nfa a = stack[stack_top--];
-                stack[++stack_top] = kleene_closure_nfa(&manager, &a);
+                stack[++stack_top] = kleene_closure_nfa(manager, &a);
             }
             else if (current_item.type == OPTIONAL)
             {
                 t_nfa a = stack[stack_top--];
-                stack[++stack_top] = optional_nfa(&manager, &a);
+                stack[++stack_top] = optional_nfa(manager, &a);
+            }
+            else if (current_item.type == REPETITION)
+            {
+                t_nfa a = stack[stack_top--];
+                stack[++stack_top] = repetition_nfa(manager, &a, current_item.min, current_item.max);
             }
         }
     }
@@ -375,133 +564,899 @@ nfa regex_to_nfa(const regex r)
         fprintf(stderr, "Error: Invalid regex. Stack should have exactly one NFA left, but has %d.\n", stack_top + 1);
         exit(EXIT_FAILURE);
     }
-    else
+
+    t_nfa result = stack[stack_top];
+    free(stack);
+    return result;
+}
+
+nfa regex_to_nfa(const regex r)
+{
+    // Create a new states manager
+    states_manager manager = new_states_manager();
+
+    t_nfa temp_nfa = regex_to_t_nfa(&manager, r);
+    nfa result = t_nfa_to_nfa(temp_nfa, &manager);
+    free_states_manager(&manager);
+    remove_epsilon_transitions(&result);
+
+    // Matching goes through a lazy DFA; NULL (no usable budget) means plain simulation.
+    result.lazy_cache = new_lazy_dfa(&result, LAZY_DFA_DEFAULT_BUDGET, false);
+    result.search_cache = new_lazy_dfa(&result, LAZY_DFA_DEFAULT_BUDGET, true);
+
+    // Small regexes also get a bit-parallel automaton, which match_nfa prefers
+    result.bit_parallel = malloc(sizeof(glushkov));
+    if (result.bit_parallel != NULL && !regex_to_glushkov(r, result.bit_parallel))
     {
-        t_nfa temp_nfa = stack[stack_top];
-        return t_nfa_to_nfa(temp_nfa, manager);
+        free(result.bit_parallel);
+        result.bit_parallel = NULL;
     }
+
+    // Regexes with a required literal get a prefilter for search_nfa
+    result.prefilter = malloc(sizeof(prefilter));
+    if (result.prefilter != NULL && !regex_to_prefilter(r, result.prefilter))
+    {
+        free(result.prefilter);
+        result.prefilter = NULL;
+    }
+    return result;
+}
+
+nfa regex_set_to_nfa(const regex *patterns, uint32_t count, int32_t **state_patterns, bool *nullable)
+{
+    states_manager manager = new_states_manager();
+
+    // The start state leads to the start of every pattern
+    uint32_t start = new_state(&manager);
+    uint32_t *starts = malloc((count > 0 ? count : 1) * sizeof(uint32_t));
+    uint32_t *ends = malloc((count > 0 ? count : 1) * sizeof(uint32_t));
+    // States of pattern i are numbered from first_state[i] to first_state[i + 1] - 1
+    uint32_t *first_state = malloc((count + 1) * sizeof(uint32_t));
+    if (starts == NULL || ends == NULL || first_state == NULL)
+    {
+        fprintf(stderr, "Error: Out of memory while building the NFA.\n");
+        exit(EXIT_FAILURE);
+    }
+
+    for (uint32_t i = 0; i < count; i++)
+    {
+        first_state[i] = manager.next_id;
+        t_nfa fragment = regex_to_t_nfa(&manager, patterns[i]);
+        add_transition(&manager, start, EPSILON_LABEL, fragment.start);
+        starts[i] = fragment.start;
+        ends[i] = fragment.end;
+    }
+    first_state[count] = manager.next_id;
+
+    t_nfa temp_nfa;
+    temp_nfa.start = start;
+    temp_nfa.end = start;
+    temp_nfa.first_state = start;
+    temp_nfa.first_transition = 0;
+    nfa result = t_nfa_to_nfa(temp_nfa, &manager);
+    free_states_manager(&manager);
+
+    // Every pattern accepts at its own end state. After removing the epsilon transitions
+    // the start state accepts for all the nullable patterns at once, so they are kept apart.
+    // The patterns share no states, so one set of visited states serves all the searches.
+    uint64_t *visited = calloc(result.words, sizeof(uint64_t));
+    uint32_t *stack = malloc(result.states * sizeof(uint32_t));
+    if (visited == NULL || stack == NULL)
+    {
+        fprintf(stderr, "Error: Out of memory while building the NFA.\n");
+        exit(EXIT_FAILURE);
+    }
+    state_set_clear(result.accept_states, result.words);
+    for (uint32_t i = 0; i < count; i++)
+    {
+        state_set_add(result.accept_states, ends[i]);
+        nullable[i] = epsilon_reaches(&result, starts[i], ends[i], visited, stack);
+    }
+    free(visited);
+    free(stack);
+    free(starts);
+    free(ends);
+
+    uint32_t *kept_ids = NULL;
+    remove_epsilon_transitions_keeping_ids(&result, &kept_ids);
+
+    // Find the pattern whose range of original states holds each kept state
+    int32_t *patterns_of = malloc((result.states > 0 ? result.states : 1) * sizeof(int32_t));
+    if (patterns_of == NULL)
+    {
+        fprintf(stderr, "Error: Out of memory while building the NFA.\n");
+        exit(EXIT_FAILURE);
+    }
+    for (uint32_t state = 0; state < result.states; state++)
+    {
+        if (kept_ids[state] == start)
+        {
+            patterns_of[state] = -1;
+            continue;
+        }
+        uint32_t low = 0;
+        uint32_t high = count;
+        while (high - low > 1)
+        {
+            uint32_t middle = low + (high - low) / 2;
+            if (first_state[middle] <= kept_ids[state])
+            {
+                low = middle;
+            }
+            else
+            {
+                high = middle;
+            }
+        }
+        patterns_of[state] = (int32_t)low;
+    }
+    free(kept_ids);
+    free(first_state);
+    *state_patterns = patterns_of;
+
+    return result;
+}
+
+/**
+ * @brief Compare two transitions packed as (column << 32 | target), for qsort.
+ */
+static int compare_edges(const void *a, const void *b)
+{
+    uint64_t x = *(const uint64_t *)a;
+    uint64_t y = *(const uint64_t *)b;
+    return (x > y) - (x < y);
+}
+
+/**
+ * @brief Store the transitions of every state as the sparse transitions of an NFA. The transitions
+ * of each state are sorted by column and target, and repeated ones are dropped.
+ * @param automaton Pointer to the NFA. Its states field gives the number of states
+ * @param keys Transitions packed as (column << 32 | target) and grouped by source state. Released here
+ * @param start Array with states + 1 entries, where the transitions of a state are keys[start[state]]
+ * to keys[start[state + 1] - 1]. It becomes the edge_start array of the NFA
+ */
+static void set_sparse_transitions(nfa *automaton, uint64_t *keys, uint32_t *start)
+{
+    const uint32_t states = automaton->states;
+
+    // Sort the transitions of each state and compact them towards the front
+    uint32_t count = 0;
+    for (uint32_t state = 0; state < states; state++)
+    {
+        uint32_t first = start[state];
+        uint32_t last = start[state + 1];
+        if (last - first > 1)
+        {
+            qsort(keys + first, last - first, sizeof(uint64_t), compare_edges);
+        }
+        start[state] = count;
+        for (uint32_t edge = first; edge < last; edge++)
+        {
+            if (edge == first || keys[edge] != keys[count - 1])
+            {
+                keys[count++] = keys[edge];
+            }
+        }
+    }
+    start[states] = count;
+
+    uint16_t *columns = malloc((count > 0 ? count : 1) * sizeof(uint16_t));
+    uint32_t *targets = malloc((count > 0 ? count : 1) * sizeof(uint32_t));
+    if (columns == NULL || targets == NULL)
+    {
+        fprintf(stderr, "Error: Out of memory while building the NFA.\n");
+        exit(EXIT_FAILURE);
+    }
+    for (uint32_t edge = 0; edge < count; edge++)
+    {
+        columns[edge] = (uint16_t)(keys[edge] >> 32);
+        targets[edge] = (uint32_t)keys[edge];
+    }
+    free(keys);
+
+    automaton->edge_start = start;
+    automaton->edge_columns = columns;
+    automaton->edge_targets = targets;
+}
+
+/**
+ * @brief Release the dense transition table of an NFA, if it has one.
+ * @param automaton Pointer to the NFA
+ */
+static void free_dense_transitions(nfa *automaton)
+{
+    if (automaton->transitions != NULL)
+    {
+        // All rows share the block that starts at the first row.
+        if (automaton->states > 0)
+        {
+            free(automaton->transitions[0]);
+        }
+        free(automaton->transitions);
+        automaton->transitions = NULL;
+    }
+}
+
+void build_dense_transitions(nfa *automaton)
+{
+    free_dense_transitions(automaton);
+
+    const uint32_t states = automaton->states;
+    const size_t row_words = (size_t)automaton->nfa_alphabet.symbol_count * automaton->words;
+    if (states == 0 ||
+        (automaton->words > 1 && row_words > NFA_DENSE_TABLE_LIMIT / sizeof(uint64_t) / states))
+    {
+        return;
+    }
+
+    // The rows are stored back to back in one block so that the whole table is contiguous.
+    uint64_t *table = calloc((size_t)states * row_words, sizeof(uint64_t));
+    uint64_t **transitions = malloc(states * sizeof(uint64_t *));
+    if (table == NULL || transitions == NULL)
+    {
+        fprintf(stderr, "Error: Out of memory while building the NFA.\n");
+        exit(EXIT_FAILURE);
+    }
+    for (uint32_t state = 0; state < states; state++)
+    {
+        transitions[state] = table + state * row_words;
+        for (uint32_t edge = automaton->edge_start[state]; edge < automaton->edge_start[state + 1]; edge++)
+        {
+            state_set_add(transitions[state] + (size_t)automaton->edge_columns[edge] * automaton->words,
+                          automaton->edge_targets[edge]);
+        }
+    }
+    automaton->transitions = transitions;
 }
 
 /**
  * @brief Function to convert a temporary NFA representation (t_nfa) into the final NFA struct. This function
- * takes the start and end states from the temporary NFA, initializes the transition table based on the
- * transitions stored in the states manager, and calculates the epsilon closures for all states.
+ * takes the start and end states from the temporary NFA and builds the sparse transitions from the transitions
+ * stored in the states manager. No dense table or start states are built, since the epsilon transitions are
+ * removed right after.
  * @param temp_nfa The temporary NFA representation containing the start and end states
- * @param manager The states_manager struct that contains the transitions and alphabet information
+ * @param manager Pointer to the states_manager struct that contains the transitions and alphabet information
  * @return An NFA struct representing the final non-deterministic finite automaton
  */
-nfa t_nfa_to_nfa(t_nfa temp_nfa, states_manager manager)
+nfa t_nfa_to_nfa(t_nfa temp_nfa, states_manager *manager)
 {
     nfa result;
     result.start_state = temp_nfa.start;
-    result.states = manager.states_count;
-    result.accept_states = (1ULL << temp_nfa.end);
-    result.nfa_alphabet = manager.manager_alphabet;
+    result.states = manager->states_count;
+    result.words = (uint32_t)state_set_words(result.states);
+
+    // Split the bytes into the classes that no label tells apart, and
+    // give each class used by some label a column.
+    byte_classes classes = new_byte_classes();
+    byte_set used = empty_byte_set();
+    for (uint32_t i = 0; i < manager->labels_count; i++)
+    {
+        split_byte_classes(&classes, &manager->labels[i]);
+        for (int w = 0; w < 4; w++)
+        {
+            used.bits[w] |= manager->labels[i].bits[w];
+        }
+    }
+    result.nfa_alphabet = new_alphabet(&classes, &used);
+    const int columns = result.nfa_alphabet.symbol_count;
+
+    result.accept_states = calloc(result.words, sizeof(uint64_t));
+    // The columns of label i are label_columns[label_start[i]] to label_columns[label_start[i + 1] - 1]
+    uint32_t *label_start = malloc((manager->labels_count + 1) * sizeof(uint32_t));
+    uint32_t *start = calloc((size_t)result.states + 1, sizeof(uint32_t));
+    if (result.accept_states == NULL || label_start == NULL || start == NULL)
+    {
+        fprintf(stderr, "Error: Out of memory while building the NFA.\n");
+        exit(EXIT_FAILURE);
+    }
+    state_set_add(result.accept_states, temp_nfa.end);
 
-    // Initialize the transition table with empty sets
-    result.transitions = malloc(result.states * sizeof(uint64_t *));
-    for (int i = 0; i < result.states; i++)
+    // Labels are unions of classes, so a label covers a column when it holds the byte representing it.
+    label_start[0] = 0;
+    for (uint32_t i = 0; i < manager->labels_count; i++)
+    {
+        uint32_t covered = 0;
+        for (int col = 1; col < columns; col++)
+        {
+            covered += byte_set_contains(&manager->labels[i], (unsigned char)result.nfa_alphabet.symbols[col]);
+        }
+        label_start[i + 1] = label_start[i] + covered;
+    }
+    uint16_t *label_columns = malloc((label_start[manager->labels_count] + 1) * sizeof(uint16_t));
+    if (label_columns == NULL)
     {
-        result.transitions[i] = malloc(result.nfa_alphabet.symbol_count * sizeof(uint64_t));
-        for (int j = 0; j < result.nfa_alphabet.symbol_count; j++)
-            result.transitions[i][j] = 0;
+        fprintf(stderr, "Error: Out of memory while building the NFA.\n");
+        exit(EXIT_FAILURE);
+    }
+    for (uint32_t i = 0; i < manager->labels_count; i++)
+    {
+        uint32_t next = label_start[i];
+        for (int col = 1; col < columns; col++)
+        {
+            if (byte_set_contains(&manager->labels[i], (unsigned char)result.nfa_alphabet.symbols[col]))
+            {
+                label_columns[next++] = (uint16_t)col;
+            }
+        }
     }
 
-    // Fill the transition table based on the transitions in the manager
-    for (uint8_t i = 0; i < manager.transitions_count; i++)
+    // Group the transitions by source state: count them, then place them
+    uint64_t edges = 0;
+    for (uint32_t i = 0; i < manager->transitions_count; i++)
     {
-        t_transition t = manager.transitions[i];
-        int col = result.nfa_alphabet.char_to_col[(unsigned char)t.symbol];
-        result.transitions[t.from_state][col] |= (1ULL << t.to_state);
+        t_transition t = manager->transitions[i];
+        uint32_t count = t.label == EPSILON_LABEL ? 1 : label_start[t.label + 1] - label_start[t.label];
+        start[t.from_state + 1] += count;
+        edges += count;
     }
+    uint64_t *keys = malloc((edges > 0 ? edges : 1) * sizeof(uint64_t));
+    uint32_t *next = malloc((result.states > 0 ? result.states : 1) * sizeof(uint32_t));
+    if (edges > UINT32_MAX || keys == NULL || next == NULL)
+    {
+        fprintf(stderr, "Error: Out of memory while building the NFA.\n");
+        exit(EXIT_FAILURE);
+    }
+    for (uint32_t state = 0; state < result.states; state++)
+    {
+        start[state + 1] += start[state];
+        next[state] = start[state];
+    }
+    for (uint32_t i = 0; i < manager->transitions_count; i++)
+    {
+        t_transition t = manager->transitions[i];
+        if (t.label == EPSILON_LABEL)
+        {
+            keys[next[t.from_state]++] = t.to_state;
+            continue;
+        }
+        for (uint32_t c = label_start[t.label]; c < label_start[t.label + 1]; c++)
+        {
+            keys[next[t.from_state]++] = (uint64_t)label_columns[c] << 32 | t.to_state;
+        }
+    }
+    free(next);
+    free(label_columns);
+    free(label_start);
+
+    set_sparse_transitions(&result, keys, start);
+    result.transitions = NULL;
 
-    calculate_epsilon_closure(&result);
+    result.start_states = NULL;
+    result.epsilon_free = false;
+    result.lazy_cache = NULL;
+    result.search_cache = NULL;
+    result.bit_parallel = NULL;
+    result.prefilter = NULL;
+    result.image = NULL;
 
     return result;
 }
 
 /**
- * @brief Function to calculate the epsilon closure for all states in the given NFA.
- * This function initializes a cache to store the epsilon closures and computes the closure
- * for each state using a depth-first search approach.
- * @param automaton Pointer to the NFA for which epsilon closures are to be calculated
+ * @brief Check whether a state reaches another one through epsilon transitions alone.
+ * @param automaton Pointer to the NFA
+ * @param from The state to start from
+ * @param to The state to look for
+ * @param visited State set of the states already searched, which are skipped. A search from a
+ * state that cannot reach the states visited before finds the same result with fewer steps
+ * @param stack Scratch space with room for one entry per state
+ * @return true if `to` is in the epsilon closure of `from`, false otherwise
+ */
+static bool epsilon_reaches(const nfa *automaton, uint32_t from, uint32_t to, uint64_t *visited, uint32_t *stack)
+{
+    uint32_t stack_top = 0;
+    bool found = false;
+    state_set_add(visited, from);
+    stack[stack_top++] = from;
+    while (stack_top > 0)
+    {
+        uint32_t state = stack[--stack_top];
+        found = found || state == to;
+        for (uint32_t edge = automaton->edge_start[state];
+             edge < automaton->edge_start[state + 1] && automaton->edge_columns[edge] == 0; edge++)
+        {
+            uint32_t target = automaton->edge_targets[edge];
+            if (!state_set_contains(visited, target))
+            {
+                state_set_add(visited, target);
+                stack[stack_top++] = target;
+            }
+        }
+    }
+    return found;
+}
+
+/**
+ * @brief Struct to represent the strongly connected components of the epsilon transitions of an NFA,
+ * and the graph of epsilon transitions between them, which has no cycles. The epsilon closure of a
+ * state is every state of the components reachable from its own, so closures are walked instead of
+ * stored, and the whole struct takes memory linear in the states and transitions.
+ */
+struct epsilon_components
+{
+    /* Number of components. They are numbered in the order Tarjan's algorithm completes them,
+    so an epsilon transition always leads to a component with a lower number or to its own. */
+    uint32_t count;
+    /* Component of each state */
+    uint32_t *component_of;
+    /* The states of component c are members[member_start[c]] to members[member_start[c + 1] - 1] */
+    uint32_t *member_start;
+    uint32_t *members;
+    /* The other components reached by one epsilon transition from component c, without repeats,
+    are successors[successor_start[c]] to successors[successor_start[c + 1] - 1] */
+    uint32_t *successor_start;
+    uint32_t *successors;
+};
+typedef struct epsilon_components epsilon_components;
+
+/**
+ * @brief Find the strongly connected components of the epsilon transitions of an NFA with an
+ * iterative version of Tarjan's algorithm, and the transitions between them.
+ * @param automaton Pointer to the NFA
+ * @return The components. Release them with free_epsilon_components
+ */
+static epsilon_components find_epsilon_components(const nfa *automaton)
+{
+    const uint32_t states = automaton->states;
+    const size_t count = states > 0 ? states : 1;
+
+    epsilon_components components;
+    components.count = 0;
+    components.component_of = malloc(count * sizeof(uint32_t));
+    components.member_start = malloc((count + 1) * sizeof(uint32_t));
+    components.members = malloc(count * sizeof(uint32_t));
+    components.successor_start = malloc((count + 1) * sizeof(uint32_t));
+    // Every epsilon transition gives at most one successor
+    components.successors = malloc(((size_t)automaton->edge_start[states] + 1) * sizeof(uint32_t));
+    // Tarjan's numbering of the states, UINT32_MAX for unvisited ones, and the lowest number
+    // reachable from each one through states still on the component stack
+    uint32_t *index = malloc(count * sizeof(uint32_t));
+    uint32_t *low = malloc(count * sizeof(uint32_t));
+    bool *on_stack = calloc(count, sizeof(bool));
+    // States whose component is not complete yet, in the order they were visited
+    uint32_t *component_stack = malloc(count * sizeof(uint32_t));
+    // The explicit DFS: a state and the next of its transitions to follow
+    uint32_t *call_state = malloc(count * sizeof(uint32_t));
+    uint32_t *call_edge = malloc(count * sizeof(uint32_t));
+    // The last component that took each component as a successor, to skip repeats
+    uint32_t *successor_of = malloc(count * sizeof(uint32_t));
+    if (components.component_of == NULL || components.member_start == NULL || components.members == NULL ||
+        components.successor_start == NULL || components.successors == NULL || index == NULL || low == NULL ||
+        on_stack == NULL || component_stack == NULL || call_state == NULL || call_edge == NULL ||
+        successor_of == NULL)
+    {
+        fprintf(stderr, "Error: Out of memory while building the NFA.\n");
+        exit(EXIT_FAILURE);
+    }
+    memset(index, 0xFF, count * sizeof(uint32_t));
+    memset(successor_of, 0xFF, count * sizeof(uint32_t));
+
+    uint32_t next_index = 0;
+    uint32_t component_top = 0;
+    uint32_t member_count = 0;
+    uint32_t successor_count = 0;
+    for (uint32_t root = 0; root < states; root++)
+    {
+        if (index[root] != UINT32_MAX)
+        {
+            continue;
+        }
+
+        uint32_t depth = 0;
+        call_state[depth] = root;
+        call_edge[depth] = automaton->edge_start[root];
+        depth++;
+        index[root] = low[root] = next_index++;
+        component_stack[component_top++] = root;
+        on_stack[root] = true;
+
+        while (depth > 0)
+        {
+            uint32_t state = call_state[depth - 1];
+            uint32_t edge = call_edge[depth - 1];
+
+            // Follow the next epsilon transition. They come first among the transitions of a state.
+            if (edge < automaton->edge_start[state + 1] && automaton->edge_columns[edge] == 0)
+            {
+                call_edge[depth - 1]++;
+                uint32_t target = automaton->edge_targets[edge];
+                if (index[target] == UINT32_MAX)
+                {
+                    call_state[depth] = target;
+                    call_edge[depth] = automaton->edge_start[target];
+                    depth++;
+                    index[target] = low[target] = next_index++;
+                    component_stack[component_top++] = target;
+                    on_stack[target] = true;
+                }
+                else if (on_stack[target] && index[target] < low[state])
+                {
+                    low[state] = index[target];
+                }
+                continue;
+            }
+
+            // Every transition of the state is followed. If it is the root of a component, the
+            // component is the states above it on the stack, and the ones it reaches are complete.
+            if (low[state] == index[state])
+            {
+                const uint32_t component = components.count++;
+                components.member_start[component] = member_count;
+                components.successor_start[component] = successor_count;
+                uint32_t first = component_top;
+                do
+                {
+                    first--;
+                    on_stack[component_stack[first]] = false;
+                    components.component_of[component_stack[first]] = component;
+                } while (component_stack[first] != state);
+
+                for (uint32_t i = first; i < component_top; i++)
+                {
+                    uint32_t member = component_stack[i];
+                    components.members[member_count++] = member;
+                    for (uint32_t e = automaton->edge_start[member];
+                         e < automaton->edge_start[member + 1] && automaton->edge_columns[e] == 0; e++)
+                    {
+                        uint32_t successor = components.component_of[automaton->edge_targets[e]];
+                        if (successor != component && successor_of[successor] != component)
+                        {
+                            successor_of[successor] = component;
+                            components.successors[successor_count++] = successor;
+                        }
+                    }
+                }
+                component_top = first;
+            }
+
+            depth--;
+            if (depth > 0 && low[state] < low[call_state[depth - 1]])
+            {
+                low[call_state[depth - 1]] = low[state];
+            }
+        }
+    }
+    components.member_start[components.count] = member_count;
+    components.successor_start[components.count] = successor_count;
+
+    free(index);
+    free(low);
+    free(on_stack);
+    free(component_stack);
+    free(call_state);
+    free(call_edge);
+    free(successor_of);
+    return components;
+}
+
+/**
+ * @brief Release the arrays of the epsilon components of an NFA.
+ * @param components Pointer to the components
+ */
+static void free_epsilon_components(epsilon_components *components)
+{
+    free(components->component_of);
+    free(components->member_start);
+    free(components->members);
+    free(components->successor_start);
+    free(components->successors);
+}
+
+/**
+ * @brief List the components reachable from a component, itself included, which together hold
+ * the epsilon closure of its states.
+ * @param components Pointer to the components
+ * @param component The component to start from
+ * @param reached Output array with room for every component. It is also the queue of the search
+ * @param mark Array with an entry per component, set to `stamp` for the components listed
+ * @param stamp A value that no entry of mark holds yet
+ * @return The number of components listed in reached
  */
-void calculate_epsilon_closure(nfa *automaton)
+static uint32_t reach_components(const epsilon_components *components, uint32_t component, uint32_t *reached,
+                                 uint32_t *mark, uint32_t stamp)
 {
-    // Allocate cache storage sized for all states.
-    uint64_t *closure_cache = malloc(automaton->states * sizeof(uint64_t));
+    uint32_t count = 0;
+    mark[component] = stamp;
+    reached[count++] = component;
+    for (uint32_t next = 0; next < count; next++)
+    {
+        uint32_t current = reached[next];
+        for (uint32_t i = components->successor_start[current]; i < components->successor_start[current + 1]; i++)
+        {
+            uint32_t successor = components->successors[i];
+            if (mark[successor] != stamp)
+            {
+                mark[successor] = stamp;
+                reached[count++] = successor;
+            }
+        }
+    }
+    return count;
+}
 
-    // Initialize the cache to 0 so we can detect "not computed".
-    for (int i = 0; i < automaton->states; i++)
+/**
+ * @brief Replace an NFA by the one whose states are the epsilon components of its states. All the
+ * states of a component are active at the same time, so a single state with all their transitions
+ * does the same. The components are numbered in reverse, so that every epsilon transition leads
+ * to a higher state, as nfa_close_states needs.
+ * @param automaton Pointer to the NFA to transform in place
+ * @param components Pointer to the components of the NFA
+ * @param kept_ids Output for an array with the original number of a state of each new state, owned
+ * by the caller, or NULL if it is not needed
+ */
+static void condense_epsilon_components(nfa *automaton, const epsilon_components *components, uint32_t **kept_ids)
+{
+    const uint32_t count = components->count;
+    const size_t new_words = state_set_words(count);
+    uint32_t *start = malloc(((size_t)count + 1) * sizeof(uint32_t));
+    uint64_t *keys = malloc(((size_t)automaton->edge_start[automaton->states] + 1) * sizeof(uint64_t));
+    uint64_t *accept_states = calloc(new_words, sizeof(uint64_t));
+    uint64_t *start_states = calloc(new_words, sizeof(uint64_t));
+    uint32_t *old_id = malloc((count > 0 ? count : 1) * sizeof(uint32_t));
+    if (start == NULL || keys == NULL || accept_states == NULL || start_states == NULL || old_id == NULL)
     {
-        closure_cache[i] = 0;
+        fprintf(stderr, "Error: Out of memory while building the NFA.\n");
+        exit(EXIT_FAILURE);
     }
 
-    // Attach the cache to the automaton.
-    automaton->epsilon_closure_cache = closure_cache;
+    // Every transition of a member becomes one of its component, or goes away when it stays inside
+    uint32_t edges = 0;
+    for (uint32_t state = 0; state < count; state++)
+    {
+        const uint32_t component = count - 1 - state;
+        start[state] = edges;
+        old_id[state] = components->members[components->member_start[component]];
+        for (uint32_t i = components->member_start[component]; i < components->member_start[component + 1]; i++)
+        {
+            uint32_t member = components->members[i];
+            if (state_set_contains(automaton->accept_states, member))
+            {
+                state_set_add(accept_states, state);
+            }
+            for (uint32_t edge = automaton->edge_start[member]; edge < automaton->edge_start[member + 1]; edge++)
+            {
+                uint32_t target = count - 1 - components->component_of[automaton->edge_targets[edge]];
+                if (automaton->edge_columns[edge] != 0 || target != state)
+                {
+                    keys[edges++] = (uint64_t)automaton->edge_columns[edge] << 32 | target;
+                }
+            }
+        }
+    }
+    start[count] = edges;
 
-    // Compute all closures up front so lookups are O(1).
-    for (uint8_t state = 0; state < automaton->states; state++)
+    uint32_t start_state = count - 1 - components->component_of[automaton->start_state];
+    if (kept_ids != NULL)
+    {
+        *kept_ids = old_id;
+    }
+    else
     {
-        epsilon_closure(automaton, state);
+        free(old_id);
     }
+
+    free_dense_transitions(automaton);
+    free(automaton->edge_start);
+    free(automaton->edge_columns);
+    free(automaton->edge_targets);
+    free(automaton->accept_states);
+    free(automaton->start_states);
+
+    automaton->start_state = start_state;
+    automaton->states = count;
+    automaton->words = (uint32_t)new_words;
+    set_sparse_transitions(automaton, keys, start);
+    build_dense_transitions(automaton);
+    automaton->accept_states = accept_states;
+    automaton->start_states = start_states;
+    state_set_add(start_states, start_state);
+    nfa_close_states(automaton, start_states);
+    automaton->epsilon_free = false;
 }
 
 /**
- * @brief Function to compute the epsilon closure for a given state in the NFA.
- * This function uses a depth-first search approach to find all states reachable
- * from the given state via epsilon transitions.
- * @param automaton Pointer to the NFA
- * @param state The state for which the epsilon closure is to be computed
+ * @brief Remove the epsilon transitions of an NFA, like remove_epsilon_transitions, and
+ * optionally hand over the original number of every kept state.
+ * @param automaton Pointer to the NFA to transform in place
+ * @param kept_ids Output for an array with the original number of each new state, owned by
+ * the caller, or NULL if it is not needed
  */
-void epsilon_closure(nfa *automaton, uint8_t state)
+static void remove_epsilon_transitions_keeping_ids(nfa *automaton, uint32_t **kept_ids)
 {
-    // Return if the closure for this state has already been computed and cached.
-    if (automaton->epsilon_closure_cache[state] != 0)
+    if (automaton->epsilon_free)
+    {
         return;
+    }
 
-    // Start with the state itself in the closure.
-    uint64_t closure = (1ULL << state);
+    const uint32_t states = automaton->states;
+    const size_t words = automaton->words;
+    epsilon_components components = find_epsilon_components(automaton);
+
+    // The states kept are the start state and every target of a symbol transition
+    uint64_t *kept = calloc(words, sizeof(uint64_t));
+    uint32_t *new_id = malloc((states > 0 ? states : 1) * sizeof(uint32_t));
+    uint32_t *old_id = malloc((states > 0 ? states : 1) * sizeof(uint32_t));
+    bool *component_accepts = calloc(components.count > 0 ? components.count : 1, sizeof(bool));
+    uint32_t *reached = malloc((components.count > 0 ? components.count : 1) * sizeof(uint32_t));
+    uint32_t *mark = malloc((components.count > 0 ? components.count : 1) * sizeof(uint32_t));
+    if (kept == NULL || new_id == NULL || old_id == NULL || component_accepts == NULL || reached == NULL ||
+        mark == NULL)
+    {
+        fprintf(stderr, "Error: Out of memory while building the NFA.\n");
+        exit(EXIT_FAILURE);
+    }
+    memset(mark, 0xFF, (components.count > 0 ? components.count : 1) * sizeof(uint32_t));
 
-    // Use an explicit stack for DFS over epsilon transitions.
-    uint8_t stack[MAX_STATES];
-    int stack_top = -1;
+    state_set_add(kept, automaton->start_state);
+    for (uint32_t edge = 0; edge < automaton->edge_start[states]; edge++)
+    {
+        if (automaton->edge_columns[edge] != 0)
+        {
+            state_set_add(kept, automaton->edge_targets[edge]);
+        }
+    }
+    for (uint32_t state = 0; state < states; state++)
+    {
+        if (state_set_contains(automaton->accept_states, state))
+        {
+            component_accepts[components.component_of[state]] = true;
+        }
+    }
 
-    // Push the initial state.
-    stack[++stack_top] = state;
+    // Number the kept states in their original order
+    uint32_t kept_count = 0;
+    for (uint32_t state = 0; state < states; state++)
+    {
+        if (state_set_contains(kept, state))
+        {
+            new_id[state] = kept_count;
+            old_id[kept_count] = state;
+            kept_count++;
+        }
+    }
 
-    // Explore epsilon transitions until the stack is empty.
-    while (stack_top >= 0)
+    const size_t new_words = state_set_words(kept_count);
+    uint32_t *start = malloc(((size_t)kept_count + 1) * sizeof(uint32_t));
+    uint64_t *accept_states = calloc(new_words, sizeof(uint64_t));
+    uint64_t *start_states = calloc(new_words, sizeof(uint64_t));
+    // Symbol transitions of the new states, packed as (column << 32 | new target)
+    size_t keys_capacity = (size_t)automaton->edge_start[states] + 1;
+    uint64_t *keys = malloc(keys_capacity * sizeof(uint64_t));
+    if (start == NULL || accept_states == NULL || start_states == NULL || keys == NULL)
     {
-        uint8_t current_state = stack[stack_top--];
-        uint64_t epsilon_transitions = automaton->transitions[current_state][0];
+        fprintf(stderr, "Error: Out of memory while building the NFA.\n");
+        exit(EXIT_FAILURE);
+    }
 
-        // Add newly discovered states to the closure and stack.
-        for (uint8_t next_state = 0; next_state < automaton->states; next_state++)
+    // Closures that overlap a lot, like those of a long loop of alternatives, make the result
+    // quadratic in size. The work is bounded so that such NFAs keep their epsilon transitions.
+    size_t budget = (size_t)automaton->edge_start[states] * NFA_REMOVAL_WORK_FACTOR;
+    if (budget < NFA_REMOVAL_MIN_WORK)
+    {
+        budget = NFA_REMOVAL_MIN_WORK;
+    }
+    size_t work = 0;
+    size_t count = 0;
+    for (uint32_t state = 0; state < kept_count && work <= budget; state++)
+    {
+        start[state] = (uint32_t)count;
+
+        // Gather the symbol transitions of every state in the closure, renumbering
+        // the targets, which are all kept states
+        uint32_t reached_count = reach_components(&components, components.component_of[old_id[state]],
+                                                  reached, mark, state);
+        work += reached_count;
+        for (uint32_t i = 0; i < reached_count && work <= budget; i++)
         {
-            if ((epsilon_transitions & (1ULL << next_state)) != 0 &&
-                (closure & (1ULL << next_state)) == 0)
+            uint32_t component = reached[i];
+            if (component_accepts[component])
             {
-                closure |= (1ULL << next_state);
-                stack[++stack_top] = next_state;
+                state_set_add(accept_states, state);
             }
+            for (uint32_t m = components.member_start[component]; m < components.member_start[component + 1]; m++)
+            {
+                uint32_t member = components.members[m];
+                work += 1 + automaton->edge_start[member + 1] - automaton->edge_start[member];
+                for (uint32_t edge = automaton->edge_start[member]; edge < automaton->edge_start[member + 1]; edge++)
+                {
+                    if (automaton->edge_columns[edge] == 0)
+                    {
+                        continue;
+                    }
+                    if (count == keys_capacity)
+                    {
+                        keys_capacity *= 2;
+                        keys = realloc(keys, keys_capacity * sizeof(uint64_t));
+                        if (keys == NULL)
+                        {
+                            fprintf(stderr, "Error: Out of memory while building the NFA.\n");
+                            exit(EXIT_FAILURE);
+                        }
+                    }
+                    keys[count++] = (uint64_t)automaton->edge_columns[edge] << 32 |
+                                    new_id[automaton->edge_targets[edge]];
+                }
+            }
+        }
+        if (count > UINT32_MAX)
+        {
+            fprintf(stderr, "Error: Out of memory while building the NFA.\n");
+            exit(EXIT_FAILURE);
         }
     }
+    start[kept_count] = (uint32_t)count;
+
+    // Without epsilon transitions, matches start from the start state alone
+    uint32_t start_state = new_id[automaton->start_state];
+    free(kept);
+    free(new_id);
+    free(component_accepts);
+    free(reached);
+    free(mark);
 
-    // Cache the computed closure for this state.
-    automaton->epsilon_closure_cache[state] = closure;
+    if (work > budget)
+    {
+        free(old_id);
+        free(start);
+        free(accept_states);
+        free(start_states);
+        free(keys);
+        condense_epsilon_components(automaton, &components, kept_ids);
+        free_epsilon_components(&components);
+        return;
+    }
+    free_epsilon_components(&components);
+    state_set_add(start_states, start_state);
+
+    if (kept_ids != NULL)
+    {
+        *kept_ids = old_id;
+    }
+    else
+    {
+        free(old_id);
+    }
+
+    // Replace the tables of the automaton
+    free_dense_transitions(automaton);
+    free(automaton->edge_start);
+    free(automaton->edge_columns);
+    free(automaton->edge_targets);
+    free(automaton->accept_states);
+    free(automaton->start_states);
+
+    automaton->start_state = start_state;
+    automaton->states = kept_count;
+    automaton->words = (uint32_t)new_words;
+    set_sparse_transitions(automaton, keys, start);
+    build_dense_transitions(automaton);
+    automaton->accept_states = accept_states;
+    automaton->start_states = start_states;
+    automaton->epsilon_free = true;
 }
 
-bool match_nfa(nfa automaton, const char *input, size_t input_length)
+void remove_epsilon_transitions(nfa *automaton)
 {
-    // Start with the epsilon closure of the start state.
-    uint64_t current_states = automaton.epsilon_closure_cache[automaton.start_state];
+    remove_epsilon_transitions_keeping_ids(automaton, NULL);
+}
 
+/**
+ * @brief Simulate an NFA whose state sets fit in a single 64-bit word. This is the
+ * common case, and keeping the sets in registers avoids any memory traffic for them.
+ * It needs the dense transition table, which such NFAs have once their epsilon transitions are removed.
+ * @param automaton Pointer to the NFA to simulate
+ * @param current_states The set of states to start from
+ * @param input The input string to check against the NFA
+ * @param input_length The length of the input string
+ * @return true if the NFA accepts the input string, false otherwise
+ */
+static bool simulate_nfa_single_word(const nfa *automaton, uint64_t current_states, const char *input, size_t input_length)
+{
     // Process each input character.
     for (size_t i = 0; i < input_length; i++)
     {
         char symbol = input[i];
-        int col = automaton.nfa_alphabet.char_to_col[(unsigned char)symbol];
+        int col = automaton->nfa_alphabet.char_to_col[(unsigned char)symbol];
 
         // If the symbol is not in the alphabet, no transitions are possible.
         if (col == -1)
@@ -512,92 +1467,217 @@ bool match_nfa(nfa automaton, const char *input, size_t input_length)
         uint64_t next_states = 0;
 
         // For each current state, find reachable states on the input symbol.
-        for (uint8_t state = 0; state < automaton.states; state++)
+        // Only the set bits are visited, lowest first.
+        for (uint64_t bits = current_states; bits != 0; bits &= bits - 1)
         {
-            if ((current_states & (1ULL << state)) != 0)
-            {
-                next_states |= automaton.transitions[state][col];
-            }
+            next_states |= automaton->transitions[state_set_ctz(bits)][col];
+        }
+
+        // Compute the epsilon closure of the next states, unless there are no epsilon transitions.
+        if (!automaton->epsilon_free)
+        {
+            nfa_close_states(automaton, &next_states);
+        }
+
+        current_states = next_states;
+
+        // If there are no current states, the input is rejected.
+        if (current_states == 0)
+        {
+            return false;
         }
+    }
 
-        // Compute the epsilon closure of the next states.
-        uint64_t new_current_states = 0;
-        for (uint8_t state = 0; state < automaton.states; state++)
+    // Check if any of the current states are accept states.
+    return (current_states & automaton->accept_states[0]) != 0;
+}
+
+void nfa_close_states(const nfa *automaton, uint64_t *set)
+{
+    for (size_t w = 0; w < automaton->words; w++)
+    {
+        // Epsilon transitions lead to higher states, so the states they add to this word
+        // are still ahead of the walk, and every state is visited once.
+        uint64_t done = 0;
+        for (uint64_t bits = set[w]; bits != 0; bits = set[w] & ~done)
         {
-            if ((next_states & (1ULL << state)) != 0)
+            uint32_t state = (uint32_t)(w * STATE_SET_WORD_BITS + state_set_ctz(bits));
+            done |= bits & (~bits + 1);
+            for (uint32_t edge = automaton->edge_start[state];
+                 edge < automaton->edge_start[state + 1] && automaton->edge_columns[edge] == 0; edge++)
             {
-                new_current_states |= automaton.epsilon_closure_cache[state];
+                state_set_add(set, automaton->edge_targets[edge]);
             }
         }
+    }
+}
+
+void nfa_step(const nfa *automaton, const uint64_t *current_states, int col, uint64_t *next_states)
+{
+    size_t words = automaton->words;
+
+    // For each current state, find reachable states on the input symbol.
+    // Only the set bits of each word are visited, so sparse sets are cheap.
+    state_set_clear(next_states, words);
+    for (size_t w = 0; w < words; w++)
+    {
+        for (uint64_t bits = current_states[w]; bits != 0; bits &= bits - 1)
+        {
+            uint32_t state = (uint32_t)(w * STATE_SET_WORD_BITS + state_set_ctz(bits));
+            nfa_add_transitions(automaton, state, col, next_states);
+        }
+    }
+
+    // Compute the epsilon closure of the reached states.
+    if (!automaton->epsilon_free)
+    {
+        nfa_close_states(automaton, next_states);
+    }
+}
+
+/**
+ * @brief Simulate an NFA whose state sets take more than one word.
+ * @param automaton Pointer to the NFA to simulate
+ * @param initial_states The set of states to start from
+ * @param input The input string to check against the NFA
+ * @param input_length The length of the input string
+ * @param block Scratch space for two state sets
+ * @return true if the NFA accepts the input string, false otherwise
+ */
+static bool simulate_nfa_multi_word(const nfa *automaton, const uint64_t *initial_states, const char *input,
+                                    size_t input_length, uint64_t *block)
+{
+    size_t words = automaton->words;
+
+    // Two state sets are needed: the current states and the next states.
+    uint64_t *current_states = block;
+    uint64_t *next_states = block + words;
+
+    state_set_copy(current_states, initial_states, words);
+
+    // Process each input character.
+    for (size_t i = 0; i < input_length; i++)
+    {
+        char symbol = input[i];
+        int col = automaton->nfa_alphabet.char_to_col[(unsigned char)symbol];
+
+        // If the symbol is not in the alphabet, no transitions are possible.
+        if (col == -1)
+        {
+            return false;
+        }
+
+        nfa_step(automaton, current_states, col, next_states);
 
-        current_states = new_current_states;
+        uint64_t *swap = current_states;
+        current_states = next_states;
+        next_states = swap;
 
         // If there are no current states, the input is rejected.
-        if (current_states == 0)
+        if (state_set_is_empty(current_states, words))
         {
             return false;
         }
     }
 
     // Check if any of the current states are accept states.
-    return (current_states & automaton.accept_states) != 0;
+    return state_set_intersects(current_states, automaton->accept_states, words);
 }
 
-bool save_nfa(const nfa *automaton, const char *file_path)
+/**
+ * @brief Allocate scratch space for two state sets of the NFA, exiting when out of memory.
+ * @param automaton Pointer to the NFA
+ * @return The scratch space, to be released with free
+ */
+static uint64_t *new_simulation_block(const nfa *automaton)
 {
-    if (automaton == NULL || file_path == NULL)
+    uint64_t *block = malloc(2 * (size_t)automaton->words * sizeof(uint64_t));
+    if (block == NULL)
     {
-        return false;
+        fprintf(stderr, "Error: Out of memory while simulating the NFA.\n");
+        exit(EXIT_FAILURE);
     }
+    return block;
+}
 
-    FILE *file = fopen(file_path, "wb");
-    if (file == NULL)
+bool simulate_nfa(const nfa *automaton, const uint64_t *initial_states, const char *input, size_t input_length)
+{
+    // Start with the epsilon closure of the start state, unless told otherwise.
+    if (initial_states == NULL)
     {
-        return false;
+        initial_states = automaton->start_states;
     }
 
-    const uint32_t magic = 0x3141464E; // NFA1
-    const uint32_t version = 1;
-    const int32_t symbol_count = automaton->nfa_alphabet.symbol_count;
+    if (automaton->words == 1 && automaton->transitions != NULL)
+    {
+        return simulate_nfa_single_word(automaton, initial_states[0], input, input_length);
+    }
+
+    uint64_t *block = new_simulation_block(automaton);
+    bool accepted = simulate_nfa_multi_word(automaton, initial_states, input, input_length, block);
+    free(block);
+    return accepted;
+}
 
-    if (symbol_count <= 0 || symbol_count > 256)
+bool match_nfa(const nfa *automaton, const char *input, size_t input_length)
+{
+    if (automaton->bit_parallel != NULL)
     {
-        fclose(file);
-        return false;
+        return match_glushkov(automaton->bit_parallel, input, input_length);
     }
 
-    if (fwrite(&magic, sizeof(magic), 1, file) != 1 ||
-        fwrite(&version, sizeof(version), 1, file) != 1 ||
-        fwrite(&automaton->start_state, sizeof(automaton->start_state), 1, file) != 1 ||
-        fwrite(&automaton->states, sizeof(automaton->states), 1, file) != 1 ||
-        fwrite(&automaton->accept_states, sizeof(automaton->accept_states), 1, file) != 1 ||
-        fwrite(&symbol_count, sizeof(symbol_count), 1, file) != 1)
+    if (automaton->lazy_cache != NULL)
     {
-        fclose(file);
-        return false;
+        return match_lazy_dfa(automaton->lazy_cache, automaton, input, input_length);
     }
 
-    if (fwrite(automaton->nfa_alphabet.symbols, sizeof(char), (size_t)symbol_count, file) != (size_t)symbol_count)
+    return simulate_nfa(automaton, NULL, input, input_length);
+}
+
+void match_nfa_batch(const nfa *automaton, const char **inputs, const size_t *lens, size_t n, uint8_t *results)
+{
+    match_nfa_batch_with_cache(automaton, automaton->lazy_cache, inputs, lens, n, results);
+}
+
+void match_nfa_batch_with_cache(const nfa *automaton, struct lazy_dfa *cache, const char **inputs,
+                                const size_t *lens, size_t n, uint8_t *results)
+{
+    if (automaton->bit_parallel != NULL)
     {
-        fclose(file);
-        return false;
+        for (size_t i = 0; i < n; i++)
+        {
+            results[i] = match_glushkov(automaton->bit_parallel, inputs[i], lens[i]) ? 1 : 0;
+        }
+        return;
     }
 
-    for (uint8_t state = 0; state < automaton->states; state++)
+    if (cache != NULL)
     {
-        if (fwrite(automaton->transitions[state], sizeof(uint64_t), (size_t)symbol_count, file) != (size_t)symbol_count)
+        for (size_t i = 0; i < n; i++)
         {
-            fclose(file);
-            return false;
+            results[i] = match_lazy_dfa(cache, automaton, inputs[i], lens[i]) ? 1 : 0;
         }
+        return;
     }
 
-    if (fclose(file) != 0)
+    const uint64_t *initial_states = automaton->start_states;
+
+    if (automaton->words == 1 && automaton->transitions != NULL)
     {
-        return false;
+        for (size_t i = 0; i < n; i++)
+        {
+            results[i] = simulate_nfa_single_word(automaton, initial_states[0], inputs[i], lens[i]) ? 1 : 0;
+        }
+        return;
     }
 
-    return true;
+    // The scratch sets are shared by the whole batch
+    uint64_t *block = new_simulation_block(automaton);
+    for (size_t i = 0; i < n; i++)
+    {
+        results[i] = simulate_nfa_multi_word(automaton, initial_states, inputs[i], lens[i], block) ? 1 : 0;
+    }
+    free(block);
 }
 
 void free_nfa(nfa *automaton)
@@ -607,20 +1687,38 @@ void free_nfa(nfa *automaton)
         return;
     }
 
-    if (automaton->transitions != NULL)
+    // The dense table and the start states are always built in memory, also for a loaded NFA
+    free_dense_transitions(automaton);
+    free(automaton->start_states);
+    if (automaton->image != NULL)
     {
-        for (uint8_t state = 0; state < automaton->states; state++)
-        {
-            free(automaton->transitions[state]);
-        }
-        free(automaton->transitions);
+        // The other tables live inside the loaded file
+        unmap_input(automaton->image);
+        free(automaton->image);
     }
-
-    free(automaton->epsilon_closure_cache);
-
-    automaton->transitions = NULL;
-    automaton->epsilon_closure_cache = NULL;
+    else
+    {
+        free(automaton->edge_start);
+        free(automaton->edge_columns);
+        free(automaton->edge_targets);
+        free(automaton->accept_states);
+    }
+    free_lazy_dfa(automaton->lazy_cache);
+    free_lazy_dfa(automaton->search_cache);
+    free(automaton->bit_parallel);
+    free(automaton->prefilter);
+
+    automaton->edge_start = NULL;
+    automaton->edge_columns = NULL;
+    automaton->edge_targets = NULL;
+    automaton->start_states = NULL;
+    automaton->accept_states = NULL;
+    automaton->lazy_cache = NULL;
+    automaton->search_cache = NULL;
+    automaton->bit_parallel = NULL;
+    automaton->prefilter = NULL;
+    automaton->image = NULL;
     automaton->states = 0;
+    automaton->words = 0;
     automaton->start_state = 0;
-    automaton->accept_states = 0;
-}
\ No newline at end of file
+}
@@ -7,20 +7,26 @@
 #include <string.h>
 #include <stdio.h>
 #include <stdint.h>
+#include "state_set.h"
+#include "byte_classes.h"
 
-#define MAX_STATES 64
+/* Largest dense transition table built next to the sparse one, in bytes. NFAs whose state sets
+fit in one word always get it, since their table is at most 257 words per state. */
+#define NFA_DENSE_TABLE_LIMIT ((size_t)4 << 20)
 
 /**
- * @brief Struct to represent an alphabet. It contains an array of symbols and a mapping from characters
- * to their corresponding column index in the symbols array. The symbol_count field keeps track of how many
- * unique symbols are in the alphabet.
+ * @brief Struct to represent an alphabet. Its symbols are byte equivalence classes: bytes that no
+ * transition tells apart share a class and therefore a column of the transition table. It contains
+ * an array with one representative byte per column and a mapping from characters to their column.
+ * The symbol_count field keeps track of how many columns the alphabet has, including epsilon.
  */
 struct alphabet
 {
-    /* Array of symbols in the alphabet. The index of each
-    symbol corresponds to its column in the transition table. */
-    char symbols[256];
-    /* Mapping from character to column index in the symbols array */
+    /* Array of symbols in the alphabet. The index of each symbol corresponds
+    to its column in the transition table: column 0 is epsilon, and every other
+    column holds the first byte of its class. One entry per byte class plus epsilon. */
+    char symbols[257];
+    /* Mapping from character to column index in the symbols array, -1 when no transition uses it */
     int char_to_col[256];
     /* Number of symbols in the alphabet */
     int symbol_count;
@@ -30,26 +36,51 @@ typedef struct alphabet alphabet;
 /**
  * @brief Struct to represent a non-deterministic finite automaton (NFA). It contains the start state,
  * a bitset representing the accept states, the total number of states, the alphabet used by the NFA,
- * a transition table, and a cache for epsilon closures. The transition table is a 2D array where each
- * entry is a bitset representing the set of states reachable from the current state on the given symbol.
+ * the transitions, and a cache for epsilon closures. Every set of states is a state set of `words`
+ * 64-bit words (see state_set.h), so the number of states is only limited by memory.
  */
 struct NFA
 {
     /* State id for the start state */
-    uint8_t start_state;
+    uint32_t start_state;
     /* Bitset representing accept states */
-    uint64_t accept_states;
+    uint64_t *accept_states;
     /* Number of states in the NFA */
-    uint8_t states;
+    uint32_t states;
+    /* Number of 64-bit words in each state set */
+    uint32_t words;
     /* Alphabet used by the NFA */
     alphabet nfa_alphabet;
-    /** Transition table. Each entry is a bitset representing the set of
-     * states reachable from the current state on the given symbol. A
-     * MAX_STATES x nfa_alphabet.symbol_count matrix. */
-    uint64_t** transitions;
-    /* Cache for epsilon closures. Each entry is a bitset representing
-    the epsilon closure of the corresponding state. */
-    uint64_t* epsilon_closure_cache;
+    /** Transitions as a sparse table: those of a state are the entries edge_start[state] to
+     * edge_start[state + 1] - 1 of edge_columns and edge_targets, sorted by column and then by
+     * target, with the epsilon transitions in column 0. edge_start has states + 1 entries. */
+    uint32_t *edge_start;
+    uint16_t *edge_columns;
+    uint32_t *edge_targets;
+    /** Dense transition table, or NULL when it would take more than NFA_DENSE_TABLE_LIMIT bytes.
+     * transitions[state] points to nfa_alphabet.symbol_count state sets, one per column, each one
+     * representing the set of states reachable from the state on the given symbol. All the rows
+     * live in a single allocation owned by transitions[0]. */
+    uint64_t **transitions;
+    /* The states active before any input: the start state and its epsilon closure. */
+    uint64_t *start_states;
+    /* True when the NFA has no epsilon transitions, so every epsilon closure is the state itself
+    and state sets never need closing. Otherwise every epsilon transition leads to a higher state
+    once epsilon removal is done, which is what nfa_close_states relies on. */
+    bool epsilon_free;
+    /* Lazy DFA built on the fly while matching, or NULL to always use
+    the plain NFA simulation. Owned by the NFA. */
+    struct lazy_dfa *lazy_cache;
+    /* Lazy DFA used by search_nfa, built with an implicit `.*` prefix, or NULL. Owned by the NFA. */
+    struct lazy_dfa *search_cache;
+    /* Bit-parallel Glushkov automaton of the same regex, or NULL when the
+    regex has too many operands for it. Owned by the NFA. */
+    struct glushkov *bit_parallel;
+    /* Literals required by every match, used by search_nfa to skip input, or NULL
+    when the regex has none. Owned by the NFA. */
+    struct prefilter *prefilter;
+    /* File loaded by load_nfa that the accept states and the sparse transitions point into, or NULL when the NFA owns those tables. Owned by the NFA. */
+    struct mapped_input *image;
 };
 typedef struct NFA nfa;
 
@@ -63,26 +94,226 @@ typedef struct NFA nfa;
  */
 nfa regex_to_nfa(const regex r);
 
+/**
+ * @brief Convert several regular expressions into one NFA that accepts the strings of any of them.
+ * A new start state leads to the start of every pattern, and the epsilon transitions are removed
+ * as in regex_to_nfa, so every state except the start belongs to exactly one pattern.
+ * @param patterns Array with the regexes, as regex structs
+ * @param count Number of regexes
+ * @param state_patterns Output for an array with the index of the pattern of each state, or -1
+ * for the start state. The caller owns the array
+ * @param nullable Output array with room for `count` entries, set to true for the patterns that
+ * accept the empty string
+ * @return The combined NFA
+ */
+nfa regex_set_to_nfa(const regex *patterns, uint32_t count, int32_t **state_patterns, bool *nullable);
+
+/**
+ * @brief Remove the epsilon transitions of an NFA. Only the start state and the states entered
+ * by a symbol transition are kept. Each of them gets the symbol transitions of its whole epsilon
+ * closure, and it accepts when its closure has an accept state. The result usually has far fewer
+ * states, and simulating it needs no epsilon closures at all. When that would take more than a few
+ * times the size of the NFA, as for a long loop of alternatives, the epsilon transitions are kept
+ * instead: each cycle of them becomes a single state, and the rest all lead to higher states.
+ * @param automaton Pointer to the NFA to transform in place
+ */
+void remove_epsilon_transitions(nfa *automaton);
+
+/**
+ * @brief Build the dense transition table of an NFA from its sparse transitions, unless it would
+ * take more than NFA_DENSE_TABLE_LIMIT bytes. Any previous table is released first.
+ * @param automaton Pointer to the NFA
+ */
+void build_dense_transitions(nfa *automaton);
+
+/**
+ * @brief Get the set of states reachable from a state on the symbol at the given column.
+ * Only valid when the NFA has a dense transition table.
+ * @param automaton Pointer to the NFA
+ * @param state The source state
+ * @param col The column of the symbol in the alphabet
+ * @return A pointer to the state set stored in the transition table
+ */
+static inline uint64_t *nfa_transition(const nfa *automaton, uint32_t state, int col)
+{
+    return automaton->transitions[state] + (size_t)col * automaton->words;
+}
+
+/**
+ * @brief Find the sparse transitions of a state on the symbol at the given column.
+ * @param automaton Pointer to the NFA
+ * @param state The source state
+ * @param col The column of the symbol in the alphabet
+ * @param end Output for one past the last transition
+ * @return The index of the first transition in edge_columns and edge_targets
+ */
+static inline uint32_t nfa_edges(const nfa *automaton, uint32_t state, int col, uint32_t *end)
+{
+    // Binary search for the first transition of the column, and then for the first one past it
+    uint32_t low = automaton->edge_start[state];
+    uint32_t high = automaton->edge_start[state + 1];
+    while (low < high)
+    {
+        uint32_t middle = low + (high - low) / 2;
+        if (automaton->edge_columns[middle] < col)
+        {
+            low = middle + 1;
+        }
+        else
+        {
+            high = middle;
+        }
+    }
+    uint32_t first = low;
+    high = automaton->edge_start[state + 1];
+    while (low < high)
+    {
+        uint32_t middle = low + (high - low) / 2;
+        if (automaton->edge_columns[middle] <= col)
+        {
+            low = middle + 1;
+        }
+        else
+        {
+            high = middle;
+        }
+    }
+    *end = low;
+    return first;
+}
+
+/**
+ * @brief Add the states reachable from a state on the symbol at the given column to a set. The
+ * dense table is used when the NFA has one, and the sparse transitions otherwise.
+ * @param automaton Pointer to the NFA
+ * @param state The source state
+ * @param col The column of the symbol in the alphabet
+ * @param set The state set to add the states to
+ */
+static inline void nfa_add_transitions(const nfa *automaton, uint32_t state, int col, uint64_t *set)
+{
+    if (automaton->transitions != NULL)
+    {
+        state_set_or(set, nfa_transition(automaton, state, col), automaton->words);
+        return;
+    }
+    uint32_t end;
+    for (uint32_t edge = nfa_edges(automaton, state, col, &end); edge < end; edge++)
+    {
+        state_set_add(set, automaton->edge_targets[edge]);
+    }
+}
+
+/**
+ * @brief Add the epsilon closure of a set of states to the set, in a single pass over its states
+ * in increasing order. Only valid after epsilon removal, when epsilon transitions lead to higher states.
+ * @param automaton Pointer to the NFA
+ * @param set The state set to close
+ */
+void nfa_close_states(const nfa *automaton, uint64_t *set);
+
+/**
+ * @brief Compute the states reached from a set of states on one symbol, followed by
+ * their epsilon closure. This is one step of the NFA simulation.
+ * @param automaton Pointer to the NFA
+ * @param current_states The set of states before reading the symbol
+ * @param col The column of the symbol in the alphabet
+ * @param next_states Output set with the states after reading the symbol
+ */
+void nfa_step(const nfa *automaton, const uint64_t *current_states, int col, uint64_t *next_states);
+
+/**
+ * @brief Simulate the NFA on an input string with plain state set simulation.
+ * @param automaton Pointer to the NFA to simulate
+ * @param initial_states The set of states to start from, or NULL to start from
+ * the epsilon closure of the start state
+ * @param input The input string to check against the NFA
+ * @param input_length The length of the input string
+ * @return true if the NFA accepts the input string, false otherwise
+ */
+bool simulate_nfa(const nfa *automaton, const uint64_t *initial_states, const char *input, size_t input_length);
+
 /**
  * @brief Function to check if a given input string matches the language defined by the NFA.
- * This function simulates the NFA on the input string and returns true if the NFA accepts
- * the string, and false otherwise.
- * @param automaton The NFA to simulate
+ * This function picks the fastest engine available for the NFA: the bit-parallel Glushkov
+ * automaton for small regexes, then the lazy DFA, and the plain simulation otherwise.
+ * It returns true if the NFA accepts the string, and false otherwise.
+ * @param automaton Pointer to the NFA to simulate
  * @param input The input string to check against the NFA
  * @param input_length The length of the input string
  * @return true if the NFA accepts the input string, false otherwise
  */
-bool match_nfa(nfa automaton, const char *input, size_t input_length);
+bool match_nfa(const nfa *automaton, const char *input, size_t input_length);
+
+/**
+ * @brief Check a batch of input strings against the NFA. The lazy DFA cache or the
+ * simulation scratch space is set up once and reused for every input of the batch.
+ * @param automaton Pointer to the NFA to simulate
+ * @param inputs Array of n input strings
+ * @param lens Array with the length of each input string
+ * @param n Number of input strings
+ * @param results Output array of n entries, set to 1 for accepted inputs and 0 otherwise
+ */
+void match_nfa_batch(const nfa *automaton, const char **inputs, const size_t *lens, size_t n, uint8_t *results);
+
+/**
+ * @brief Check a batch of input strings against the NFA like match_nfa_batch, but with a lazy
+ * DFA cache given by the caller instead of the one owned by the NFA. Matching only writes to
+ * the cache, so threads that each have their own cache can share one NFA.
+ * @param automaton Pointer to the NFA to simulate
+ * @param cache Lazy DFA cache created for the NFA, or NULL to use the plain simulation
+ * @param inputs Array of n input strings
+ * @param lens Array with the length of each input string
+ * @param n Number of input strings
+ * @param results Output array of n entries, set to 1 for accepted inputs and 0 otherwise
+ */
+void match_nfa_batch_with_cache(const nfa *automaton, struct lazy_dfa *cache, const char **inputs,
+                                const size_t *lens, size_t n, uint8_t *results);
 
 /**
  * @brief Serialize an NFA to a binary file.
- * The serialized format stores metadata, alphabet symbols and transition table.
+ * The serialized format (NFA4) has a header with the metadata and the offset of every section,
+ * followed by the alphabet, the accept states, the sparse transitions, and the Glushkov automaton
+ * and prefilter when the NFA has them. Sections are aligned to 64 bytes and stored in the layout
+ * used in memory, so load_nfa can use them where they are. Only NFAs whose epsilon transitions
+ * were removed can be saved, including those where epsilon removal kept them.
  * @param automaton Pointer to the NFA to serialize
  * @param file_path Output file path
  * @return true if the file was written successfully, false otherwise
  */
 bool save_nfa(const nfa *automaton, const char *file_path);
 
+/**
+ * @brief Load an NFA saved by save_nfa. The file is mapped into memory and validated, and the
+ * NFA points into it instead of copying its tables, so loading does not depend on how the
+ * automaton was built. Files of another version or byte order are rejected.
+ * @param file_path Path of the file
+ * @param automaton Output for the NFA. Release it with free_nfa
+ * @return true if the file holds a valid NFA, false otherwise
+ */
+bool load_nfa(const char *file_path, nfa *automaton);
+
+/**
+ * @brief Same as save_nfa, but the file also stores a key, such as the text the NFA was built
+ * from, so a later load can check that the file is the one it expects.
+ * @param automaton Pointer to the NFA to serialize
+ * @param file_path Output file path
+ * @param key The bytes of the key
+ * @param key_length Number of bytes of the key
+ * @return true if the file was written successfully, false otherwise
+ */
+bool save_nfa_keyed(const nfa *automaton, const char *file_path, const char *key, size_t key_length);
+
+/**
+ * @brief Same as load_nfa, but the file is only accepted if it was saved under the given key.
+ * @param file_path Path of the file
+ * @param automaton Output for the NFA. Release it with free_nfa
+ * @param key The bytes of the expected key, or NULL to accept any key
+ * @param key_length Number of bytes of the key
+ * @return true if the file holds a valid NFA saved under the key, false otherwise
+ */
+bool load_nfa_keyed(const char *file_path, nfa *automaton, const char *key, size_t key_length);
+
 /**
  * @brief Release heap memory owned by an NFA.
  * @param automaton Pointer to the NFA to free
@@ -0,0 +1,493 @@
+#include "nfa.h"
+#include "lazy_dfa.h"
+#include "glushkov.h"
+#include "prefilter.h"
+#include "record_io.h"
+
+/* Magic number of NFA files, "NFA4" read as a little-endian integer */
+#define NFA_FILE_MAGIC 0x3441464E
+/* Version of the format written by save_nfa */
+#define NFA_FILE_VERSION 4
+/* Written as is, so a file saved on a machine with another byte order is rejected */
+#define NFA_FILE_BYTE_ORDER 0x01020304
+/* Every section starts at a multiple of this many bytes */
+#define NFA_FILE_ALIGNMENT 64
+
+/* Flags of the header */
+#define NFA_FILE_EPSILON_FREE 1u
+#define NFA_FILE_GLUSHKOV 2u
+#define NFA_FILE_PREFILTER 4u
+
+/**
+ * @brief Sections of an NFA file, in the order they are stored.
+ */
+enum NFA_File_Section
+{
+    /* The symbols of the alphabet, 257 bytes */
+    SECTION_SYMBOLS,
+    /* char_to_col, 256 int32_t */
+    SECTION_CHAR_TO_COL,
+    /* The accept states, one state set */
+    SECTION_ACCEPT_STATES,
+    /* edge_start of the sparse transitions, states + 1 uint32_t */
+    SECTION_EDGE_STARTS,
+    /* edge_columns of the sparse transitions, one uint16_t per transition */
+    SECTION_EDGE_COLUMNS,
+    /* edge_targets of the sparse transitions, one uint32_t per transition */
+    SECTION_EDGE_TARGETS,
+    /* The Glushkov automaton, as a glushkov_image. Empty when the NFA has none */
+    SECTION_GLUSHKOV,
+    /* The prefilter, as a prefilter_image. Empty when the NFA has none */
+    SECTION_PREFILTER,
+    /* Key the file was saved under by save_nfa_keyed. Empty for save_nfa */
+    SECTION_KEY,
+    SECTION_COUNT,
+};
+
+/**
+ * @brief Header at the start of an NFA file. Every field has a fixed size and is naturally
+ * aligned, so the struct has no padding and is stored as is.
+ */
+struct nfa_file_header
+{
+    uint32_t magic;
+    uint32_t version;
+    uint32_t byte_order;
+    /* NFA_FILE_* flags */
+    uint32_t flags;
+    uint32_t start_state;
+    uint32_t states;
+    uint32_t words;
+    int32_t symbol_count;
+    /* Number of transitions */
+    uint64_t edges;
+    /* Size of the whole file */
+    uint64_t file_size;
+    /* Offset and size of each section, in bytes */
+    uint64_t section_offset[SECTION_COUNT];
+    uint64_t section_length[SECTION_COUNT];
+};
+typedef struct nfa_file_header nfa_file_header;
+
+/**
+ * @brief Fixed-size form of a Glushkov automaton in an NFA file.
+ */
+struct glushkov_image
+{
+    uint64_t shift_mask;
+    uint64_t follow_tables[GLUSHKOV_CHUNKS][256];
+    uint64_t byte_masks[256];
+    uint64_t accept_mask;
+    uint32_t positions;
+    uint32_t table_chunk_count;
+    uint8_t table_chunks[GLUSHKOV_CHUNKS];
+};
+typedef struct glushkov_image glushkov_image;
+
+/**
+ * @brief Fixed-size form of a prefilter in an NFA file.
+ */
+struct prefilter_image
+{
+    uint64_t prefix_length;
+    uint64_t required_length;
+    char prefix[PREFILTER_MAX_LITERAL];
+    char required[PREFILTER_MAX_LITERAL];
+};
+typedef struct prefilter_image prefilter_image;
+
+/**
+ * @brief Multiply two sizes, failing instead of overflowing.
+ * @return true if the product fits in 64 bits, false otherwise
+ */
+static bool checked_multiply(uint64_t a, uint64_t b, uint64_t *product)
+{
+    if (a != 0 && b > UINT64_MAX / a)
+    {
+        return false;
+    }
+    *product = a * b;
+    return true;
+}
+
+/**
+ * @brief Expected size of every section of an NFA, from the fields of its header.
+ * @return true if every size fits in 64 bits, false otherwise
+ */
+static bool section_lengths(const nfa_file_header *header, uint64_t *lengths)
+{
+    // The key is the only section whose size is not fixed by the rest of the header
+    lengths[SECTION_KEY] = header->section_length[SECTION_KEY];
+
+    uint64_t set_bytes = (uint64_t)header->words * sizeof(uint64_t);
+    if (!checked_multiply(header->edges, sizeof(uint16_t), &lengths[SECTION_EDGE_COLUMNS]) ||
+        !checked_multiply(header->edges, sizeof(uint32_t), &lengths[SECTION_EDGE_TARGETS]))
+    {
+        return false;
+    }
+    lengths[SECTION_EDGE_STARTS] = ((uint64_t)header->states + 1) * sizeof(uint32_t);
+    lengths[SECTION_SYMBOLS] = sizeof(((alphabet *)NULL)->symbols);
+    lengths[SECTION_CHAR_TO_COL] = 256 * sizeof(int32_t);
+    lengths[SECTION_ACCEPT_STATES] = set_bytes;
+    lengths[SECTION_GLUSHKOV] = (header->flags & NFA_FILE_GLUSHKOV) ? sizeof(glushkov_image) : 0;
+    lengths[SECTION_PREFILTER] = (header->flags & NFA_FILE_PREFILTER) ? sizeof(prefilter_image) : 0;
+    return true;
+}
+
+/**
+ * @brief Write a block of bytes at the current offset, after zero padding up to `offset`.
+ * @return true on success, false otherwise
+ */
+static bool write_at(FILE *file, uint64_t *written, uint64_t offset, const void *bytes, size_t count)
+{
+    static const char zeros[NFA_FILE_ALIGNMENT] = {0};
+    while (*written < offset)
+    {
+        size_t padding = (size_t)(offset - *written);
+        if (padding > sizeof(zeros))
+        {
+            padding = sizeof(zeros);
+        }
+        if (fwrite(zeros, 1, padding, file) != padding)
+        {
+            return false;
+        }
+        *written += padding;
+    }
+    if (count > 0 && fwrite(bytes, 1, count, file) != count)
+    {
+        return false;
+    }
+    *written += count;
+    return true;
+}
+
+bool save_nfa(const nfa *automaton, const char *file_path)
+{
+    return save_nfa_keyed(automaton, file_path, NULL, 0);
+}
+
+bool save_nfa_keyed(const nfa *automaton, const char *file_path, const char *key, size_t key_length)
+{
+    if (automaton == NULL || file_path == NULL || automaton->states == 0)
+    {
+        return false;
+    }
+
+    nfa_file_header header;
+    memset(&header, 0, sizeof(header));
+    header.magic = NFA_FILE_MAGIC;
+    header.version = NFA_FILE_VERSION;
+    header.byte_order = NFA_FILE_BYTE_ORDER;
+    header.flags = (automaton->epsilon_free ? NFA_FILE_EPSILON_FREE : 0) |
+                   (automaton->bit_parallel != NULL ? NFA_FILE_GLUSHKOV : 0) |
+                   (automaton->prefilter != NULL ? NFA_FILE_PREFILTER : 0);
+    header.start_state = automaton->start_state;
+    header.states = automaton->states;
+    header.words = automaton->words;
+    header.symbol_count = automaton->nfa_alphabet.symbol_count;
+    header.edges = automaton->edge_start[automaton->states];
+    header.section_length[SECTION_KEY] = key_length;
+
+    if (!section_lengths(&header, header.section_length))
+    {
+        return false;
+    }
+    uint64_t offset = sizeof(header);
+    for (int section = 0; section < SECTION_COUNT; section++)
+    {
+        offset = (offset + NFA_FILE_ALIGNMENT - 1) / NFA_FILE_ALIGNMENT * NFA_FILE_ALIGNMENT;
+        header.section_offset[section] = offset;
+        offset += header.section_length[section];
+    }
+    header.file_size = offset;
+
+    int32_t char_to_col[256];
+    for (int c = 0; c < 256; c++)
+    {
+        char_to_col[c] = automaton->nfa_alphabet.char_to_col[c];
+    }
+
+    glushkov_image glushkov_section;
+    memset(&glushkov_section, 0, sizeof(glushkov_section));
+    if (automaton->bit_parallel != NULL)
+    {
+        const glushkov *g = automaton->bit_parallel;
+        glushkov_section.shift_mask = g->shift_mask;
+        memcpy(glushkov_section.follow_tables, g->follow_tables, sizeof(glushkov_section.follow_tables));
+        memcpy(glushkov_section.byte_masks, g->byte_masks, sizeof(glushkov_section.byte_masks));
+        glushkov_section.accept_mask = g->accept_mask;
+        glushkov_section.positions = (uint32_t)g->positions;
+        glushkov_section.table_chunk_count = (uint32_t)g->table_chunk_count;
+        memcpy(glushkov_section.table_chunks, g->table_chunks, sizeof(glushkov_section.table_chunks));
+    }
+
+    prefilter_image prefilter_section;
+    memset(&prefilter_section, 0, sizeof(prefilter_section));
+    if (automaton->prefilter != NULL)
+    {
+        const prefilter *p = automaton->prefilter;
+        prefilter_section.prefix_length = p->prefix_length;
+        prefilter_section.required_length = p->required_length;
+        memcpy(prefilter_section.prefix, p->prefix, p->prefix_length);
+        memcpy(prefilter_section.required, p->required, p->required_length);
+    }
+
+    FILE *file = fopen(file_path, "wb");
+    if (file == NULL)
+    {
+        return false;
+    }
+
+    uint64_t written = 0;
+    bool ok = write_at(file, &written, 0, &header, sizeof(header)) &&
+              write_at(file, &written, header.section_offset[SECTION_SYMBOLS], automaton->nfa_alphabet.symbols,
+                       (size_t)header.section_length[SECTION_SYMBOLS]) &&
+              write_at(file, &written, header.section_offset[SECTION_CHAR_TO_COL], char_to_col,
+                       sizeof(char_to_col)) &&
+              write_at(file, &written, header.section_offset[SECTION_ACCEPT_STATES], automaton->accept_states,
+                       (size_t)header.section_length[SECTION_ACCEPT_STATES]) &&
+              write_at(file, &written, header.section_offset[SECTION_EDGE_STARTS], automaton->edge_start,
+                       (size_t)header.section_length[SECTION_EDGE_STARTS]) &&
+              write_at(file, &written, header.section_offset[SECTION_EDGE_COLUMNS], automaton->edge_columns,
+                       (size_t)header.section_length[SECTION_EDGE_COLUMNS]) &&
+              write_at(file, &written, header.section_offset[SECTION_EDGE_TARGETS], automaton->edge_targets,
+                       (size_t)header.section_length[SECTION_EDGE_TARGETS]) &&
+              write_at(file, &written, header.section_offset[SECTION_GLUSHKOV], &glushkov_section,
+                       (size_t)header.section_length[SECTION_GLUSHKOV]) &&
+              write_at(file, &written, header.section_offset[SECTION_PREFILTER], &prefilter_section,
+                       (size_t)header.section_length[SECTION_PREFILTER]) &&
+              write_at(file, &written, header.section_offset[SECTION_KEY], key, key_length) &&
+              write_at(file, &written, header.file_size, NULL, 0);
+
+    if (fclose(file) != 0)
+    {
+        return false;
+    }
+    return ok;
+}
+
+/**
+ * @brief Check that a set of states has no state beyond the last one.
+ */
+static bool valid_state_set(const uint64_t *set, uint32_t states, uint32_t words)
+{
+    const uint32_t used_bits = states % STATE_SET_WORD_BITS;
+    return used_bits == 0 || (set[words - 1] >> used_bits) == 0;
+}
+
+/**
+ * @brief Check the header and every section of an NFA file before any pointer is taken into it.
+ * @param data The bytes of the file, aligned to 8 bytes
+ * @param length Size of the file
+ * @param header Output for the header
+ * @return true if the file describes a valid NFA, false otherwise
+ */
+static bool validate_nfa_file(const char *data, size_t length, nfa_file_header *header)
+{
+    if (length < sizeof(*header))
+    {
+        return false;
+    }
+    memcpy(header, data, sizeof(*header));
+
+    if (header->magic != NFA_FILE_MAGIC || header->version != NFA_FILE_VERSION ||
+        header->byte_order != NFA_FILE_BYTE_ORDER || header->file_size != length)
+    {
+        return false;
+    }
+    if (header->states == 0 || header->start_state >= header->states ||
+        header->words != state_set_words(header->states) || header->symbol_count < 1 ||
+        header->symbol_count > (int32_t)sizeof(((alphabet *)NULL)->symbols) || header->edges > UINT32_MAX)
+    {
+        return false;
+    }
+
+    uint64_t lengths[SECTION_COUNT];
+    if (!section_lengths(header, lengths))
+    {
+        return false;
+    }
+    for (int section = 0; section < SECTION_COUNT; section++)
+    {
+        uint64_t offset = header->section_offset[section];
+        if (header->section_length[section] != lengths[section] || offset % NFA_FILE_ALIGNMENT != 0 ||
+            offset > length || lengths[section] > length - offset)
+        {
+            return false;
+        }
+    }
+
+    // Columns of bytes are symbol columns: never epsilon, never past the alphabet
+    const int32_t *char_to_col = (const int32_t *)(data + header->section_offset[SECTION_CHAR_TO_COL]);
+    for (int c = 0; c < 256; c++)
+    {
+        if (char_to_col[c] == 0 || char_to_col[c] < -1 || char_to_col[c] >= header->symbol_count)
+        {
+            return false;
+        }
+    }
+
+    // No set may hold a state past the last one, since sets are walked bit by bit
+    const uint64_t *accept_states = (const uint64_t *)(data + header->section_offset[SECTION_ACCEPT_STATES]);
+    if (!valid_state_set(accept_states, header->states, header->words))
+    {
+        return false;
+    }
+
+    // The transitions of each state are in range and strictly sorted by column and target, since
+    // they are found by binary search. Epsilon transitions lead to higher states, as nfa_close_states
+    // needs, and only NFAs that were not made epsilon free have them.
+    const bool epsilon_free = (header->flags & NFA_FILE_EPSILON_FREE) != 0;
+    const uint32_t *starts = (const uint32_t *)(data + header->section_offset[SECTION_EDGE_STARTS]);
+    const uint16_t *columns = (const uint16_t *)(data + header->section_offset[SECTION_EDGE_COLUMNS]);
+    const uint32_t *targets = (const uint32_t *)(data + header->section_offset[SECTION_EDGE_TARGETS]);
+    if (starts[0] != 0 || starts[header->states] != header->edges)
+    {
+        return false;
+    }
+    for (uint32_t state = 0; state < header->states; state++)
+    {
+        if (starts[state + 1] < starts[state] || starts[state + 1] > header->edges)
+        {
+            return false;
+        }
+        for (uint32_t edge = starts[state]; edge < starts[state + 1]; edge++)
+        {
+            if ((columns[edge] == 0 && (epsilon_free || targets[edge] <= state)) ||
+                columns[edge] >= header->symbol_count || targets[edge] >= header->states ||
+                (edge > starts[state] && (columns[edge] < columns[edge - 1] ||
+                                          (columns[edge] == columns[edge - 1] && targets[edge] <= targets[edge - 1]))))
+            {
+                return false;
+            }
+        }
+    }
+
+    if (header->flags & NFA_FILE_GLUSHKOV)
+    {
+        glushkov_image image;
+        memcpy(&image, data + header->section_offset[SECTION_GLUSHKOV], sizeof(image));
+        if (image.positions < 1 || image.positions > GLUSHKOV_MAX_POSITIONS + 1 ||
+            image.table_chunk_count > GLUSHKOV_CHUNKS)
+        {
+            return false;
+        }
+        for (uint32_t k = 0; k < image.table_chunk_count; k++)
+        {
+            if (image.table_chunks[k] >= GLUSHKOV_CHUNKS)
+            {
+                return false;
+            }
+        }
+    }
+
+    if (header->flags & NFA_FILE_PREFILTER)
+    {
+        prefilter_image image;
+        memcpy(&image, data + header->section_offset[SECTION_PREFILTER], sizeof(image));
+        if (image.prefix_length > PREFILTER_MAX_LITERAL || image.required_length > PREFILTER_MAX_LITERAL)
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+bool load_nfa(const char *file_path, nfa *automaton)
+{
+    return load_nfa_keyed(file_path, automaton, NULL, 0);
+}
+
+bool load_nfa_keyed(const char *file_path, nfa *automaton, const char *key, size_t key_length)
+{
+    mapped_input *image = malloc(sizeof(mapped_input));
+    if (image == NULL || !map_input(file_path, image))
+    {
+        free(image);
+        return false;
+    }
+
+    nfa_file_header header;
+    if (!validate_nfa_file(image->data, image->length, &header) ||
+        (key != NULL && (header.section_length[SECTION_KEY] != key_length ||
+                         memcmp(image->data + header.section_offset[SECTION_KEY], key, key_length) != 0)))
+    {
+        unmap_input(image);
+        free(image);
+        return false;
+    }
+    const char *data = image->data;
+
+    nfa result;
+    result.image = image;
+    result.start_state = header.start_state;
+    result.states = header.states;
+    result.words = header.words;
+    result.epsilon_free = (header.flags & NFA_FILE_EPSILON_FREE) != 0;
+
+    memset(&result.nfa_alphabet, 0, sizeof(result.nfa_alphabet));
+    memcpy(result.nfa_alphabet.symbols, data + header.section_offset[SECTION_SYMBOLS],
+           (size_t)header.section_length[SECTION_SYMBOLS]);
+    const int32_t *char_to_col = (const int32_t *)(data + header.section_offset[SECTION_CHAR_TO_COL]);
+    for (int c = 0; c < 256; c++)
+    {
+        result.nfa_alphabet.char_to_col[c] = char_to_col[c];
+    }
+    result.nfa_alphabet.symbol_count = header.symbol_count;
+
+    // The tables stay in the file; the dense transition table and the start states are built in memory
+    result.edge_start = (uint32_t *)(data + header.section_offset[SECTION_EDGE_STARTS]);
+    result.edge_columns = (uint16_t *)(data + header.section_offset[SECTION_EDGE_COLUMNS]);
+    result.edge_targets = (uint32_t *)(data + header.section_offset[SECTION_EDGE_TARGETS]);
+    result.transitions = NULL;
+    result.accept_states = (uint64_t *)(data + header.section_offset[SECTION_ACCEPT_STATES]);
+    result.start_states = calloc(header.words, sizeof(uint64_t));
+    result.bit_parallel = (header.flags & NFA_FILE_GLUSHKOV) ? malloc(sizeof(glushkov)) : NULL;
+    result.prefilter = (header.flags & NFA_FILE_PREFILTER) ? malloc(sizeof(prefilter)) : NULL;
+    if (result.start_states == NULL || ((header.flags & NFA_FILE_GLUSHKOV) && result.bit_parallel == NULL) ||
+        ((header.flags & NFA_FILE_PREFILTER) && result.prefilter == NULL))
+    {
+        fprintf(stderr, "Error: Out of memory while loading the NFA.\n");
+        exit(EXIT_FAILURE);
+    }
+    build_dense_transitions(&result);
+    state_set_add(result.start_states, header.start_state);
+    if (!result.epsilon_free)
+    {
+        nfa_close_states(&result, result.start_states);
+    }
+
+    if (result.bit_parallel != NULL)
+    {
+        glushkov_image section;
+        memcpy(&section, data + header.section_offset[SECTION_GLUSHKOV], sizeof(section));
+        glushkov *g = result.bit_parallel;
+        g->shift_mask = section.shift_mask;
+        memcpy(g->follow_tables, section.follow_tables, sizeof(g->follow_tables));
+        memcpy(g->byte_masks, section.byte_masks, sizeof(g->byte_masks));
+        g->accept_mask = section.accept_mask;
+        g->positions = (int)section.positions;
+        g->table_chunk_count = (int)section.table_chunk_count;
+        memcpy(g->table_chunks, section.table_chunks, sizeof(g->table_chunks));
+    }
+
+    if (result.prefilter != NULL)
+    {
+        prefilter_image section;
+        memcpy(&section, data + header.section_offset[SECTION_PREFILTER], sizeof(section));
+        prefilter *p = result.prefilter;
+        p->prefix_length = (size_t)section.prefix_length;
+        p->required_length = (size_t)section.required_length;
+        memcpy(p->prefix, section.prefix, sizeof(p->prefix));
+        memcpy(p->required, section.required, sizeof(p->required));
+    }
+
+    // The lazy DFAs start empty, exactly as after regex_to_nfa
+    result.lazy_cache = new_lazy_dfa(&result, LAZY_DFA_DEFAULT_BUDGET, false);
+    result.search_cache = new_lazy_dfa(&result, LAZY_DFA_DEFAULT_BUDGET, true);
+
+    *automaton = result;
+    return true;
+}
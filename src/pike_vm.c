@@ -0,0 +1,765 @@
+#include "pike_vm.h"
+
+/**
+ * @brief Struct to represent a node of the syntax tree a Pike VM program is compiled from.
+ */
+struct pike_node
+{
+    /* Operator of the node, or OPERAND for a leaf */
+    item_type type;
+    /* Bytes of an OPERAND node */
+    byte_set bytes;
+    /* Group of a CAPTURE node */
+    int group;
+    /* Bounds of a REPETITION node, with max -1 when unbounded */
+    int min;
+    int max;
+    /* Operand of the unary operators, or left operand of the binary ones */
+    int left;
+    /* Right operand of the binary operators */
+    int right;
+    /* Whether the subtree matches the empty string */
+    bool nullable;
+    /* Slot where the current iteration started, for the repetitions of an operand that matches
+    the empty string that have optional iterations, or -1 */
+    int slot;
+};
+typedef struct pike_node pike_node;
+
+/**
+ * @brief Add an instruction at the end of a program.
+ * @return The index of the instruction
+ */
+static int emit(pike_program *program, pike_opcode opcode, int x, int y)
+{
+    pike_instruction *instruction = &program->instructions[program->size];
+    instruction->opcode = opcode;
+    instruction->bytes = empty_byte_set();
+    instruction->x = x;
+    instruction->y = y;
+    return program->size++;
+}
+
+/**
+ * @brief Count the instructions of every subtree. Children always come before their parent in
+ * postfix order, so a single pass in that order finds them all.
+ * @param nodes The nodes of the tree, in postfix order
+ * @param count The number of nodes
+ * @param sizes Output with the number of instructions emit_tree adds for each subtree
+ */
+static void count_instructions(const pike_node *nodes, int count, size_t *sizes)
+{
+    for (int node = 0; node < count; node++)
+    {
+        const pike_node *current = &nodes[node];
+        size_t left = current->left != -1 ? sizes[current->left] : 0;
+        size_t right = current->right != -1 ? sizes[current->right] : 0;
+        switch (current->type)
+        {
+            case OPERAND:
+                sizes[node] = 1;
+                break;
+            case CONCATENATION:
+                sizes[node] = left + right;
+                break;
+            case ALTERNATION:
+                sizes[node] = 2 + left + right;
+                break;
+            case KLEENE_STAR:
+                sizes[node] = (current->slot != -1 ? 4 : 2) + left;
+                break;
+            case POSITIVE_CLOSURE:
+                sizes[node] = (current->slot != -1 ? 3 : 1) + left;
+                break;
+            case CAPTURE:
+                sizes[node] = 2 + left;
+                break;
+            case OPTIONAL:
+                sizes[node] = 1 + left;
+                break;
+            case REPETITION:
+                if (current->max == -1)
+                {
+                    size_t loop = current->slot != -1 ? 1 : 0;
+                    sizes[node] = current->min == 0 ? 2 + 2 * loop + left : (size_t)current->min * left + 1 + 2 * loop;
+                }
+                else if (current->max > current->min && current->slot != -1)
+                {
+                    // A save, then a split and a loop around each optional copy
+                    sizes[node] = (size_t)current->max * left + 1 + 2 * (size_t)(current->max - current->min);
+                }
+                else if (current->max > current->min)
+                {
+                    // One split before each optional copy
+                    sizes[node] = (size_t)current->max * left + (size_t)(current->max - current->min);
+                }
+                else
+                {
+                    sizes[node] = (size_t)current->max * left;
+                }
+                break;
+            default:
+                sizes[node] = 0;
+                break;
+        }
+    }
+}
+
+/**
+ * @brief Kinds of the steps emit_tree keeps on its stack.
+ */
+enum emit_step_kind
+{
+    /* Add the instructions of the subtree at node */
+    STEP_NODE,
+    /* After the left alternative: jump over the right one, which the split at value leads to */
+    STEP_ALTERNATIVE,
+    /* Point the jump at value past the last instruction */
+    STEP_PATCH_JUMP,
+    /* Point the second target of the split at value past the last instruction */
+    STEP_PATCH_SPLIT,
+    /* After the operand of a star: check for an empty iteration, then jump back to the split at
+    value, which then exits here */
+    STEP_STAR_END,
+    /* After the operand of a plus: check for an empty iteration, then split back to the first
+    instruction of the operand at value, or go on */
+    STEP_PLUS_END,
+    /* Save the slot in value */
+    STEP_SAVE,
+    /* Last copy of the operand of an unbounded repetition, as a star or a plus */
+    STEP_REPEAT_LAST,
+    /* The optional copies of a bounded repetition, with value copies left and extra the last of
+    the splits and loops still pointing nowhere, or -1 before the first copy */
+    STEP_OPTIONAL_COPY,
+    /* After an optional copy of a bounded repetition, with value copies left after it and extra
+    as in STEP_OPTIONAL_COPY */
+    STEP_OPTIONAL_END,
+};
+typedef enum emit_step_kind emit_step_kind;
+
+/**
+ * @brief Struct to represent a step of emit_tree.
+ */
+struct emit_step
+{
+    emit_step_kind kind;
+    /* The node the step belongs to */
+    int node;
+    /* An instruction or a count, as the kind says */
+    int value;
+    int extra;
+};
+typedef struct emit_step emit_step;
+
+/**
+ * @brief Struct to represent the growable stack of steps of emit_tree.
+ */
+struct emit_stack
+{
+    emit_step *steps;
+    size_t size;
+    size_t capacity;
+};
+typedef struct emit_stack emit_stack;
+
+/**
+ * @brief Push a step on the stack of emit_tree, growing it when it is full.
+ */
+static void push_step(emit_stack *stack, emit_step_kind kind, int node, int value, int extra)
+{
+    if (stack->size == stack->capacity)
+    {
+        stack->capacity = stack->capacity == 0 ? 64 : stack->capacity * 2;
+        stack->steps = realloc(stack->steps, stack->capacity * sizeof(emit_step));
+        if (stack->steps == NULL)
+        {
+            fprintf(stderr, "Error: Out of memory while compiling the Pike VM program.\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+    emit_step *step = &stack->steps[stack->size++];
+    step->kind = kind;
+    step->node = node;
+    step->value = value;
+    step->extra = extra;
+}
+
+/**
+ * @brief Start a star. When its operand matches the empty string, the first iteration is
+ * optional, so it starts here.
+ * @return The split that enters the loop
+ */
+static int emit_star_start(pike_program *program, const pike_node *node)
+{
+    // L1: split L2, L3; L2: operand; jump L1; L3:
+    // or SAVE s; L1: split L2, L3; L2: operand; loop s, L3; jump L1; L3:
+    if (node->slot != -1)
+    {
+        emit(program, PIKE_SAVE, node->slot, 0);
+    }
+    return emit(program, PIKE_SPLIT, program->size + 1, 0);
+}
+
+/**
+ * @brief Start a plus. When its operand matches the empty string, the first iteration is required,
+ * so it is never checked for being empty.
+ * @return The first instruction of the operand
+ */
+static int emit_plus_start(pike_program *program, const pike_node *node)
+{
+    // L1: operand; split L1, L2; L2:
+    // or CLEAR s; L1: operand; loop s, L2; split L1, L2; L2:
+    if (node->slot != -1)
+    {
+        emit(program, PIKE_CLEAR, node->slot, 0);
+    }
+    return program->size;
+}
+
+/**
+ * @brief End an iteration of a repetition whose operand matches the empty string.
+ * @return The loop instruction, whose exit target is still to be set, or -1 for the other
+ * repetitions
+ */
+static int emit_loop(pike_program *program, const pike_node *node)
+{
+    return node->slot != -1 ? emit(program, PIKE_LOOP, 0, node->slot) : -1;
+}
+
+/**
+ * @brief Add the instructions of a tree at the end of a program. The steps still to do are kept on
+ * a stack, pushed in reverse order, so deeply nested groups and long literals do not recurse.
+ * @param program Pointer to the program
+ * @param nodes The nodes of the tree
+ * @param root The root of the tree
+ */
+static void emit_tree(pike_program *program, const pike_node *nodes, int root)
+{
+    emit_stack stack = {NULL, 0, 0};
+    push_step(&stack, STEP_NODE, root, 0, 0);
+    while (stack.size > 0)
+    {
+        const emit_step step = stack.steps[--stack.size];
+        const pike_node *current = &nodes[step.node];
+        switch (step.kind)
+        {
+            case STEP_NODE:
+                break;
+            case STEP_ALTERNATIVE:
+            {
+                int jump = emit(program, PIKE_JUMP, 0, 0);
+                program->instructions[step.value].y = program->size;
+                push_step(&stack, STEP_PATCH_JUMP, step.node, jump, 0);
+                push_step(&stack, STEP_NODE, current->right, 0, 0);
+                continue;
+            }
+            case STEP_PATCH_JUMP:
+                program->instructions[step.value].x = program->size;
+                continue;
+            case STEP_PATCH_SPLIT:
+                program->instructions[step.value].y = program->size;
+                continue;
+            case STEP_STAR_END:
+            {
+                int loop = emit_loop(program, current);
+                emit(program, PIKE_JUMP, step.value, 0);
+                program->instructions[step.value].y = program->size;
+                if (loop != -1)
+                {
+                    program->instructions[loop].x = program->size;
+                }
+                continue;
+            }
+            case STEP_PLUS_END:
+            {
+                int loop = emit_loop(program, current);
+                emit(program, PIKE_SPLIT, step.value, program->size + 1);
+                if (loop != -1)
+                {
+                    program->instructions[loop].x = program->size;
+                }
+                continue;
+            }
+            case STEP_SAVE:
+                emit(program, PIKE_SAVE, step.value, 0);
+                continue;
+            case STEP_REPEAT_LAST:
+                // The required copies are done, and the last one is a star or a plus: x{2,} is x x+
+                if (current->min == 0)
+                {
+                    push_step(&stack, STEP_STAR_END, step.node, emit_star_start(program, current), 0);
+                }
+                else
+                {
+                    push_step(&stack, STEP_PLUS_END, step.node, emit_plus_start(program, current), 0);
+                }
+                push_step(&stack, STEP_NODE, current->left, 0, 0);
+                continue;
+            case STEP_OPTIONAL_COPY:
+            {
+                // split L1, END; L1: operand; split L2, END; L2: operand; ... END:
+                // or SAVE s; split L1, END; L1: operand; loop s, END; split L2, END; ... END:
+                // Until END is known, the splits are chained through their second target, and
+                // the loops through their first one
+                if (step.value == 0)
+                {
+                    for (int pending = step.extra; pending != -1;)
+                    {
+                        pike_instruction *instruction = &program->instructions[pending];
+                        int *target = instruction->opcode == PIKE_SPLIT ? &instruction->y : &instruction->x;
+                        pending = *target;
+                        *target = program->size;
+                    }
+                    continue;
+                }
+                if (step.extra == -1 && current->slot != -1)
+                {
+                    emit(program, PIKE_SAVE, current->slot, 0);
+                }
+                int split = emit(program, PIKE_SPLIT, program->size + 1, step.extra);
+                push_step(&stack, STEP_OPTIONAL_END, step.node, step.value - 1, split);
+                push_step(&stack, STEP_NODE, current->left, 0, 0);
+                continue;
+            }
+            case STEP_OPTIONAL_END:
+            {
+                int loop = emit_loop(program, current);
+                if (loop != -1)
+                {
+                    program->instructions[loop].x = step.extra;
+                }
+                push_step(&stack, STEP_OPTIONAL_COPY, step.node, step.value, loop != -1 ? loop : step.extra);
+                continue;
+            }
+        }
+
+        switch (current->type)
+        {
+            case OPERAND:
+                program->instructions[emit(program, PIKE_BYTE, 0, 0)].bytes = current->bytes;
+                break;
+            case CONCATENATION:
+                push_step(&stack, STEP_NODE, current->right, 0, 0);
+                push_step(&stack, STEP_NODE, current->left, 0, 0);
+                break;
+            case ALTERNATION:
+                // split L1, L2; L1: left; jump L3; L2: right; L3:
+                push_step(&stack, STEP_ALTERNATIVE, step.node, emit(program, PIKE_SPLIT, program->size + 1, 0), 0);
+                push_step(&stack, STEP_NODE, current->left, 0, 0);
+                break;
+            case KLEENE_STAR:
+                push_step(&stack, STEP_STAR_END, step.node, emit_star_start(program, current), 0);
+                push_step(&stack, STEP_NODE, current->left, 0, 0);
+                break;
+            case POSITIVE_CLOSURE:
+                push_step(&stack, STEP_PLUS_END, step.node, emit_plus_start(program, current), 0);
+                push_step(&stack, STEP_NODE, current->left, 0, 0);
+                break;
+            case OPTIONAL:
+                // split L1, L2; L1: operand; L2:
+                push_step(&stack, STEP_PATCH_SPLIT, step.node, emit(program, PIKE_SPLIT, program->size + 1, 0), 0);
+                push_step(&stack, STEP_NODE, current->left, 0, 0);
+                break;
+            case REPETITION:
+                if (current->max == -1)
+                {
+                    push_step(&stack, STEP_REPEAT_LAST, step.node, 0, 0);
+                    for (int copy = 1; copy < current->min; copy++)
+                    {
+                        push_step(&stack, STEP_NODE, current->left, 0, 0);
+                    }
+                    break;
+                }
+                if (current->max > current->min)
+                {
+                    push_step(&stack, STEP_OPTIONAL_COPY, step.node, current->max - current->min, -1);
+                }
+                for (int copy = 0; copy < current->min; copy++)
+                {
+                    push_step(&stack, STEP_NODE, current->left, 0, 0);
+                }
+                break;
+            case CAPTURE:
+                emit(program, PIKE_SAVE, 2 * current->group, 0);
+                push_step(&stack, STEP_SAVE, step.node, 2 * current->group + 1, 0);
+                push_step(&stack, STEP_NODE, current->left, 0, 0);
+                break;
+            default:
+                break;
+        }
+    }
+    free(stack.steps);
+}
+
+/**
+ * @brief Build the syntax tree of a postfix regex with capture groups.
+ * @param r The postfix regex
+ * @param nodes Output for the nodes, one per item
+ * @return The root of the tree
+ */
+static int build_tree(const regex r, pike_node *nodes)
+{
+    // There can never be more subtrees on the stack than items in the regex
+    int *stack = malloc((r.size > 0 ? r.size : 1) * sizeof(int));
+    if (stack == NULL)
+    {
+        fprintf(stderr, "Error: Out of memory while compiling the Pike VM program.\n");
+        exit(EXIT_FAILURE);
+    }
+    int stack_top = -1;
+
+    for (int i = 0; i < r.size; i++)
+    {
+        item current_item = r.items[i];
+        pike_node *node = &nodes[i];
+        node->type = current_item.type;
+        node->bytes = current_item.bytes;
+        node->group = current_item.group;
+        node->min = current_item.min;
+        node->max = current_item.max;
+        node->left = -1;
+        node->right = -1;
+        node->slot = -1;
+
+        if (current_item.type != OPERAND)
+        {
+            int operands = (current_item.type == CONCATENATION || current_item.type == ALTERNATION) ? 2 : 1;
+            if (stack_top + 1 < operands)
+            {
+                fprintf(stderr, "Error: Invalid regex. Operator '%c' is missing operands.\n", current_item.value);
+                exit(EXIT_FAILURE);
+            }
+            if (operands == 2)
+            {
+                node->right = stack[stack_top--];
+            }
+            node->left = stack[stack_top--];
+        }
+        stack[++stack_top] = i;
+
+        switch (node->type)
+        {
+            case OPERAND:
+                node->nullable = false;
+                break;
+            case CONCATENATION:
+                node->nullable = nodes[node->left].nullable && nodes[node->right].nullable;
+                break;
+            case ALTERNATION:
+                node->nullable = nodes[node->left].nullable || nodes[node->right].nullable;
+                break;
+            case OPTIONAL:
+            case KLEENE_STAR:
+                node->nullable = true;
+                break;
+            case REPETITION:
+                node->nullable = node->min == 0 || nodes[node->left].nullable;
+                break;
+            default:
+                node->nullable = nodes[node->left].nullable;
+                break;
+        }
+    }
+
+    if (stack_top != 0)
+    {
+        fprintf(stderr, "Error: Invalid regex. Stack should have exactly one NFA left, but has %d.\n", stack_top + 1);
+        exit(EXIT_FAILURE);
+    }
+
+    int root = stack[0];
+    free(stack);
+    return root;
+}
+
+pike_program compile_pike_program(const char *regex_str)
+{
+    int groups;
+    regex r = parse_regex_with_groups(regex_str, &groups);
+
+    pike_node *nodes = malloc((r.size > 0 ? r.size : 1) * sizeof(pike_node));
+    size_t *sizes = malloc((r.size > 0 ? r.size : 1) * sizeof(size_t));
+    if (nodes == NULL || sizes == NULL)
+    {
+        fprintf(stderr, "Error: Out of memory while compiling the Pike VM program.\n");
+        exit(EXIT_FAILURE);
+    }
+    int root = build_tree(r, nodes);
+
+    // Only the repetitions of an operand that matches the empty string can take an empty
+    // iteration, and they need a slot to notice it
+    pike_program program;
+    program.size = 0;
+    program.groups = groups;
+    program.slots = 2 * (groups + 1);
+    program.cycles = false;
+    for (int node = 0; node < r.size; node++)
+    {
+        pike_node *current = &nodes[node];
+        bool loops = current->type == KLEENE_STAR || current->type == POSITIVE_CLOSURE ||
+                     (current->type == REPETITION && current->max == -1);
+        if ((loops || (current->type == REPETITION && current->max > current->min)) && nodes[current->left].nullable)
+        {
+            current->slot = program.slots++;
+            program.cycles = program.cycles || loops;
+        }
+    }
+
+    // The whole match adds two saves and a match to the instructions of the tree
+    count_instructions(nodes, r.size, sizes);
+    program.instructions = malloc((sizes[root] + 3) * sizeof(pike_instruction));
+    if (program.instructions == NULL)
+    {
+        fprintf(stderr, "Error: Out of memory while compiling the Pike VM program.\n");
+        exit(EXIT_FAILURE);
+    }
+
+    emit(&program, PIKE_SAVE, 0, 0);
+    emit_tree(&program, nodes, root);
+    emit(&program, PIKE_SAVE, 1, 0);
+    emit(&program, PIKE_MATCH, 0, 0);
+    free(nodes);
+    free(sizes);
+    free_regex(r);
+
+    // Threads only wait on a byte or on the match, and at most one does on each such instruction
+    // in each list
+    size_t size = (size_t)program.size;
+    size_t slots = (size_t)program.slots;
+    size_t waiting = 0;
+    for (size_t pc = 0; pc < size; pc++)
+    {
+        if (program.instructions[pc].opcode == PIKE_BYTE || program.instructions[pc].opcode == PIKE_MATCH)
+        {
+            waiting++;
+        }
+    }
+    program.threads[0] = malloc(waiting * sizeof(int));
+    program.threads[1] = malloc(waiting * sizeof(int));
+    program.captures[0] = malloc(waiting * slots * sizeof(size_t));
+    program.captures[1] = malloc(waiting * slots * sizeof(size_t));
+    program.working = malloc(slots * sizeof(size_t));
+    program.added = calloc(size, sizeof(size_t));
+    program.entered = calloc(size, sizeof(size_t));
+    program.visits = malloc(size);
+    program.step = 0;
+    program.stack_capacity = (int)size + 3;
+    program.stack = malloc((size_t)program.stack_capacity * sizeof(int));
+    program.stack_values = malloc((size_t)program.stack_capacity * sizeof(size_t));
+    if (program.threads[0] == NULL || program.threads[1] == NULL || program.captures[0] == NULL ||
+        program.captures[1] == NULL || program.working == NULL || program.added == NULL ||
+        program.entered == NULL || program.visits == NULL || program.stack == NULL || program.stack_values == NULL)
+    {
+        fprintf(stderr, "Error: Out of memory while compiling the Pike VM program.\n");
+        exit(EXIT_FAILURE);
+    }
+
+    return program;
+}
+
+/**
+ * @brief Make room for the entries a single instruction pushes on the stack of add_thread.
+ * @param program Pointer to the program
+ * @param stack_top Index of the top entry of the stack
+ */
+static void reserve_stack(pike_program *program, int stack_top)
+{
+    if (stack_top + 3 < program->stack_capacity)
+    {
+        return;
+    }
+    program->stack_capacity *= 2;
+    program->stack = realloc(program->stack, (size_t)program->stack_capacity * sizeof(int));
+    program->stack_values = realloc(program->stack_values, (size_t)program->stack_capacity * sizeof(size_t));
+    if (program->stack == NULL || program->stack_values == NULL)
+    {
+        fprintf(stderr, "Error: Out of memory while matching with the Pike VM.\n");
+        exit(EXIT_FAILURE);
+    }
+}
+
+/**
+ * @brief Add a thread to a list, following its jumps, splits and saves until every path waits on
+ * a byte or a match. The paths are added in priority order, and an instruction is not added again
+ * once every path after it was, since the thread that got there first has higher priority. A path
+ * that comes back to an instruction whose paths are still being added went around a repetition
+ * without reading a byte; it is followed, as a backtracking matcher would, until the repetition
+ * stops on its empty iteration, but only while the instruction was followed less than
+ * PIKE_VM_MAX_VISITS times in this step.
+ * @param program Pointer to the program
+ * @param list The list the threads are added to, 0 or 1
+ * @param count Pointer to the number of threads in the list
+ * @param start The instruction of the thread
+ * @param offset The offset of the input the thread is at
+ * @param step The current step
+ */
+static void add_thread(pike_program *program, int list, int *count, int start, size_t offset, size_t step)
+{
+    const size_t slots = (size_t)program->slots;
+    size_t *working = program->working;
+    int stack_top = -1;
+    program->stack[++stack_top] = start;
+
+    while (stack_top != -1)
+    {
+        int pc = program->stack[stack_top--];
+        if (pc < 0)
+        {
+            if (-1 - pc < program->slots)
+            {
+                // Every path after the save was added, so the slot gets its old value back
+                working[-1 - pc] = program->stack_values[stack_top + 1];
+            }
+            else
+            {
+                // Every path after the instruction was added
+                program->added[-1 - pc - program->slots] = step;
+            }
+            continue;
+        }
+        if (program->added[pc] == step)
+        {
+            continue;
+        }
+
+        const pike_instruction *instruction = &program->instructions[pc];
+        if (instruction->opcode == PIKE_BYTE || instruction->opcode == PIKE_MATCH)
+        {
+            // Bytes and matches wait in the list for the next step
+            program->added[pc] = step;
+            program->threads[list][*count] = pc;
+            memcpy(program->captures[list] + (size_t)*count * slots, working, slots * sizeof(size_t));
+            (*count)++;
+            continue;
+        }
+        reserve_stack(program, stack_top);
+        int *stack = program->stack;
+        if (!program->cycles)
+        {
+            // No path comes back to the instruction without reading a byte
+            program->added[pc] = step;
+        }
+        else
+        {
+            if (program->entered[pc] != step)
+            {
+                program->entered[pc] = step;
+                program->visits[pc] = 0;
+            }
+            if (program->visits[pc] == PIKE_VM_MAX_VISITS)
+            {
+                continue;
+            }
+            program->visits[pc]++;
+            stack[++stack_top] = -1 - program->slots - pc;
+        }
+        switch (instruction->opcode)
+        {
+            case PIKE_JUMP:
+                stack[++stack_top] = instruction->x;
+                break;
+            case PIKE_SPLIT:
+                // The first target is popped, and therefore added, first
+                stack[++stack_top] = instruction->y;
+                stack[++stack_top] = instruction->x;
+                break;
+            case PIKE_SAVE:
+            case PIKE_CLEAR:
+                stack[++stack_top] = -1 - instruction->x;
+                program->stack_values[stack_top] = working[instruction->x];
+                working[instruction->x] = instruction->opcode == PIKE_SAVE ? offset : PIKE_VM_UNSET;
+                stack[++stack_top] = pc + 1;
+                break;
+            case PIKE_LOOP:
+                // An optional iteration that matched the empty string is kept, but ends the repetition
+                if (working[instruction->y] == offset)
+                {
+                    stack[++stack_top] = instruction->x;
+                    break;
+                }
+                stack[++stack_top] = -1 - instruction->y;
+                program->stack_values[stack_top] = working[instruction->y];
+                working[instruction->y] = offset;
+                stack[++stack_top] = pc + 1;
+                break;
+            default:
+                break;
+        }
+    }
+}
+
+bool pike_vm_match(pike_program *program, const char *input, size_t input_length, size_t *slots)
+{
+    const size_t slot_count = (size_t)program->slots;
+    int current = 0;
+    int count = 0;
+
+    for (size_t slot = 0; slot < slot_count; slot++)
+    {
+        program->working[slot] = PIKE_VM_UNSET;
+    }
+    add_thread(program, current, &count, 0, 0, ++program->step);
+
+    for (size_t i = 0; i < input_length && count > 0; i++)
+    {
+        const unsigned char byte = (unsigned char)input[i];
+        const size_t step = ++program->step;
+        int next_count = 0;
+
+        // The threads are stepped in priority order, so the next list keeps that order
+        for (int thread = 0; thread < count; thread++)
+        {
+            const pike_instruction *instruction = &program->instructions[program->threads[current][thread]];
+            if (instruction->opcode != PIKE_BYTE || !byte_set_contains(&instruction->bytes, byte))
+            {
+                // A match before the end of the input does not match the whole input
+                continue;
+            }
+            memcpy(program->working, program->captures[current] + (size_t)thread * slot_count,
+                   slot_count * sizeof(size_t));
+            add_thread(program, 1 - current, &next_count, program->threads[current][thread] + 1, i + 1, step);
+        }
+
+        current = 1 - current;
+        count = next_count;
+    }
+
+    // The thread with the highest priority that reached the match has the captures
+    for (int thread = 0; thread < count; thread++)
+    {
+        if (program->instructions[program->threads[current][thread]].opcode == PIKE_MATCH)
+        {
+            memcpy(slots, program->captures[current] + (size_t)thread * slot_count, slot_count * sizeof(size_t));
+            return true;
+        }
+    }
+    return false;
+}
+
+bool match_captures(const nfa *automaton, pike_program *program, const char *input, size_t input_length,
+                    size_t *slots)
+{
+    // Most inputs are expected to be rejected, and they never reach the Pike VM
+    if (!match_nfa(automaton, input, input_length))
+    {
+        return false;
+    }
+    return pike_vm_match(program, input, input_length, slots);
+}
+
+void free_pike_program(pike_program *program)
+{
+    free(program->instructions);
+    free(program->threads[0]);
+    free(program->threads[1]);
+    free(program->captures[0]);
+    free(program->captures[1]);
+    free(program->working);
+    free(program->added);
+    free(program->entered);
+    free(program->visits);
+    free(program->stack);
+    free(program->stack_values);
+    program->instructions = NULL;
+    program->size = 0;
+}
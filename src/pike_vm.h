@@ -0,0 +1,150 @@
+#ifndef PIKE_VM_H
+#define PIKE_VM_H
+
+#include "nfa.h"
+
+/* Offset stored in the capture slots of a group that did not take part in the match */
+#define PIKE_VM_UNSET ((size_t)-1)
+
+/* Times an instruction can be followed for the same byte while a path goes around repetitions
+without reading one */
+#define PIKE_VM_MAX_VISITS 8
+
+/**
+ * @brief Opcodes of the instructions of a Pike VM program.
+ */
+enum Pike_Opcode
+{
+    /* Consume one byte of the set and go on with the next instruction */
+    PIKE_BYTE,
+    /* Go on with both targets, the first one with higher priority */
+    PIKE_SPLIT,
+    /* Go on with the first target */
+    PIKE_JUMP,
+    /* Store the current offset in a capture slot and go on with the next instruction */
+    PIKE_SAVE,
+    /* Mark a slot as unset and go on with the next instruction */
+    PIKE_CLEAR,
+    /* End of an iteration of a repetition: go on with the first target if the iteration matched the
+    empty string, since it started at the offset in the slot; otherwise store the current offset in
+    the slot, where the next iteration starts, and go on with the next instruction */
+    PIKE_LOOP,
+    /* Accept, if the whole input was consumed */
+    PIKE_MATCH,
+};
+typedef enum Pike_Opcode pike_opcode;
+
+/**
+ * @brief Struct to represent one instruction of a Pike VM program.
+ */
+struct pike_instruction
+{
+    /* What the instruction does */
+    pike_opcode opcode;
+    /* Bytes consumed by a PIKE_BYTE instruction */
+    byte_set bytes;
+    /* Target of PIKE_SPLIT, PIKE_JUMP and PIKE_LOOP, or the slot of PIKE_SAVE and PIKE_CLEAR */
+    int x;
+    /* Second target of PIKE_SPLIT, or the slot of PIKE_LOOP */
+    int y;
+};
+typedef struct pike_instruction pike_instruction;
+
+/**
+ * @brief Struct to represent a regex compiled for the Pike VM, together with the thread lists
+ * the VM runs on. Group 0 is the whole match, and the other groups are numbered from 1 in the
+ * order of their left parentheses. Group g starts at slot 2g and ends at slot 2g + 1. The slots
+ * after those of the groups hold where the current iteration of each repetition of an operand
+ * that matches the empty string started.
+ * The thread lists are reused by every match, so a program must not be shared between threads.
+ */
+struct pike_program
+{
+    /* The instructions. Execution starts at instruction 0 */
+    pike_instruction *instructions;
+    /* Number of instructions */
+    int size;
+    /* Number of capture groups, without group 0 */
+    int groups;
+    /* Number of capture slots of each thread, two per group including group 0, and one per
+    repetition of an operand that matches the empty string that can take iterations it does not
+    need */
+    int slots;
+    /* Whether a path can come back to an instruction without reading a byte, through a `*` or
+    `+` whose operand matches the empty string */
+    bool cycles;
+    /* Instruction of each thread of the current and next lists */
+    int *threads[2];
+    /* Capture slots of each thread of the current and next lists, `slots` per thread */
+    size_t *captures[2];
+    /* Capture slots of the thread being added */
+    size_t *working;
+    /* Step in which every path after each instruction was last added, to add it only once per step */
+    size_t *added;
+    /* Step in which each instruction was last followed */
+    size_t *entered;
+    /* Times each instruction was followed in the step in `entered` */
+    unsigned char *visits;
+    /* Last step taken. Steps are never reused, so `added` and `entered` do not need clearing between
+    matches */
+    size_t step;
+    /* Stack of the instructions to follow while a thread is added. An entry -1 - s restores slot
+    s, and an entry -1 - slots - pc marks instruction pc as added */
+    int *stack;
+    /* Value restored by each slot entry of the stack */
+    size_t *stack_values;
+    /* Number of entries the stack has room for. It grows when a path goes around repetitions
+    that match the empty string */
+    int stack_capacity;
+};
+typedef struct pike_program pike_program;
+
+/**
+ * @brief Compile a regex into a Pike VM program. The program is built from the same parse as
+ * the NFA, so both accept the same language. The program prefers the left side of an
+ * alternation and the longest repetition, so the captures are the ones a backtracking matcher
+ * that tries the alternatives in that order would report. Iterations that match the empty string
+ * follow the same rule as such matchers: the required iterations are always taken, and an
+ * optional one that matches the empty string is kept but ends the repetition, so `(a*)*`
+ * captures an empty span on an empty input. Such iterations are only followed up to
+ * PIKE_VM_MAX_VISITS times per instruction and byte, so with repetitions of operands that match
+ * the empty string nested three or more deep the captures can differ from a backtracking matcher,
+ * which takes exponential time on them.
+ * @param regex_str The regex
+ * @return The program. Release it with free_pike_program
+ */
+pike_program compile_pike_program(const char *regex_str);
+
+/**
+ * @brief Run a Pike VM program over the whole input. The threads advance in lockstep over the
+ * input, at most one thread per instruction, so the match takes O(n·m) time for an input of
+ * n bytes and a program of m instructions, whatever the regex.
+ * @param program Pointer to the program
+ * @param input The input string
+ * @param input_length The length of the input string
+ * @param slots Output for the capture slots, `program->slots` offsets. Unset groups are
+ * PIKE_VM_UNSET. It is only written when the input matches
+ * @return true if the program accepts the whole input, false otherwise
+ */
+bool pike_vm_match(pike_program *program, const char *input, size_t input_length, size_t *slots);
+
+/**
+ * @brief Match an input and find its captures. The NFA accepts or rejects the input first with
+ * its fastest engine, and the slower Pike VM only runs over the inputs it accepts.
+ * @param automaton Pointer to the NFA of the regex
+ * @param program Pointer to the Pike VM program of the same regex
+ * @param input The input string
+ * @param input_length The length of the input string
+ * @param slots Output for the capture slots, as in pike_vm_match
+ * @return true if the input matches, false otherwise
+ */
+bool match_captures(const nfa *automaton, pike_program *program, const char *input, size_t input_length,
+                    size_t *slots);
+
+/**
+ * @brief Release the memory owned by a Pike VM program.
+ * @param program Pointer to the program
+ */
+void free_pike_program(pike_program *program);
+
+#endif // PIKE_VM_H
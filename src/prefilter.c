@@ -0,0 +1,304 @@
+#include "prefilter.h"
+#include "state_set.h"
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#endif
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define PREFILTER_SSE2 1
+#endif
+
+/**
+ * @brief Struct to represent the literals of a subexpression while analysing the regex.
+ * Every string matched by the subexpression starts with prefix, ends with suffix and
+ * contains required. When exact is true, the subexpression matches exactly one string,
+ * stored in all three literals.
+ */
+struct literal_info
+{
+    char prefix[PREFILTER_MAX_LITERAL];
+    size_t prefix_length;
+    char suffix[PREFILTER_MAX_LITERAL];
+    size_t suffix_length;
+    char required[PREFILTER_MAX_LITERAL];
+    size_t required_length;
+    bool exact;
+};
+typedef struct literal_info literal_info;
+
+/**
+ * @brief Keep a literal as the required one if it is longer than the current one.
+ * @param info The literals of the subexpression
+ * @param literal The candidate literal
+ * @param length The length of the candidate literal
+ */
+static void offer_required(literal_info *info, const char *literal, size_t length)
+{
+    if (length > info->required_length)
+    {
+        memmove(info->required, literal, length);
+        info->required_length = length;
+    }
+}
+
+/**
+ * @brief Literals of the concatenation of two subexpressions.
+ */
+static literal_info concatenate_literals(const literal_info *a, const literal_info *b)
+{
+    literal_info result;
+    char joined[2 * PREFILTER_MAX_LITERAL];
+    size_t joined_length;
+
+    // Prefix: all of a when it is exact, followed by the prefix of b
+    memcpy(result.prefix, a->prefix, a->prefix_length);
+    result.prefix_length = a->prefix_length;
+    if (a->exact)
+    {
+        size_t extra = b->prefix_length;
+        if (result.prefix_length + extra > PREFILTER_MAX_LITERAL)
+        {
+            extra = PREFILTER_MAX_LITERAL - result.prefix_length;
+        }
+        memcpy(result.prefix + result.prefix_length, b->prefix, extra);
+        result.prefix_length += extra;
+    }
+
+    // Suffix: the suffix of a followed by all of b when it is exact, keeping the last bytes
+    if (b->exact)
+    {
+        memcpy(joined, a->suffix, a->suffix_length);
+        memcpy(joined + a->suffix_length, b->suffix, b->suffix_length);
+        joined_length = a->suffix_length + b->suffix_length;
+    }
+    else
+    {
+        memcpy(joined, b->suffix, b->suffix_length);
+        joined_length = b->suffix_length;
+    }
+    size_t keep = joined_length > PREFILTER_MAX_LITERAL ? PREFILTER_MAX_LITERAL : joined_length;
+    memcpy(result.suffix, joined + joined_length - keep, keep);
+    result.suffix_length = keep;
+
+    result.exact = a->exact && b->exact && a->prefix_length + b->prefix_length <= PREFILTER_MAX_LITERAL;
+
+    // Required: the best of both sides and of the literal that spans the boundary
+    result.required_length = 0;
+    offer_required(&result, a->required, a->required_length);
+    offer_required(&result, b->required, b->required_length);
+    memcpy(joined, a->suffix, a->suffix_length);
+    memcpy(joined + a->suffix_length, b->prefix, b->prefix_length);
+    joined_length = a->suffix_length + b->prefix_length;
+    offer_required(&result, joined, joined_length > PREFILTER_MAX_LITERAL ? PREFILTER_MAX_LITERAL : joined_length);
+    offer_required(&result, result.prefix, result.prefix_length);
+    offer_required(&result, result.suffix, result.suffix_length);
+
+    return result;
+}
+
+/**
+ * @brief Literals of the alternation of two subexpressions.
+ */
+static literal_info alternate_literals(const literal_info *a, const literal_info *b)
+{
+    literal_info result;
+
+    // Longest common prefix and suffix of both sides
+    size_t length = 0;
+    while (length < a->prefix_length && length < b->prefix_length && a->prefix[length] == b->prefix[length])
+    {
+        length++;
+    }
+    memcpy(result.prefix, a->prefix, length);
+    result.prefix_length = length;
+
+    length = 0;
+    while (length < a->suffix_length && length < b->suffix_length &&
+           a->suffix[a->suffix_length - 1 - length] == b->suffix[b->suffix_length - 1 - length])
+    {
+        length++;
+    }
+    memcpy(result.suffix, a->suffix + a->suffix_length - length, length);
+    result.suffix_length = length;
+
+    result.exact = a->exact && b->exact && a->prefix_length == b->prefix_length &&
+                   memcmp(a->prefix, b->prefix, a->prefix_length) == 0;
+
+    result.required_length = 0;
+    if (a->required_length == b->required_length && memcmp(a->required, b->required, a->required_length) == 0)
+    {
+        offer_required(&result, a->required, a->required_length);
+    }
+    offer_required(&result, result.prefix, result.prefix_length);
+    offer_required(&result, result.suffix, result.suffix_length);
+
+    return result;
+}
+
+bool regex_to_prefilter(const regex r, prefilter *result)
+{
+    literal_info *stack = malloc((r.size > 0 ? r.size : 1) * sizeof(literal_info));
+    if (stack == NULL)
+    {
+        return false;
+    }
+    int stack_top = -1;
+
+    for (int i = 0; i < r.size; i++)
+    {
+        item current_item = r.items[i];
+
+        if (current_item.type == OPERAND)
+        {
+            literal_info info;
+            if (byte_set_count(&current_item.bytes) == 1)
+            {
+                info.prefix[0] = info.suffix[0] = info.required[0] = current_item.value;
+                info.prefix_length = info.suffix_length = info.required_length = 1;
+                info.exact = true;
+            }
+            else
+            {
+                // A class or the wildcard is not a literal, so it has no known bytes
+                info.prefix_length = info.suffix_length = info.required_length = 0;
+                info.exact = false;
+            }
+            stack[++stack_top] = info;
+            continue;
+        }
+
+        int operands = (current_item.type == CONCATENATION || current_item.type == ALTERNATION) ? 2 : 1;
+        if (stack_top + 1 < operands)
+        {
+            free(stack);
+            return false;
+        }
+
+        if (current_item.type == CONCATENATION || current_item.type == ALTERNATION)
+        {
+            literal_info b = stack[stack_top--];
+            literal_info a = stack[stack_top--];
+            stack[++stack_top] = current_item.type == CONCATENATION ? concatenate_literals(&a, &b)
+                                                                    : alternate_literals(&a, &b);
+        }
+        else if (current_item.type == POSITIVE_CLOSURE || (current_item.type == REPETITION && current_item.min > 0))
+        {
+            // Every repetition still starts, ends and contains the same literals
+            stack[stack_top].exact = false;
+        }
+        else if (current_item.type == KLEENE_STAR || current_item.type == OPTIONAL || current_item.type == REPETITION)
+        {
+            // The empty string matches, so nothing is required
+            literal_info *info = &stack[stack_top];
+            info->prefix_length = info->suffix_length = info->required_length = 0;
+            info->exact = false;
+        }
+    }
+
+    if (stack_top != 0)
+    {
+        free(stack);
+        return false;
+    }
+
+    literal_info root = stack[0];
+    free(stack);
+
+    memcpy(result->prefix, root.prefix, root.prefix_length);
+    result->prefix_length = root.prefix_length;
+    memcpy(result->required, root.required, root.required_length);
+    result->required_length = root.required_length;
+
+    return result->required_length > 0;
+}
+
+/**
+ * @brief Check whether a candidate position holds the whole literal. The first and last
+ * bytes are already known to match.
+ */
+static bool literal_at(const char *literal, size_t literal_length, const char *position)
+{
+    return literal_length <= 2 || memcmp(position + 1, literal + 1, literal_length - 2) == 0;
+}
+
+size_t prefilter_find(const char *literal, size_t literal_length, const char *input, size_t input_length,
+                      size_t from)
+{
+    if (from > input_length || input_length - from < literal_length)
+    {
+        return PREFILTER_NOT_FOUND;
+    }
+    if (literal_length == 0)
+    {
+        return from;
+    }
+
+    // Last offset where the literal fits
+    const size_t last_start = input_length - literal_length;
+    const size_t last_offset = literal_length - 1;
+    size_t i = from;
+
+#if defined(__AVX2__)
+    const __m256i first_32 = _mm256_set1_epi8(literal[0]);
+    const __m256i last_32 = _mm256_set1_epi8(literal[last_offset]);
+    while (i <= last_start && last_start - i >= 31)
+    {
+        __m256i block_first = _mm256_loadu_si256((const __m256i *)(input + i));
+        __m256i block_last = _mm256_loadu_si256((const __m256i *)(input + i + last_offset));
+        uint32_t mask = (uint32_t)_mm256_movemask_epi8(
+            _mm256_and_si256(_mm256_cmpeq_epi8(block_first, first_32), _mm256_cmpeq_epi8(block_last, last_32)));
+        for (; mask != 0; mask &= mask - 1)
+        {
+            size_t candidate = i + (size_t)state_set_ctz(mask);
+            if (literal_at(literal, literal_length, input + candidate))
+            {
+                return candidate;
+            }
+        }
+        i += 32;
+    }
+#endif
+
+#if defined(PREFILTER_SSE2)
+    const __m128i first_16 = _mm_set1_epi8(literal[0]);
+    const __m128i last_16 = _mm_set1_epi8(literal[last_offset]);
+    while (i <= last_start && last_start - i >= 15)
+    {
+        __m128i block_first = _mm_loadu_si128((const __m128i *)(input + i));
+        __m128i block_last = _mm_loadu_si128((const __m128i *)(input + i + last_offset));
+        unsigned mask = (unsigned)_mm_movemask_epi8(
+            _mm_and_si128(_mm_cmpeq_epi8(block_first, first_16), _mm_cmpeq_epi8(block_last, last_16)));
+        for (; mask != 0; mask &= mask - 1)
+        {
+            size_t candidate = i + (size_t)state_set_ctz(mask);
+            if (literal_at(literal, literal_length, input + candidate))
+            {
+                return candidate;
+            }
+        }
+        i += 16;
+    }
+#endif
+
+    // Scalar tail: memchr on the first byte, then compare the rest
+    while (i <= last_start)
+    {
+        const char *hit = memchr(input + i, literal[0], last_start - i + 1);
+        if (hit == NULL)
+        {
+            return PREFILTER_NOT_FOUND;
+        }
+        size_t candidate = (size_t)(hit - input);
+        if (input[candidate + last_offset] == literal[last_offset] &&
+            literal_at(literal, literal_length, input + candidate))
+        {
+            return candidate;
+        }
+        i = candidate + 1;
+    }
+
+    return PREFILTER_NOT_FOUND;
+}
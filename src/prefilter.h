@@ -0,0 +1,54 @@
+#ifndef PREFILTER_H
+#define PREFILTER_H
+
+#include "regex.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* Maximum length of the literals kept by a prefilter */
+#define PREFILTER_MAX_LITERAL 32
+/* Offset returned by prefilter_find when the literal does not occur */
+#define PREFILTER_NOT_FOUND SIZE_MAX
+
+/**
+ * @brief Struct to represent the literals that every match of a regex must contain. They are
+ * used to skip the parts of the input where no match can start, so the automaton only runs
+ * near candidate positions. An empty literal (length 0) means the regex has none.
+ */
+struct prefilter
+{
+    /* Literal that every match starts with */
+    char prefix[PREFILTER_MAX_LITERAL];
+    /* Length of the prefix literal */
+    size_t prefix_length;
+    /* Longest literal found inside every match. It may be the prefix itself */
+    char required[PREFILTER_MAX_LITERAL];
+    /* Length of the required literal */
+    size_t required_length;
+};
+typedef struct prefilter prefilter;
+
+/**
+ * @brief Extract the required literals of a regular expression in postfix notation.
+ * @param r The input regular expression as a regex struct
+ * @param result Output for the prefilter
+ * @return true if the regex has a non-empty required literal, false otherwise
+ */
+bool regex_to_prefilter(const regex r, prefilter *result);
+
+/**
+ * @brief Find the first occurrence of a literal in the input, starting at a given offset.
+ * The scan compares the first and last bytes of the literal against 16 or 32 input bytes
+ * at a time with SSE2 or AVX2 when available, and checks the rest only on candidates.
+ * @param literal The literal to look for
+ * @param literal_length The length of the literal
+ * @param input The input string
+ * @param input_length The length of the input string
+ * @param from The offset where the scan starts
+ * @return The offset of the first occurrence at or after `from`, or PREFILTER_NOT_FOUND
+ */
+size_t prefilter_find(const char *literal, size_t literal_length, const char *input, size_t input_length,
+                      size_t from);
+
+#endif // PREFILTER_H
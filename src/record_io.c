@@ -0,0 +1,291 @@
+#include "record_io.h"
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if !defined(_WIN32)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#define RECORD_IO_MMAP 1
+#endif
+
+/* Number of bytes of the length prefix of a record */
+#define RECORD_PREFIX_SIZE 4
+
+bool parse_record_format(const char *name, record_format *format)
+{
+    if (strcmp(name, "line") == 0)
+    {
+        *format = RECORD_NEWLINE;
+    }
+    else if (strcmp(name, "nul") == 0)
+    {
+        *format = RECORD_NUL;
+    }
+    else if (strcmp(name, "len") == 0)
+    {
+        *format = RECORD_LENGTH_PREFIX;
+    }
+    else
+    {
+        return false;
+    }
+    return true;
+}
+
+/**
+ * @brief Read a stream until its end into a heap buffer.
+ * @param file The stream to read
+ * @param input Pointer to the input to fill
+ * @return true if the stream was read, false otherwise
+ */
+static bool read_whole_stream(FILE *file, mapped_input *input)
+{
+    size_t capacity = 1 << 16;
+    size_t length = 0;
+    char *data = malloc(capacity);
+    if (data == NULL)
+    {
+        return false;
+    }
+
+    for (;;)
+    {
+        if (length == capacity)
+        {
+            capacity *= 2;
+            char *grown = realloc(data, capacity);
+            if (grown == NULL)
+            {
+                free(data);
+                return false;
+            }
+            data = grown;
+        }
+
+        size_t read = fread(data + length, 1, capacity - length, file);
+        length += read;
+        if (read == 0)
+        {
+            break;
+        }
+    }
+
+    if (ferror(file))
+    {
+        free(data);
+        return false;
+    }
+
+    input->data = data;
+    input->length = length;
+    input->mapped = false;
+    return true;
+}
+
+bool map_input(const char *file_path, mapped_input *input)
+{
+    if (file_path == NULL)
+    {
+        return read_whole_stream(stdin, input);
+    }
+
+#if defined(RECORD_IO_MMAP)
+    int fd = open(file_path, O_RDONLY);
+    if (fd == -1)
+    {
+        return false;
+    }
+
+    struct stat info;
+    if (fstat(fd, &info) == 0 && S_ISREG(info.st_mode) && info.st_size > 0 &&
+        (uintmax_t)info.st_size <= SIZE_MAX)
+    {
+        void *data = mmap(NULL, (size_t)info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (data != MAP_FAILED)
+        {
+            close(fd);
+#if defined(MADV_SEQUENTIAL)
+            madvise(data, (size_t)info.st_size, MADV_SEQUENTIAL);
+#endif
+            input->data = data;
+            input->length = (size_t)info.st_size;
+            input->mapped = true;
+            return true;
+        }
+    }
+    close(fd);
+#endif
+
+    // Pipes, empty files and anything that cannot be mapped is read into memory
+    FILE *file = fopen(file_path, "rb");
+    if (file == NULL)
+    {
+        return false;
+    }
+    bool ok = read_whole_stream(file, input);
+    fclose(file);
+    return ok;
+}
+
+void unmap_input(mapped_input *input)
+{
+#if defined(RECORD_IO_MMAP)
+    if (input->mapped)
+    {
+        munmap((void *)input->data, input->length);
+    }
+    else
+#endif
+    {
+        free((void *)input->data);
+    }
+    input->data = NULL;
+    input->length = 0;
+    input->mapped = false;
+}
+
+/**
+ * @brief Read the little-endian length prefix of a record.
+ */
+static uint32_t read_prefix(const char *bytes)
+{
+    const unsigned char *b = (const unsigned char *)bytes;
+    return (uint32_t)b[0] | ((uint32_t)b[1] << 8) | ((uint32_t)b[2] << 16) | ((uint32_t)b[3] << 24);
+}
+
+void record_reader_init(record_reader *reader, const char *data, size_t length, record_format format)
+{
+    reader->data = data;
+    reader->length = length;
+    reader->position = 0;
+    reader->format = format;
+    reader->malformed = false;
+}
+
+bool next_record(record_reader *reader, const char **record, size_t *record_length)
+{
+    const size_t position = reader->position;
+    const size_t remaining = reader->length - position;
+    if (remaining == 0)
+    {
+        return false;
+    }
+
+    const char *start = reader->data + position;
+    if (reader->format == RECORD_LENGTH_PREFIX)
+    {
+        if (remaining < RECORD_PREFIX_SIZE || read_prefix(start) > remaining - RECORD_PREFIX_SIZE)
+        {
+            reader->malformed = true;
+            return false;
+        }
+        *record = start + RECORD_PREFIX_SIZE;
+        *record_length = read_prefix(start);
+        reader->position += RECORD_PREFIX_SIZE + *record_length;
+        return true;
+    }
+
+    const char delimiter = reader->format == RECORD_NUL ? '\0' : '\n';
+    const char *end = memchr(start, delimiter, remaining);
+    size_t length = end != NULL ? (size_t)(end - start) : remaining;
+    reader->position += end != NULL ? length + 1 : length;
+
+    if (reader->format == RECORD_NEWLINE)
+    {
+        const char *carriage_return = memchr(start, '\r', length);
+        if (carriage_return != NULL)
+        {
+            length = (size_t)(carriage_return - start);
+        }
+    }
+
+    *record = start;
+    *record_length = length;
+    return true;
+}
+
+size_t record_boundary(const char *data, size_t length, record_format format, size_t from, size_t min_length)
+{
+    if (min_length == 0 || from >= length)
+    {
+        return from < length ? from : length;
+    }
+    if (length - from <= min_length)
+    {
+        return length;
+    }
+    const size_t target = from + min_length;
+
+    if (format == RECORD_LENGTH_PREFIX)
+    {
+        // The records have to be walked from `from`, since a prefix cannot be told apart from data
+        size_t position = from;
+        while (position < target)
+        {
+            if (length - position < RECORD_PREFIX_SIZE ||
+                read_prefix(data + position) > length - position - RECORD_PREFIX_SIZE)
+            {
+                return length;
+            }
+            position += RECORD_PREFIX_SIZE + read_prefix(data + position);
+        }
+        return position;
+    }
+
+    // The boundary is right after the first delimiter that ends at or after the target
+    const char delimiter = format == RECORD_NUL ? '\0' : '\n';
+    const char *end = memchr(data + target - 1, delimiter, length - (target - 1));
+    return end != NULL ? (size_t)(end - data) + 1 : length;
+}
+
+void writer_init(output_writer *writer, FILE *file)
+{
+    writer->file = file;
+    writer->length = 0;
+    writer->buffer = malloc(OUTPUT_BUFFER_SIZE);
+    if (writer->buffer == NULL)
+    {
+        fprintf(stderr, "Error: Out of memory while writing the output.\n");
+        exit(EXIT_FAILURE);
+    }
+}
+
+void writer_flush(output_writer *writer)
+{
+    if (writer->length > 0)
+    {
+        fwrite(writer->buffer, 1, writer->length, writer->file);
+        writer->length = 0;
+    }
+}
+
+void writer_write(output_writer *writer, const char *bytes, size_t count)
+{
+    if (count == 0)
+    {
+        return;
+    }
+    if (count > OUTPUT_BUFFER_SIZE - writer->length)
+    {
+        writer_flush(writer);
+        // Blocks larger than the buffer are written directly
+        if (count > OUTPUT_BUFFER_SIZE)
+        {
+            fwrite(bytes, 1, count, writer->file);
+            return;
+        }
+    }
+    memcpy(writer->buffer + writer->length, bytes, count);
+    writer->length += count;
+}
+
+void writer_close(output_writer *writer)
+{
+    writer_flush(writer);
+    fflush(writer->file);
+    free(writer->buffer);
+    writer->buffer = NULL;
+}
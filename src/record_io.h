@@ -0,0 +1,167 @@
+#ifndef RECORD_IO_H
+#define RECORD_IO_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+
+/* Size of the buffer of an output_writer */
+#define OUTPUT_BUFFER_SIZE (1 << 18)
+
+/**
+ * @brief How the records of an input are delimited.
+ */
+enum Record_Format
+{
+    /* Records end at '\n'. Like fgets in the -t mode, the record itself ends at its first '\r' */
+    RECORD_NEWLINE,
+    /* Records end at a NUL byte */
+    RECORD_NUL,
+    /* Every record is preceded by its length, as a 4-byte little-endian unsigned integer */
+    RECORD_LENGTH_PREFIX,
+};
+typedef enum Record_Format record_format;
+
+/**
+ * @brief Struct to represent a whole input held in memory, either mapped from a file or read into
+ * a buffer when the input cannot be mapped (pipes, empty files, platforms without mmap).
+ */
+struct mapped_input
+{
+    /* The bytes of the input */
+    const char *data;
+    /* Number of bytes of the input */
+    size_t length;
+    /* True if data is a memory mapping, false if it is a heap buffer */
+    bool mapped;
+};
+typedef struct mapped_input mapped_input;
+
+/**
+ * @brief Struct to represent a cursor over the records of an input. Records are returned in
+ * place, as pointers into the input, so splitting never copies them.
+ */
+struct record_reader
+{
+    /* The bytes being split */
+    const char *data;
+    /* Number of bytes being split */
+    size_t length;
+    /* Offset of the next record */
+    size_t position;
+    /* How the records are delimited */
+    record_format format;
+    /* Set to true when a length prefix points past the end of the input */
+    bool malformed;
+};
+typedef struct record_reader record_reader;
+
+/**
+ * @brief Struct to represent a buffered writer, so results are written in large blocks instead
+ * of one call to stdio per record.
+ */
+struct output_writer
+{
+    /* Destination of the output */
+    FILE *file;
+    /* Buffer of OUTPUT_BUFFER_SIZE bytes */
+    char *buffer;
+    /* Number of bytes in the buffer */
+    size_t length;
+};
+typedef struct output_writer output_writer;
+
+/**
+ * @brief Parse the name of a record format, as given on the command line.
+ * @param name "line", "nul" or "len"
+ * @param format Pointer where the format is stored
+ * @return true if the name is known, false otherwise
+ */
+bool parse_record_format(const char *name, record_format *format);
+
+/**
+ * @brief Load a whole input into memory. Regular files are mapped read-only, so no byte is copied.
+ * @param file_path Path of the input, or NULL to read the rest of stdin
+ * @param input Pointer to the input to fill
+ * @return true if the input was loaded, false otherwise
+ */
+bool map_input(const char *file_path, mapped_input *input);
+
+/**
+ * @brief Release an input loaded by map_input.
+ * @param input Pointer to the input
+ */
+void unmap_input(mapped_input *input);
+
+/**
+ * @brief Start splitting a block of bytes into records. The block must start at a record boundary.
+ * @param reader Pointer to the reader to initialize
+ * @param data The bytes to split
+ * @param length Number of bytes to split
+ * @param format How the records are delimited
+ */
+void record_reader_init(record_reader *reader, const char *data, size_t length, record_format format);
+
+/**
+ * @brief Get the next record. A delimiter at the very end of the input does not start another
+ * record, so an input of n newline-terminated lines has n records.
+ * @param reader Pointer to the reader
+ * @param record Pointer where the start of the record is stored
+ * @param record_length Pointer where the length of the record is stored
+ * @return true if a record was found, false at the end of the input or if it is malformed
+ */
+bool next_record(record_reader *reader, const char **record, size_t *record_length);
+
+/**
+ * @brief Find the first record boundary at least `min_length` bytes after `from`.
+ * @param data The bytes of the input
+ * @param length Number of bytes of the input
+ * @param format How the records are delimited
+ * @param from A record boundary
+ * @param min_length Minimum number of bytes between `from` and the boundary
+ * @return The offset of the boundary, or `length` if no record starts after it
+ */
+size_t record_boundary(const char *data, size_t length, record_format format, size_t from, size_t min_length);
+
+/**
+ * @brief Start writing buffered output.
+ * @param writer Pointer to the writer to initialize
+ * @param file Destination of the output
+ */
+void writer_init(output_writer *writer, FILE *file);
+
+/**
+ * @brief Write a block of bytes.
+ * @param writer Pointer to the writer
+ * @param bytes The bytes to write
+ * @param count Number of bytes to write
+ */
+void writer_write(output_writer *writer, const char *bytes, size_t count);
+
+/**
+ * @brief Write the bytes in the buffer to the destination.
+ * @param writer Pointer to the writer
+ */
+void writer_flush(output_writer *writer);
+
+/**
+ * @brief Write a single byte.
+ * @param writer Pointer to the writer
+ * @param byte The byte to write
+ */
+static inline void writer_put(output_writer *writer, char byte)
+{
+    if (writer->length == OUTPUT_BUFFER_SIZE)
+    {
+        writer_flush(writer);
+    }
+    writer->buffer[writer->length++] = byte;
+}
+
+/**
+ * @brief Write everything buffered so far and release the buffer.
+ * @param writer Pointer to the writer
+ */
+void writer_close(output_writer *writer);
+
+#endif // RECORD_IO_H
@@ -1,55 +1,330 @@
 #include "regex.h"
+#include "regex_ast.h"
+#include "utf8.h"
 #include <string.h>
 #include <stdlib.h>
+#include <stdio.h>
 
-item *itemize_regex(const char *regex_str, int *out_size);
-item *shunting_yard(const item *items, int size, int *out_size);
-item *implicit_to_explicit_concatenation(const item *items, int size, int *out_size);
+item *itemize_regex(const char *regex_str, arena *memory, int *out_size);
+item *shunting_yard(const item *items, int size, arena *memory, int *out_size, int *group_count);
 item new_item(char value, item_type type);
+item new_class_item(const byte_set *set);
 item_type get_item_type(char c);
 
-regex parse_regex(const char *regex_str)
+/**
+ * @brief Function to run the parsing steps shared by parse_regex and parse_regex_with_groups.
+ * @param regex_str The input regular expression as a string
+ * @param group_count Output for the number of capture groups, or NULL to drop the groups
+ * @return A regex struct containing the size of the postfix items and the array of postfix items
+ */
+static regex parse(const char *regex_str, int *group_count)
 {
+    // Every intermediate array lives in one arena, sized from the pattern, and dies with it
+    size_t length = strlen(regex_str);
+    arena memory = new_arena(length * 4 * sizeof(item));
+
     // First, we itemize the regex string into an array of items
     int size;
-    item *items = itemize_regex(regex_str, &size);
-    // Next, we convert implicit concatenation to explicit concatenation
-    int explicit_size;
-    item *explicit_items = implicit_to_explicit_concatenation(items, size, &explicit_size);
-    // We can free the original items array as we no longer need it
-    free(items);
-    // Finally, we convert the infix notation to postfix notation using the shunting yard algorithm
+    item *items = itemize_regex(regex_str, &memory, &size);
+    // Next, we convert the infix notation to postfix notation using the shunting yard algorithm,
+    // which also makes the implicit concatenations explicit
     int postfix_size = 0;
-    item *postfix_items = shunting_yard(explicit_items, explicit_size, &postfix_size);
-    // We can free the explicit items array as we no longer need it
-    free(explicit_items);
+    item *postfix_items = shunting_yard(items, size, &memory, &postfix_size, group_count);
 
-    regex result;
-    result.size = postfix_size;
-    result.items = postfix_items;
+    regex postfix;
+    postfix.size = postfix_size;
+    postfix.items = postfix_items;
 
+    // Last, we rewrite the expression into a simpler one before any automaton is built from it.
+    // Only this final postfix is allocated outside the arena
+    regex result = simplify_regex(postfix, &memory);
+    free_arena(&memory);
     return result;
 }
 
+regex parse_regex(const char *regex_str)
+{
+    return parse(regex_str, NULL);
+}
+
+regex parse_regex_with_groups(const char *regex_str, int *group_count)
+{
+    // Mismatched parentheses leave the count untouched
+    *group_count = 0;
+    return parse(regex_str, group_count);
+}
+
+/**
+ * @brief Struct to represent a growable list of items.
+ */
+struct item_list
+{
+    item *items;
+    int size;
+    int capacity;
+    /* Arena the items are allocated from */
+    arena *memory;
+};
+typedef struct item_list item_list;
+
+/**
+ * @brief Function to add an item at the end of a list, growing it when it is full.
+ * @param list Pointer to the list
+ * @param value The item to add
+ */
+static void push_item(item_list *list, item value)
+{
+    if (list->size == list->capacity)
+    {
+        int capacity = list->capacity == 0 ? 64 : list->capacity * 2;
+        list->items = arena_grow(list->memory, list->items, (size_t)list->size * sizeof(item),
+                                 (size_t)capacity * sizeof(item));
+        list->capacity = capacity;
+    }
+    list->items[list->size++] = value;
+}
+
+/**
+ * @brief Function to add the items that match one of a set of code points or raw bytes. ASCII
+ * code points and raw bytes take a single operand. Other code points are split into the byte
+ * sequences of their UTF-8 encodings, added as an alternation of concatenations inside a pair
+ * of parentheses that do not capture, so the whole set still acts as one operand.
+ * @param list Pointer to the list
+ * @param code_points The code points
+ * @param raw The raw bytes
+ */
+static void push_code_points(item_list *list, const code_point_set *code_points, const byte_set *raw)
+{
+    byte_set single = *raw;
+    code_point_set wide = utf8_new_set();
+    for (size_t i = 0; i < code_points->count; i++)
+    {
+        code_point_range range = code_points->ranges[i];
+        if (range.first < 0x80)
+        {
+            byte_set_add_range(&single, (unsigned char)range.first, (unsigned char)(range.last < 0x80 ? range.last : 0x7F));
+        }
+        if (range.last >= 0x80)
+        {
+            utf8_add_range(&wide, range.first < 0x80 ? 0x80 : range.first, range.last);
+        }
+    }
+    size_t count;
+    utf8_sequence *sequences = utf8_set_sequences(&wide, &count);
+    utf8_free_set(&wide);
+
+    bool has_single = byte_set_count(&single) > 0;
+    if (count == 0)
+    {
+        // Also an empty class, which is an operand that no byte matches
+        push_item(list, new_class_item(&single));
+        free(sequences);
+        return;
+    }
+
+    item open = new_item(LEFT_PARENTHESIS_SYMBOL, L_PARENTHESIS);
+    open.group = -1;
+    push_item(list, open);
+    if (has_single)
+    {
+        push_item(list, new_class_item(&single));
+    }
+    for (size_t i = 0; i < count; i++)
+    {
+        if (has_single || i > 0)
+        {
+            push_item(list, new_item(ALTERNATION_SYMBOL, ALTERNATION));
+        }
+        for (int byte = 0; byte < sequences[i].length; byte++)
+        {
+            push_item(list, new_class_item(&sequences[i].bytes[byte]));
+        }
+    }
+    push_item(list, new_item(RIGHT_PARENTHESIS_SYMBOL, R_PARENTHESIS));
+    free(sequences);
+}
+
+/**
+ * @brief Function to read one character of the regex as a code point. Bytes that do not start
+ * valid UTF-8 are read as raw bytes.
+ * @param regex_str The input regular expression as a string
+ * @param length The length of the regex string
+ * @param i Pointer to the index of the character, moved past it
+ * @param code_point Output for the code point, or for the byte when it is raw
+ * @return true if the character is a raw byte, false if it is a code point
+ */
+static bool read_character(const char *regex_str, size_t length, size_t *i, uint32_t *code_point)
+{
+    size_t read = utf8_decode(regex_str + *i, length - *i, code_point);
+    if (read == 0)
+    {
+        *code_point = (unsigned char)regex_str[(*i)++];
+        return true;
+    }
+    *i += read;
+    return false;
+}
+
+/**
+ * @brief Function to read one member of a character class: a character, or an escaped character.
+ * @param regex_str The input regular expression as a string
+ * @param length The length of the regex string
+ * @param i Pointer to the index of the member, moved past it
+ * @param code_point Output for the code point of the member, or for the byte when it is raw
+ * @return true if the member is a raw byte, false if it is a code point
+ */
+static bool class_member(const char *regex_str, size_t length, size_t *i, uint32_t *code_point)
+{
+    if (regex_str[*i] == ESCAPE_SYMBOL && *i + 1 < length)
+    {
+        (*i)++;
+    }
+    return read_character(regex_str, length, i, code_point);
+}
+
+/**
+ * @brief Function to parse a character class such as [a-z_], [^0-9], []-] or [α-ω]. A right
+ * bracket right after the left bracket (or after the negation symbol) and a range symbol at
+ * either end of the class are literal, and a backslash escapes the next character as in the
+ * rest of the regex. Members are code points, and a negated class matches any code point that
+ * is not a member. Bytes of the regex that are not valid UTF-8 are raw bytes: they are members
+ * of a class as they are, and a negated class leaves them out.
+ * @param regex_str The input regular expression as a string
+ * @param length The length of the regex string
+ * @param i Pointer to the index of the left bracket, moved to the right bracket
+ * @param list Pointer to the list the items of the class are added to
+ */
+static void parse_class(const char *regex_str, size_t length, size_t *i, item_list *list)
+{
+    size_t start = *i;
+    size_t position = start + 1;
+    bool negated = position < length && regex_str[position] == NEGATION_SYMBOL;
+    if (negated)
+    {
+        position++;
+    }
+
+    code_point_set code_points = utf8_new_set();
+    byte_set raw = empty_byte_set();
+    size_t first_member = position;
+    while (position < length && (regex_str[position] != RIGHT_BRACKET_SYMBOL || position == first_member))
+    {
+        uint32_t first;
+        if (class_member(regex_str, length, &position, &first))
+        {
+            byte_set_add(&raw, (unsigned char)first);
+            continue;
+        }
+
+        uint32_t last = first;
+        if (position + 1 < length && regex_str[position] == RANGE_SYMBOL &&
+            regex_str[position + 1] != RIGHT_BRACKET_SYMBOL)
+        {
+            position++;
+            if (class_member(regex_str, length, &position, &last) || last < first)
+            {
+                fprintf(stderr, "Error: Invalid regex. Range in the class at %zu is out of order.\n", start);
+                exit(EXIT_FAILURE);
+            }
+        }
+        utf8_add_range(&code_points, first, last);
+    }
+
+    if (position >= length)
+    {
+        fprintf(stderr, "Error: Invalid regex. Character class at %zu is not closed.\n", start);
+        exit(EXIT_FAILURE);
+    }
+    *i = position;
+
+    utf8_normalize_set(&code_points);
+    if (negated)
+    {
+        utf8_complement_set(&code_points);
+        raw = empty_byte_set();
+    }
+    push_code_points(list, &code_points, &raw);
+    utf8_free_set(&code_points);
+}
+
+/**
+ * @brief Function to read the decimal bound of a repetition.
+ * @param regex_str The input regular expression as a string
+ * @param length The length of the regex string
+ * @param i Pointer to the index of the first digit, moved past the digits
+ * @return The bound, or -1 if there are no digits
+ */
+static int repetition_bound(const char *regex_str, size_t length, size_t *i)
+{
+    int bound = -1;
+    while (*i < length && regex_str[*i] >= '0' && regex_str[*i] <= '9')
+    {
+        int digit = regex_str[(*i)++] - '0';
+        bound = bound == -1 ? digit : bound * 10 + digit;
+        if (bound > REPETITION_MAX)
+        {
+            fprintf(stderr, "Error: Invalid regex. Repetitions can not go over %d copies.\n", REPETITION_MAX);
+            exit(EXIT_FAILURE);
+        }
+    }
+    return bound;
+}
+
+/**
+ * @brief Function to parse a repetition such as {3}, {2,} or {1,5}.
+ * @param regex_str The input regular expression as a string
+ * @param length The length of the regex string
+ * @param i Pointer to the index of the left brace. When the repetition is valid, it is moved to
+ * the right brace
+ * @param result Output for the REPETITION item
+ * @return true if a valid repetition starts at the left brace, false if the brace is a literal
+ */
+static bool parse_repetition(const char *regex_str, size_t length, size_t *i, item *result)
+{
+    size_t position = *i + 1;
+    int min = repetition_bound(regex_str, length, &position);
+    int max = min;
+    if (min == -1)
+    {
+        return false;
+    }
+    if (position < length && regex_str[position] == BOUNDS_SEPARATOR_SYMBOL)
+    {
+        position++;
+        max = repetition_bound(regex_str, length, &position);
+    }
+    if (position >= length || regex_str[position] != RIGHT_BRACE_SYMBOL)
+    {
+        return false;
+    }
+    if (max != -1 && max < min)
+    {
+        fprintf(stderr, "Error: Invalid regex. Repetition {%d,%d} is out of order.\n", min, max);
+        exit(EXIT_FAILURE);
+    }
+
+    *result = new_item(LEFT_BRACE_SYMBOL, REPETITION);
+    result->min = min;
+    result->max = max;
+    *i = position;
+    return true;
+}
+
 /**
  * @brief Function to convert a regex string into an array of items.
  * This function iterates through the input regex string, creates items
  * for each character, and determines if they are operators or not.
  *
  * @param regex_str The input regular expression as a string
+ * @param memory Pointer to the arena the items are allocated from
  * @param out_size A pointer to an integer where the size of the output array will be stored
  * @return An array of items representing the regex
  */
-item *itemize_regex(const char *regex_str, int *out_size)
+item *itemize_regex(const char *regex_str, arena *memory, int *out_size)
 {
-    // Get an approximation of the number of items
-    // in the regex by counting the characters
-    int length = strlen(regex_str);
-
-    // Create a temporary array to hold the items
-    item temp_items[length];
-
-    *out_size = 0;
+    size_t length = strlen(regex_str);
+    item_list list = {NULL, 0, 0, memory};
+    byte_set no_raw = empty_byte_set();
 
     // Iterate through the regex string and create items
     for (size_t i = 0; i < length; i++)
@@ -58,89 +333,177 @@ item *itemize_regex(const char *regex_str, int *out_size)
         {
             // If we encounter an escape symbol, we need to skip
             // it and take the next character as a literal
-            temp_items[(*out_size)++] = new_item(regex_str[++i], OPERAND);
+            i++;
         }
-        else
+        else if (regex_str[i] == LEFT_BRACKET_SYMBOL)
+        {
+            // A whole class acts as a single operand
+            parse_class(regex_str, length, &i, &list);
+            continue;
+        }
+        else if (regex_str[i] == LEFT_BRACE_SYMBOL)
+        {
+            item repetition;
+            if (parse_repetition(regex_str, length, &i, &repetition))
+            {
+                push_item(&list, repetition);
+                continue;
+            }
+        }
+        else if (regex_str[i] == WILDCARD_SYMBOL)
+        {
+            // Any code point except a newline
+            code_point_set code_points = utf8_new_set();
+            utf8_add_range(&code_points, 0, '\n' - 1);
+            utf8_add_range(&code_points, '\n' + 1, UTF8_MAX_CODE_POINT);
+            push_code_points(&list, &code_points, &no_raw);
+            utf8_free_set(&code_points);
+            continue;
+        }
+        else if (get_item_type(regex_str[i]) != OPERAND)
         {
             // For other characters, we check if they are operators or not
-            temp_items[(*out_size)++] = new_item(regex_str[i], get_item_type(regex_str[i]));
+            push_item(&list, new_item(regex_str[i], get_item_type(regex_str[i])));
+            continue;
+        }
+
+        // A literal character. Characters outside ASCII are one operand for all their bytes
+        uint32_t code_point;
+        size_t next = i;
+        if (read_character(regex_str, length, &next, &code_point) || code_point < 0x80)
+        {
+            push_item(&list, new_item(regex_str[i], OPERAND));
+        }
+        else
+        {
+            code_point_set code_points = utf8_new_set();
+            utf8_add_range(&code_points, code_point, code_point);
+            push_code_points(&list, &code_points, &no_raw);
+            utf8_free_set(&code_points);
         }
+        i = next - 1;
     }
 
-    // Allocate memory for the items array in the regex struct
-    item *items = malloc(*out_size * sizeof(item));
+    *out_size = list.size;
+    return list.items;
+}
 
-    // Copy items from the temporary array to the allocated array
-    for (int i = 0; i < *out_size; i++)
+/**
+ * @brief Function to check if two adjacent items are implicitly concatenated. For example, in
+ * "ab" and "a(b)" the operand is followed by the start of another operand.
+ * @param previous The first item
+ * @param next The item right after it
+ * @return true if a concatenation operator goes between them
+ */
+static bool implicit_concatenation(const item *previous, const item *next)
+{
+    return (previous->type == OPERAND || previous->type == R_PARENTHESIS || previous->type == KLEENE_STAR ||
+            previous->type == POSITIVE_CLOSURE || previous->type == OPTIONAL || previous->type == REPETITION) &&
+           (next->type == OPERAND || next->type == L_PARENTHESIS);
+}
+
+/**
+ * @brief Function to push a binary operator onto the operator stack, after popping to the
+ * output the operators with higher or equal precedence that are not left parentheses.
+ * @param operators The operator stack
+ * @param operators_top Pointer to the top of the operator stack
+ * @param output The output items
+ * @param output_top Pointer to the last output item
+ * @param operator The binary operator
+ */
+static void push_binary_operator(item *operators, int *operators_top, item *output, int *output_top, item operator)
+{
+    while (*operators_top != -1 &&
+           operators[*operators_top].type >= operator.type &&
+           operators[*operators_top].type != L_PARENTHESIS)
     {
-        items[i] = temp_items[i];
+        output[++(*output_top)] = operators[(*operators_top)--];
     }
-
-    return items;
+    operators[++(*operators_top)] = operator;
 }
 
 /**
  * @brief Function to convert an array of items from infix notation to postfix notation
  * using the Shunting Yard algorithm. This function handles operator precedence and
- * ensures that the output is in the correct order for further processing.
+ * ensures that the output is in the correct order for further processing. The implicit
+ * concatenations are made explicit on the way, so "ab" comes out as "ab.".
  *
  * @param items The input array of items in infix notation
  * @param size The number of items in the input array
+ * @param memory Pointer to the arena the output and the operator stack are allocated from
  * @param out_size Pointer to an int where the size of the output array will be stored
+ * @param group_count Pointer to an int where the number of capture groups will be stored, or NULL
+ * to leave the CAPTURE items out of the output
  * @return An array of items in postfix notation, or NULL if there are mismatched parentheses
  */
-item *shunting_yard(const item *items, int size, int *out_size)
+item *shunting_yard(const item *items, int size, arena *memory, int *out_size, int *group_count)
 {
-    // Shunting Yard algorithm initialization
-    item operators[size];
-    item output[size];
+    // Shunting Yard algorithm initialization. Up to one concatenation goes between each pair of
+    // items, and each right parenthesis adds at most one CAPTURE item in place of the pair of
+    // parentheses, so the output and the stack never hold more than twice the input.
+    const size_t capacity = (size_t)(size > 0 ? size : 1) * 2;
+    item *operators = arena_alloc(memory, capacity * sizeof(item));
+    item *output = arena_alloc(memory, capacity * sizeof(item));
     int operators_top = -1;
     int output_top = -1;
+    int groups = 0;
 
     // Iterate through the items and apply the shunting yard algorithm
-    for (size_t i = 0; i < size; i++)
+    for (int i = 0; i < size; i++)
     {
+        if (i > 0 && implicit_concatenation(&items[i - 1], &items[i]))
+        {
+            push_binary_operator(operators, &operators_top, output, &output_top,
+                                 new_item(CONCATENATION_SYMBOL, CONCATENATION));
+        }
+
         if (items[i].type == OPERAND)
         {
             // If the item is not an operator, add it to the output
             output[++output_top] = items[i];
         }
-        else
+        else if (items[i].type == R_PARENTHESIS)
         {
             // If the item is a right parenthesis, pop operators to the output
             // until we find a left parenthesis. If we don't find a left parenthesis,
             // it means there are mismatched parentheses.
-            if (items[i].type == R_PARENTHESIS)
+            while (operators_top != -1 && operators[operators_top].type != L_PARENTHESIS)
+            {
+                output[++output_top] = operators[operators_top--];
+            }
+            if (operators_top == -1)
             {
-                while (operators_top != -1 && operators[operators_top].type != L_PARENTHESIS)
-                {
-                    output[++output_top] = operators[operators_top--];
-                }
-                if (operators_top == -1)
-                {
-                    // Mismatched parentheses
-                    return NULL;
-                }
-                // Pop the left parenthesis from the stack
-                operators_top--;
+                // Mismatched parentheses
+                return NULL;
             }
-            else if (items[i].type == L_PARENTHESIS)
+            // Pop the left parenthesis from the stack, and close its group
+            if (group_count && operators[operators_top].group > 0)
             {
-                operators[++operators_top] = items[i];
+                item capture = new_item(RIGHT_PARENTHESIS_SYMBOL, CAPTURE);
+                capture.group = operators[operators_top].group;
+                output[++output_top] = capture;
             }
-            else
+            operators_top--;
+        }
+        else if (items[i].type == L_PARENTHESIS)
+        {
+            // Groups are numbered in the order of their left parentheses. The parentheses
+            // added around the bytes of a code point have a negative group and do not capture.
+            operators[++operators_top] = items[i];
+            if (items[i].group == 0)
             {
-                // If the item is an operator, pop operators from the stack to the output
-                // while they have higher or equal precedence and are not left parentheses
-                while (operators_top != -1 &&
-                       operators[operators_top].type >= items[i].type &&
-                       operators[operators_top].type != L_PARENTHESIS)
-                {
-                    output[++output_top] = operators[operators_top--];
-                }
-                operators[++operators_top] = items[i];
+                operators[operators_top].group = ++groups;
             }
         }
+        else if (items[i].type >= OPTIONAL && items[i].type <= REPETITION)
+        {
+            // A unary operator applies to the operand that was just completed in the output
+            output[++output_top] = items[i];
+        }
+        else
+        {
+            push_binary_operator(operators, &operators_top, output, &output_top, items[i]);
+        }
     }
 
     // After processing all items, pop any remaining operators from the stack to the output
@@ -154,61 +517,15 @@ item *shunting_yard(const item *items, int size, int *out_size)
         output[++output_top] = operators[operators_top--];
     }
 
-    // Clean up the output array to return only the valid items
-    item *result = malloc((output_top + 1) * sizeof(item));
-    for (int i = 0; i <= output_top; i++)
-    {
-        result[i] = output[i];
-    }
     if (out_size)
     {
         *out_size = output_top + 1;
     }
-    return result;
-}
-
-/**
- * @brief Function to convert implicit concatenation in the regex to explicit concatenation.
- * For example, "ab" will be converted to "a.b". This function iterates through the items
- * and inserts a concatenation operator where needed based on the types of adjacent items.
- *
- * @param items The input array of items with potential implicit concatenation
- * @param size The number of items in the input array
- * @param out_size A pointer to an integer where the size of the output array will be stored
- * @return An array of items with explicit concatenation operators, and the size of the output array
- */
-item *implicit_to_explicit_concatenation(const item *items, int size, int *out_size)
-{
-    // This function will convert implicit concatenation in the regex to explicit concatenation
-    // For example, "ab" will be converted to "a.b"
-
-    // We can have at most size * 2 items in the worst case (every item is an operand followed by a concatenation operator)
-    item temp_items[size * 2];
-    int temp_size = 0;
-
-    // Iterate through the items and insert concatenation operators where needed
-    for (size_t i = 0; i < size; i++)
-    {
-        temp_items[temp_size++] = items[i];
-
-        // Check if we need to insert a concatenation operator
-        if (i + 1 < size &&
-            ((items[i].type == OPERAND || items[i].type == R_PARENTHESIS || items[i].type == KLEENE_STAR || items[i].type == POSITIVE_CLOSURE || items[i].type == OPTIONAL) &&
-             (items[i + 1].type == OPERAND || items[i + 1].type == L_PARENTHESIS)))
-        {
-            temp_items[temp_size++] = new_item(CONCATENATION_SYMBOL, CONCATENATION);
-        }
-    }
-
-    // Allocate memory for the output array
-    item *result = malloc(temp_size * sizeof(item));
-    for (int i = 0; i < temp_size; i++)
+    if (group_count)
     {
-        result[i] = temp_items[i];
+        *group_count = groups;
     }
-
-    *out_size = temp_size;
-    return result;
+    return output;
 }
 
 /**
@@ -223,9 +540,40 @@ item new_item(char value, item_type type)
     item new_item;
     new_item.value = value;
     new_item.type = type;
+    new_item.group = 0;
+    new_item.bytes = empty_byte_set();
+    new_item.min = 0;
+    new_item.max = 0;
+    if (type == OPERAND)
+    {
+        byte_set_add(&new_item.bytes, (unsigned char)value);
+    }
     return new_item;
 }
 
+/**
+ * @brief Helper function to create an operand item that matches any byte of a set. When the set
+ * has a single byte the item is the same as a literal of that byte.
+ * @param set The bytes matched by the operand
+ * @return An operand item with the given bytes
+ */
+item new_class_item(const byte_set *set)
+{
+    item class_item = new_item(LEFT_BRACKET_SYMBOL, OPERAND);
+    class_item.bytes = *set;
+    if (byte_set_count(set) == 1)
+    {
+        for (int byte = 0; byte < 256; byte++)
+        {
+            if (byte_set_contains(set, (unsigned char)byte))
+            {
+                class_item.value = (char)byte;
+            }
+        }
+    }
+    return class_item;
+}
+
 /**
  * @brief Helper function to determine the type of an item based on its character value.
  *
@@ -240,8 +588,6 @@ item_type get_item_type(char c)
         return L_PARENTHESIS;
     case RIGHT_PARENTHESIS_SYMBOL:
         return R_PARENTHESIS;
-    case CONCATENATION_SYMBOL:
-        return CONCATENATION;
     case KLEENE_STAR_SYMBOL:
         return KLEENE_STAR;
     case POSITIVE_CLOSURE_SYMBOL:
@@ -1,8 +1,10 @@
 #ifndef REGEX_H
 #define REGEX_H
 
+#include "byte_classes.h"
+
 // Operators symbols
-/* Concatenation symbol. Ej. a.b for ab */
+/* Concatenation symbol of the postfix notation. Ej. ab. for ab. In a regex, `.` is the wildcard */
 #define CONCATENATION_SYMBOL '.'
 /* Kleene star symbol. Ej. a* for empty string, a, aa, aaa, etc. */
 #define KLEENE_STAR_SYMBOL '*'
@@ -12,6 +14,14 @@
 #define POSITIVE_CLOSURE_SYMBOL '+'
 /* Optional symbol. Ej. a? for empty string or a */
 #define OPTIONAL_SYMBOL '?'
+/* Repetition symbols. Ej. a{2} for aa, a{2,} for aa, aaa, etc., and a{1,3} for a, aa or aaa.
+A left brace that does not start a valid repetition is a literal */
+#define LEFT_BRACE_SYMBOL '{'
+#define RIGHT_BRACE_SYMBOL '}'
+/* Separator of the bounds of a repetition */
+#define BOUNDS_SEPARATOR_SYMBOL ','
+/* Largest bound of a repetition. Each copy of the operand up to the bound has its own states */
+#define REPETITION_MAX 1000
 
 // Hierarchy symbols
 /* Left parenthesis symbol. Ej. (a|b) for grouping */
@@ -20,16 +30,27 @@
 #define RIGHT_PARENTHESIS_SYMBOL ')'
 
 // Special symbols
-/** Epsilon symbol. Represents the empty string. Using 240 because it's not a common
- * character in regex and is outside the standard ASCII range */
-#define EPSILON_SYMBOL 240 
 /* Escape symbol. Used to escape special characters. Ej. \* for literal asterisk */
 #define ESCAPE_SYMBOL '\\'
+/* Wildcard symbol. Ej. a.c for a, any byte except a newline, and c */
+#define WILDCARD_SYMBOL '.'
+
+// Character class symbols
+/* Left bracket symbol. Ej. [abc] for a, b or c */
+#define LEFT_BRACKET_SYMBOL '['
+/* Right bracket symbol. Ej. []] for a literal right bracket, when it comes first */
+#define RIGHT_BRACKET_SYMBOL ']'
+/* Range symbol. Ej. [a-z] for a lowercase letter. Literal at the start or end of the class */
+#define RANGE_SYMBOL '-'
+/* Negation symbol. Ej. [^0-9] for any byte except a digit, when it comes first */
+#define NEGATION_SYMBOL '^'
 
 /**
  * @brief Enum to represent the different types of operators
  * in a regular expression. The values are assigned based on
  * their precedence, with lower values having higher precedence.
+ * The unary operators (OPTIONAL to REPETITION) bind tighter than
+ * any binary one and apply in the order they are written.
  */
 enum Item_Type
 {
@@ -38,9 +59,11 @@ enum Item_Type
     OPTIONAL,
     POSITIVE_CLOSURE,
     KLEENE_STAR,
+    REPETITION,
     OPERAND,
     L_PARENTHESIS,
     R_PARENTHESIS,
+    CAPTURE,
 };
 typedef enum Item_Type item_type;
 
@@ -51,10 +74,18 @@ typedef enum Item_Type item_type;
  */
 struct Item
 {
-    /** The character value of the item */
+    /** The character value of the item. For an operand that matches a single byte, the byte */
     char value;
     /** The type of the item, which can be an operator or an operand */
     item_type type;
+    /** Number of the capture group closed by a CAPTURE item, from 1, or 0 for other items */
+    int group;
+    /** Bytes matched by an OPERAND item: one for a literal, or the bytes of a class or wildcard */
+    byte_set bytes;
+    /** Least number of copies of the operand of a REPETITION item */
+    int min;
+    /** Largest number of copies of the operand of a REPETITION item, or -1 when unbounded */
+    int max;
 };
 typedef struct Item item;
 
@@ -73,14 +104,27 @@ typedef struct Regex regex;
 /**
  * @brief Function to parse a regular expression string and convert it into a regex struct.
  * This function performs several steps: it first itemizes the regex string into an array of items,
- * then it converts implicit concatenation to explicit concatenation, and finally it converts
- * the infix notation to postfix notation using the shunting yard algorithm.
+ * then it converts implicit concatenation to explicit concatenation, then it converts the infix
+ * notation to postfix notation using the shunting yard algorithm, and finally it simplifies the
+ * postfix through its syntax tree (see simplify_regex).
  *
  * @param regex_str The input regular expression as a string
  * @return A regex struct containing the size of the postfix items and the array of postfix items
  */
 regex parse_regex(const char *regex_str);
 
+/**
+ * @brief Function to parse a regular expression like parse_regex, but keeping the capture groups.
+ * Every pair of parentheses is a group, numbered from 1 in the order of their left parentheses,
+ * and a unary CAPTURE item with the group number is added to the postfix after the group's
+ * operand. Only the Pike VM understands CAPTURE items, so the automata are built from parse_regex.
+ *
+ * @param regex_str The input regular expression as a string
+ * @param group_count Output for the number of capture groups
+ * @return A regex struct containing the size of the postfix items and the array of postfix items
+ */
+regex parse_regex_with_groups(const char *regex_str, int *group_count);
+
 /*
  * @brief Helper function to create a new item with the given value and operator status.
  *
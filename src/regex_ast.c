@@ -0,0 +1,696 @@
+#include "regex_ast.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/**
+ * @brief Struct to represent a growable list of node indices.
+ */
+struct node_list
+{
+    int *items;
+    int size;
+    int capacity;
+    /* Arena the list is allocated from */
+    arena *memory;
+};
+typedef struct node_list node_list;
+
+/**
+ * @brief Add a node index at the end of a list, growing it when it is full.
+ */
+static void push_node(node_list *list, int node)
+{
+    if (list->size == list->capacity)
+    {
+        int capacity = list->capacity == 0 ? 8 : list->capacity * 2;
+        list->items = arena_grow(list->memory, list->items, (size_t)list->size * sizeof(int),
+                                 (size_t)capacity * sizeof(int));
+        list->capacity = capacity;
+    }
+    list->items[list->size++] = node;
+}
+
+/**
+ * @brief Create an empty list of node indices allocated from the arena of a tree.
+ */
+static node_list new_node_list(const regex_ast *ast)
+{
+    node_list list = {NULL, 0, 0, ast->memory};
+    return list;
+}
+
+/**
+ * @brief Work out whether a node is nullable and has captures, from its children.
+ * @param ast Pointer to the tree
+ * @param node The node
+ */
+static void update_node(regex_ast *ast, int node)
+{
+    regex_node *current = &ast->nodes[node];
+    const regex_node *left = current->left != -1 ? &ast->nodes[current->left] : NULL;
+    const regex_node *right = current->right != -1 ? &ast->nodes[current->right] : NULL;
+
+    switch (current->token.type)
+    {
+        case CONCATENATION:
+            current->nullable = left->nullable && right->nullable;
+            break;
+        case ALTERNATION:
+            current->nullable = left->nullable || right->nullable;
+            break;
+        case OPTIONAL:
+        case KLEENE_STAR:
+            current->nullable = true;
+            break;
+        case REPETITION:
+            current->nullable = current->token.min == 0 || left->nullable;
+            break;
+        case POSITIVE_CLOSURE:
+        case CAPTURE:
+            current->nullable = left->nullable;
+            break;
+        default:
+            current->nullable = false;
+            break;
+    }
+    current->captures = current->token.type == CAPTURE || (left != NULL && left->captures) ||
+                        (right != NULL && right->captures);
+}
+
+/**
+ * @brief Add a node at the end of a tree.
+ * @param ast Pointer to the tree
+ * @param token The item of the node
+ * @param left The left child, or -1
+ * @param right The right child, or -1
+ * @return The index of the node
+ */
+static int add_node(regex_ast *ast, item token, int left, int right)
+{
+    if (ast->size == ast->capacity)
+    {
+        int capacity = ast->capacity == 0 ? 16 : ast->capacity * 2;
+        ast->nodes = arena_grow(ast->memory, ast->nodes, (size_t)ast->size * sizeof(regex_node),
+                                (size_t)capacity * sizeof(regex_node));
+        ast->capacity = capacity;
+    }
+    regex_node *node = &ast->nodes[ast->size];
+    node->token = token;
+    node->left = left;
+    node->right = right;
+    node->simple = false;
+    update_node(ast, ast->size);
+    return ast->size++;
+}
+
+/**
+ * @brief Get the symbol a postfix regex writes for an operator.
+ */
+static char operator_symbol(item_type type)
+{
+    switch (type)
+    {
+        case ALTERNATION:
+            return ALTERNATION_SYMBOL;
+        case CONCATENATION:
+            return CONCATENATION_SYMBOL;
+        case OPTIONAL:
+            return OPTIONAL_SYMBOL;
+        case POSITIVE_CLOSURE:
+            return POSITIVE_CLOSURE_SYMBOL;
+        default:
+            return KLEENE_STAR_SYMBOL;
+    }
+}
+
+/**
+ * @brief Add a binary operator node over two nodes, or return the other one when one is -1.
+ */
+static int join_nodes(regex_ast *ast, item_type type, int left, int right)
+{
+    if (left == -1)
+    {
+        return right;
+    }
+    if (right == -1)
+    {
+        return left;
+    }
+    return add_node(ast, new_item(operator_symbol(type), type), left, right);
+}
+
+/**
+ * @brief Turn a unary node into another unary operator over the same operand.
+ */
+static void set_unary(regex_ast *ast, int node, item_type type)
+{
+    ast->nodes[node].token = new_item(operator_symbol(type), type);
+    update_node(ast, node);
+}
+
+/**
+ * @brief Compare two subtrees. The pairs of nodes still to compare are kept on a stack, so deep
+ * subtrees do not recurse.
+ * @return true if both subtrees are the same expression, written the same way
+ */
+static bool equal_subtrees(const regex_ast *ast, int a, int b)
+{
+    node_list pending = new_node_list(ast);
+    push_node(&pending, a);
+    push_node(&pending, b);
+
+    while (pending.size > 0)
+    {
+        const int y_index = pending.items[--pending.size];
+        const int x_index = pending.items[--pending.size];
+        if (x_index == -1 || y_index == -1)
+        {
+            if (x_index != y_index)
+            {
+                return false;
+            }
+            continue;
+        }
+
+        const regex_node *x = &ast->nodes[x_index];
+        const regex_node *y = &ast->nodes[y_index];
+        if (x->token.type != y->token.type || x->token.group != y->token.group || x->token.min != y->token.min ||
+            x->token.max != y->token.max || memcmp(&x->token.bytes, &y->token.bytes, sizeof(byte_set)) != 0)
+        {
+            return false;
+        }
+        push_node(&pending, x->left);
+        push_node(&pending, y->left);
+        push_node(&pending, x->right);
+        push_node(&pending, y->right);
+    }
+    return true;
+}
+
+/**
+ * @brief List the operands of a chain of the same binary operator, in order. Since the operators
+ * are associative, a(bc) and (ab)c both list a, b and c. Long literals make chains as long as the
+ * pattern, so the chain is walked with a stack instead of recursion.
+ * @param ast Pointer to the tree
+ * @param node The root of the chain
+ * @param type The operator of the chain
+ * @param list The list the operands are added to
+ */
+static void flatten_chain(const regex_ast *ast, int node, item_type type, node_list *list)
+{
+    node_list pending = new_node_list(ast);
+    push_node(&pending, node);
+    while (pending.size > 0)
+    {
+        const int current = pending.items[--pending.size];
+        if (ast->nodes[current].token.type != type)
+        {
+            push_node(list, current);
+            continue;
+        }
+        // The left operand is popped, and therefore listed, first
+        push_node(&pending, ast->nodes[current].right);
+        push_node(&pending, ast->nodes[current].left);
+    }
+}
+
+/**
+ * @brief Join a range of a list with a binary operator.
+ * @return The root of the chain, or -1 if the range is empty
+ */
+static int build_chain(regex_ast *ast, item_type type, const int *nodes, int count)
+{
+    int chain = -1;
+    for (int i = 0; i < count; i++)
+    {
+        chain = join_nodes(ast, type, chain, nodes[i]);
+    }
+    return chain;
+}
+
+/**
+ * @brief Schedule the simplification of a subtree. The pending subtrees are kept on a stack of
+ * triples, so nesting of any depth does not recurse.
+ * @param pending The stack of pending subtrees
+ * @param node The root of the subtree, or -1 - node to finish a node whose children are done
+ * @param parent The node whose child the subtree is, or -1 for the root
+ * @param right Whether the subtree is the right child of the parent
+ */
+static void push_task(node_list *pending, int node, int parent, bool right)
+{
+    push_node(pending, node);
+    push_node(pending, parent);
+    push_node(pending, right);
+}
+
+/**
+ * @brief Simplify a unary node whose operand is already simple.
+ * @return The node that replaces it
+ */
+static int simplify_unary(regex_ast *ast, int node)
+{
+    const int left = ast->nodes[node].left;
+    item token = ast->nodes[node].token;
+
+    if (token.type == REPETITION)
+    {
+        if (token.min == 1 && token.max == 1)
+        {
+            return left;
+        }
+        if (token.min <= 1 && (token.max == 1 || token.max == -1))
+        {
+            // {0,1} is ?, {0,} is * and {1,} is +
+            token.type = token.max == 1 ? OPTIONAL : (token.min == 0 ? KLEENE_STAR : POSITIVE_CLOSURE);
+            set_unary(ast, node, token.type);
+        }
+        else
+        {
+            update_node(ast, node);
+            return node;
+        }
+    }
+
+    if (token.type == OPTIONAL && ast->nodes[left].nullable)
+    {
+        // x? only adds the empty string, which x already matches, and x tries it first anyway
+        return left;
+    }
+
+    const item_type inner = ast->nodes[left].token.type;
+    if ((token.type == OPTIONAL || token.type == POSITIVE_CLOSURE || token.type == KLEENE_STAR) &&
+        (inner == OPTIONAL || inner == POSITIVE_CLOSURE || inner == KLEENE_STAR) && !ast->nodes[left].captures)
+    {
+        // Two closures of the same operand are one closure: only x+ under + stays +, only x? under ?
+        // stays ?, and every other pair can repeat x any number of times, none included
+        item_type combined = KLEENE_STAR;
+        if (token.type == inner && token.type != KLEENE_STAR)
+        {
+            combined = token.type;
+        }
+        set_unary(ast, left, combined);
+        return left;
+    }
+
+    update_node(ast, node);
+    return node;
+}
+
+/**
+ * @brief Simplify an alternation node whose alternatives are already simple. The repeated ones
+ * are dropped, common prefixes are factored out and neighbouring single-byte operands are merged.
+ * @param ast Pointer to the tree
+ * @param node The alternation node
+ * @param pending The stack of pending subtrees, where the alternatives left after a common prefix
+ * are scheduled, since they are built from new nodes
+ * @return The node that replaces it
+ */
+static int simplify_alternation(regex_ast *ast, int node, node_list *pending)
+{
+    node_list alternatives = new_node_list(ast);
+    flatten_chain(ast, node, ALTERNATION, &alternatives);
+
+    // Drop the alternatives that repeat the previous one. The second copy never matches
+    // where the first one does not, and gives the same captures when there are none
+    node_list kept = new_node_list(ast);
+    for (int i = 0; i < alternatives.size; i++)
+    {
+        int alternative = alternatives.items[i];
+        if (kept.size > 0 && !ast->nodes[alternative].captures &&
+            equal_subtrees(ast, kept.items[kept.size - 1], alternative))
+        {
+            continue;
+        }
+        push_node(&kept, alternative);
+    }
+
+    // Factor out the first factor shared by neighbouring alternatives: ab|ac|a is a(b|c)?. An
+    // alternative that is only the factor ends the run, so the empty string is tried last
+    node_list factored = new_node_list(ast);
+    node_list factors = new_node_list(ast);
+    node_list other = new_node_list(ast);
+    for (int i = 0; i < kept.size;)
+    {
+        factors.size = 0;
+        flatten_chain(ast, kept.items[i], CONCATENATION, &factors);
+        const int prefix = factors.items[0];
+        int end = i + 1;
+        bool empty_rest = false;
+        if (factors.size > 1 && !ast->nodes[prefix].captures)
+        {
+            while (end < kept.size && !empty_rest)
+            {
+                other.size = 0;
+                flatten_chain(ast, kept.items[end], CONCATENATION, &other);
+                if (!equal_subtrees(ast, other.items[0], prefix))
+                {
+                    break;
+                }
+                empty_rest = other.size == 1;
+                end++;
+            }
+        }
+
+        if (end - i < 2)
+        {
+            push_node(&factored, kept.items[i]);
+            i++;
+            continue;
+        }
+
+        // Take out every factor the run shares at once, so that a long shared literal is not
+        // factored one byte at a time. Only the last alternative may be left with nothing
+        int shared = factors.size - 1;
+        for (int j = i + 1; j < end; j++)
+        {
+            other.size = 0;
+            flatten_chain(ast, kept.items[j], CONCATENATION, &other);
+            const int limit = j == end - 1 ? other.size : other.size - 1;
+            int common = 1;
+            while (common < shared && common < limit && !ast->nodes[factors.items[common]].captures &&
+                   equal_subtrees(ast, factors.items[common], other.items[common]))
+            {
+                common++;
+            }
+            shared = common;
+        }
+
+        int rest = -1;
+        for (int j = i; j < end; j++)
+        {
+            other.size = 0;
+            flatten_chain(ast, kept.items[j], CONCATENATION, &other);
+            int remainder = build_chain(ast, CONCATENATION, other.items + shared, other.size - shared);
+            empty_rest = remainder == -1;
+            rest = join_nodes(ast, ALTERNATION, rest, remainder);
+        }
+        if (empty_rest)
+        {
+            rest = add_node(ast, new_item(OPTIONAL_SYMBOL, OPTIONAL), rest, -1);
+        }
+        const int joined = add_node(ast, new_item(CONCATENATION_SYMBOL, CONCATENATION),
+                                    build_chain(ast, CONCATENATION, factors.items, shared), rest);
+        push_node(&factored, joined);
+        // The rest is built from new nodes, so it is simplified again
+        push_task(pending, rest, joined, true);
+        i = end;
+    }
+
+    // Merge neighbouring single-byte operands into one class: a|b|c is [abc]. Each matches one
+    // byte and has no captures, so the order between them does not matter
+    int merged = 0;
+    for (int i = 0; i < factored.size; i++)
+    {
+        const int current = factored.items[i];
+        const int previous = merged > 0 ? factored.items[merged - 1] : -1;
+        if (previous != -1 && ast->nodes[previous].token.type == OPERAND && ast->nodes[current].token.type == OPERAND)
+        {
+            item *token = &ast->nodes[previous].token;
+            for (int word = 0; word < 4; word++)
+            {
+                token->bytes.bits[word] |= ast->nodes[current].token.bytes.bits[word];
+            }
+            if (byte_set_count(&token->bytes) > 1)
+            {
+                token->value = LEFT_BRACKET_SYMBOL;
+            }
+            continue;
+        }
+        factored.items[merged++] = current;
+    }
+
+    return build_chain(ast, ALTERNATION, factored.items, merged);
+}
+
+/**
+ * @brief Schedule the children of a node, or the operands of the chain of binary operators it
+ * starts, before the node itself is finished.
+ * @param ast Pointer to the tree
+ * @param node The node
+ * @param pending The stack of pending subtrees
+ */
+static void expand_node(regex_ast *ast, int node, node_list *pending)
+{
+    const item_type type = ast->nodes[node].token.type;
+    if (type != CONCATENATION && type != ALTERNATION)
+    {
+        push_task(pending, ast->nodes[node].left, node, false);
+        return;
+    }
+
+    // A long literal or a long list of alternatives is a long chain, which is walked here rather
+    // than one level at a time. The operands are simplified where they are in the chain
+    node_list chain = new_node_list(ast);
+    push_node(&chain, node);
+    for (int i = 0; i < chain.size; i++)
+    {
+        const int current = chain.items[i];
+        const int children[2] = {ast->nodes[current].left, ast->nodes[current].right};
+        for (int side = 0; side < 2; side++)
+        {
+            if (ast->nodes[children[side]].token.type == type && !ast->nodes[children[side]].simple)
+            {
+                push_node(&chain, children[side]);
+            }
+            else
+            {
+                push_task(pending, children[side], current, side == 1);
+            }
+        }
+    }
+}
+
+/**
+ * @brief Finish a chain of concatenations whose operands are already simple. Its nodes are kept
+ * rather than rebuilt, and are updated from the bottom up.
+ * @param ast Pointer to the tree
+ * @param node The root of the chain
+ */
+static void simplify_concatenation(regex_ast *ast, int node)
+{
+    node_list chain = new_node_list(ast);
+    push_node(&chain, node);
+    for (int i = 0; i < chain.size; i++)
+    {
+        const int current = chain.items[i];
+        if (ast->nodes[ast->nodes[current].left].token.type == CONCATENATION &&
+            !ast->nodes[ast->nodes[current].left].simple)
+        {
+            push_node(&chain, ast->nodes[current].left);
+        }
+        if (ast->nodes[ast->nodes[current].right].token.type == CONCATENATION &&
+            !ast->nodes[ast->nodes[current].right].simple)
+        {
+            push_node(&chain, ast->nodes[current].right);
+        }
+    }
+
+    // Every node of the chain comes after its parent, so children are updated first
+    for (int i = chain.size - 1; i >= 0; i--)
+    {
+        update_node(ast, chain.items[i]);
+    }
+}
+
+/**
+ * @brief Finish a node whose children are already simple.
+ * @param ast Pointer to the tree
+ * @param node The node
+ * @param pending The stack of pending subtrees, for the new subtrees the rewrites build
+ * @return The node that replaces it
+ */
+static int finish_node(regex_ast *ast, int node, node_list *pending)
+{
+    switch (ast->nodes[node].token.type)
+    {
+        case ALTERNATION:
+            return simplify_alternation(ast, node, pending);
+        case CONCATENATION:
+            simplify_concatenation(ast, node);
+            return node;
+        case CAPTURE:
+            // The group keeps its place; only what it captures is simplified
+            update_node(ast, node);
+            return node;
+        default:
+            return simplify_unary(ast, node);
+    }
+}
+
+/**
+ * @brief Simplify a subtree, children first. Subtrees already simplified are left as they are,
+ * since the rewrites that build new nodes from simplified ones simplify them again. The subtrees
+ * still to simplify are kept on a stack, so deeply nested groups and closures do not recurse.
+ * @param ast Pointer to the tree
+ * @param node The root of the subtree
+ * @return The root of the simplified subtree
+ */
+static int simplify_node(regex_ast *ast, int node)
+{
+    int root = node;
+    node_list pending = new_node_list(ast);
+    push_task(&pending, node, -1, false);
+    while (pending.size > 0)
+    {
+        const bool right = pending.items[--pending.size];
+        const int parent = pending.items[--pending.size];
+        const int current = pending.items[--pending.size];
+
+        int result = current;
+        if (current < 0)
+        {
+            result = finish_node(ast, -1 - current, &pending);
+        }
+        else if (!ast->nodes[current].simple && ast->nodes[current].token.type != OPERAND)
+        {
+            // The node is finished, and its place filled, once its children are done
+            push_task(&pending, -1 - current, parent, right);
+            expand_node(ast, current, &pending);
+            continue;
+        }
+        ast->nodes[result].simple = true;
+
+        if (parent == -1)
+        {
+            root = result;
+        }
+        else if (right)
+        {
+            ast->nodes[parent].right = result;
+        }
+        else
+        {
+            ast->nodes[parent].left = result;
+        }
+    }
+    return root;
+}
+
+bool build_regex_ast(const regex r, arena *memory, regex_ast *ast)
+{
+    ast->nodes = NULL;
+    ast->size = 0;
+    ast->capacity = 0;
+    ast->root = -1;
+    ast->memory = memory;
+
+    // One node per item, and room for the nodes the rewrites add
+    ast->capacity = r.size + r.size / 2 + 16;
+    ast->nodes = arena_alloc(memory, (size_t)ast->capacity * sizeof(regex_node));
+
+    // There can never be more subtrees on the stack than items in the regex
+    int *stack = arena_alloc(memory, (size_t)(r.size > 0 ? r.size : 1) * sizeof(int));
+    int stack_top = -1;
+
+    for (int i = 0; i < r.size; i++)
+    {
+        item current_item = r.items[i];
+        int left = -1;
+        int right = -1;
+
+        if (current_item.type == CONCATENATION || current_item.type == ALTERNATION)
+        {
+            if (stack_top < 1)
+            {
+                return false;
+            }
+            right = stack[stack_top--];
+            left = stack[stack_top--];
+        }
+        else if ((current_item.type >= OPTIONAL && current_item.type <= REPETITION) || current_item.type == CAPTURE)
+        {
+            if (stack_top < 0)
+            {
+                return false;
+            }
+            left = stack[stack_top--];
+        }
+        else if (current_item.type != OPERAND)
+        {
+            return false;
+        }
+        stack[++stack_top] = add_node(ast, current_item, left, right);
+    }
+
+    if (stack_top != 0)
+    {
+        return false;
+    }
+    ast->root = stack[0];
+    return true;
+}
+
+void simplify_regex_ast(regex_ast *ast)
+{
+    ast->root = simplify_node(ast, ast->root);
+}
+
+regex regex_ast_to_postfix(const regex_ast *ast)
+{
+    // Every node reachable from the root is written once, so the nodes bound the size
+    regex result;
+    result.size = 0;
+    result.items = malloc((size_t)(ast->size > 0 ? ast->size : 1) * sizeof(item));
+    if (result.items == NULL)
+    {
+        fprintf(stderr, "Error: Out of memory while simplifying the regex.\n");
+        exit(EXIT_FAILURE);
+    }
+
+    // Postfix order with a stack: a node is pushed once to visit its children, and once more,
+    // as -1 - node, to be written after them
+    node_list pending = new_node_list(ast);
+    push_node(&pending, ast->root);
+    while (pending.size > 0)
+    {
+        const int node = pending.items[--pending.size];
+        if (node < 0)
+        {
+            result.items[result.size++] = ast->nodes[-1 - node].token;
+            continue;
+        }
+        push_node(&pending, -1 - node);
+        if (ast->nodes[node].right != -1)
+        {
+            push_node(&pending, ast->nodes[node].right);
+        }
+        if (ast->nodes[node].left != -1)
+        {
+            push_node(&pending, ast->nodes[node].left);
+        }
+    }
+
+    // The replaced nodes were counted too, so give the unused items back
+    item *items = realloc(result.items, (size_t)(result.size > 0 ? result.size : 1) * sizeof(item));
+    if (items != NULL)
+    {
+        result.items = items;
+    }
+    return result;
+}
+
+regex simplify_regex(const regex r, arena *memory)
+{
+    regex_ast ast;
+    if (build_regex_ast(r, memory, &ast))
+    {
+        simplify_regex_ast(&ast);
+        return regex_ast_to_postfix(&ast);
+    }
+
+    // Left for the automaton builders to report
+    regex copy;
+    copy.size = r.size;
+    copy.items = malloc((size_t)(r.size > 0 ? r.size : 1) * sizeof(item));
+    if (copy.items == NULL)
+    {
+        fprintf(stderr, "Error: Out of memory while simplifying the regex.\n");
+        exit(EXIT_FAILURE);
+    }
+    if (r.size > 0)
+    {
+        memcpy(copy.items, r.items, (size_t)r.size * sizeof(item));
+    }
+    return copy;
+}
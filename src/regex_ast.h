@@ -0,0 +1,85 @@
+#ifndef REGEX_AST_H
+#define REGEX_AST_H
+
+#include "arena.h"
+#include "regex.h"
+#include <stdbool.h>
+
+/**
+ * @brief Struct to represent a node of the syntax tree of a regex. The nodes live in a single
+ * array and refer to each other by index.
+ */
+struct regex_node
+{
+    /* The item of the node. Operators keep their type and bounds, operands their bytes */
+    item token;
+    /* Operand of the unary operators, or left operand of the binary ones, or -1 */
+    int left;
+    /* Right operand of the binary operators, or -1 */
+    int right;
+    /* Whether the subtree accepts the empty string */
+    bool nullable;
+    /* Whether the subtree has a CAPTURE node */
+    bool captures;
+    /* Whether the subtree is already simplified */
+    bool simple;
+};
+typedef struct regex_node regex_node;
+
+/**
+ * @brief Struct to represent the syntax tree of a regex.
+ */
+struct regex_ast
+{
+    /* The nodes. Rewrites add nodes at the end and leave the replaced ones unused */
+    regex_node *nodes;
+    /* Number of nodes */
+    int size;
+    /* Number of nodes that fit in the array */
+    int capacity;
+    /* Index of the root node */
+    int root;
+    /* Arena the nodes and the scratch lists of the rewrites are allocated from */
+    arena *memory;
+};
+typedef struct regex_ast regex_ast;
+
+/**
+ * @brief Build the syntax tree of a postfix regex.
+ * @param r The postfix regex
+ * @param memory Pointer to the arena the tree is allocated from. It owns the tree
+ * @param ast Output for the tree
+ * @return true on success, false if the postfix is not a single well-formed expression
+ */
+bool build_regex_ast(const regex r, arena *memory, regex_ast *ast);
+
+/**
+ * @brief Rewrite a syntax tree into a smaller one that matches the same strings and, for the
+ * Pike VM, gives the same captures. The passes are:
+ * - nested closures collapse, so (a*)*, (a+)*, (a?)* and a** become a*, and (a?)+ becomes a*;
+ * - ? on a nullable subexpression goes away, and {1}, {0,1}, {0,} and {1,} become plain operators;
+ * - single-byte operands next to each other in an alternation merge into one class, so a|b|c is [abc];
+ * - a repeated alternative right after an identical one goes away;
+ * - common prefixes are factored out of neighbouring alternatives, so ab|ac|a is a(b|c)?.
+ * Rewrites never reorder alternatives, and never look through a CAPTURE node or move one.
+ * @param ast Pointer to the tree
+ */
+void simplify_regex_ast(regex_ast *ast);
+
+/**
+ * @brief Write a syntax tree back as a postfix regex.
+ * @param ast Pointer to the tree
+ * @return The postfix regex. Release it with free_regex
+ */
+regex regex_ast_to_postfix(const regex_ast *ast);
+
+/**
+ * @brief Simplify a postfix regex through its syntax tree. A postfix that is not well formed is
+ * copied as it is, so the automaton builders report the error.
+ * @param r The postfix regex
+ * @param memory Pointer to the arena the tree is allocated from
+ * @return The simplified postfix regex, allocated outside the arena. Release it with free_regex
+ */
+regex simplify_regex(const regex r, arena *memory);
+
+#endif // REGEX_AST_H
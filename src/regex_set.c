@@ -0,0 +1,171 @@
+#include "regex_set.h"
+#include "lazy_dfa.h"
+
+regex_set new_regex_set(const regex *patterns, uint32_t count)
+{
+    regex_set set;
+    set.count = count;
+    set.nullable = malloc((count > 0 ? count : 1) * sizeof(bool));
+    if (set.nullable == NULL)
+    {
+        fprintf(stderr, "Error: Out of memory while building the regex set.\n");
+        exit(EXIT_FAILURE);
+    }
+    set.automaton = regex_set_to_nfa(patterns, count, &set.state_patterns, set.nullable);
+
+    // Matching goes through a lazy DFA of the combined automaton
+    set.automaton.lazy_cache = new_lazy_dfa(&set.automaton, REGEX_SET_CACHE_BUDGET, false);
+    return set;
+}
+
+/**
+ * @brief Run the combined automaton over the input and get the set of states active at the end.
+ * The lazy DFA is used when the NFA has one, falling back to the plain simulation if its cache
+ * keeps overflowing.
+ * @param automaton Pointer to the combined NFA
+ * @param input The input string
+ * @param input_length The length of the input string
+ * @param block Scratch space for two state sets
+ * @return The final set of states, stored inside the block, or NULL if no state is left
+ */
+static const uint64_t *final_states(const nfa *automaton, const char *input, size_t input_length, uint64_t *block)
+{
+    const size_t words = automaton->words;
+    const int *char_to_col = automaton->nfa_alphabet.char_to_col;
+    uint64_t *current_states = block;
+    uint64_t *next_states = block + words;
+    size_t i = 0;
+
+    state_set_copy(current_states, automaton->start_states, words);
+
+    lazy_dfa *cache = automaton->lazy_cache;
+    if (cache != NULL)
+    {
+        const int columns = cache->columns;
+        uint64_t flushes_at_start = cache->flushes;
+        int32_t state = cache->start;
+
+        for (; i < input_length; i++)
+        {
+            int col = char_to_col[(unsigned char)input[i]];
+            if (col == -1)
+            {
+                return NULL;
+            }
+
+            int32_t next = cache->next[(size_t)state * columns + col];
+            if (next == -1)
+            {
+                // The cache is thrashing: finish with the simulation from the current set
+                if (cache->flushes - flushes_at_start >= LAZY_DFA_MAX_FLUSHES)
+                {
+                    break;
+                }
+                next = lazy_dfa_next(cache, automaton, &state, col);
+            }
+            state = next;
+
+            if (state == cache->dead)
+            {
+                return NULL;
+            }
+        }
+
+        // Most inputs match no pattern, and those never need the set itself
+        if (i == input_length && !cache->accepting[state])
+        {
+            return NULL;
+        }
+        state_set_copy(current_states, cache->sets + (size_t)state * words, words);
+    }
+
+    for (; i < input_length; i++)
+    {
+        int col = char_to_col[(unsigned char)input[i]];
+        if (col == -1)
+        {
+            return NULL;
+        }
+
+        nfa_step(automaton, current_states, col, next_states);
+        if (state_set_is_empty(next_states, words))
+        {
+            return NULL;
+        }
+
+        uint64_t *swap = current_states;
+        current_states = next_states;
+        next_states = swap;
+    }
+
+    return current_states;
+}
+
+uint32_t match_regex_set(const regex_set *set, const char *input, size_t input_length, uint32_t *matches)
+{
+    const nfa *automaton = &set->automaton;
+    const size_t words = automaton->words;
+    uint32_t count = 0;
+
+    // Only the start state is active on the empty string, and it accepts for the nullable patterns
+    if (input_length == 0)
+    {
+        for (uint32_t pattern = 0; pattern < set->count; pattern++)
+        {
+            if (set->nullable[pattern])
+            {
+                matches[count++] = pattern;
+            }
+        }
+        return count;
+    }
+
+    // Two state sets for the simulation, followed by a set of the patterns matched
+    uint64_t *block = malloc((2 * words + state_set_words(set->count)) * sizeof(uint64_t));
+    if (block == NULL)
+    {
+        fprintf(stderr, "Error: Out of memory while matching the regex set.\n");
+        exit(EXIT_FAILURE);
+    }
+
+    const uint64_t *states = final_states(automaton, input, input_length, block);
+    if (states != NULL)
+    {
+        // States are not always numbered pattern by pattern, so the patterns are gathered in a set
+        // and come out of it in increasing order
+        uint64_t *patterns = block + 2 * words;
+        const size_t pattern_words = state_set_words(set->count);
+        state_set_clear(patterns, pattern_words);
+        for (size_t w = 0; w < words; w++)
+        {
+            for (uint64_t bits = states[w] & automaton->accept_states[w]; bits != 0; bits &= bits - 1)
+            {
+                int32_t pattern = set->state_patterns[w * STATE_SET_WORD_BITS + state_set_ctz(bits)];
+                if (pattern >= 0)
+                {
+                    state_set_add(patterns, (uint32_t)pattern);
+                }
+            }
+        }
+        for (size_t w = 0; w < pattern_words; w++)
+        {
+            for (uint64_t bits = patterns[w]; bits != 0; bits &= bits - 1)
+            {
+                matches[count++] = (uint32_t)(w * STATE_SET_WORD_BITS + state_set_ctz(bits));
+            }
+        }
+    }
+
+    free(block);
+    return count;
+}
+
+void free_regex_set(regex_set *set)
+{
+    free_nfa(&set->automaton);
+    free(set->state_patterns);
+    free(set->nullable);
+    set->state_patterns = NULL;
+    set->nullable = NULL;
+    set->count = 0;
+}
@@ -0,0 +1,57 @@
+#ifndef REGEX_SET_H
+#define REGEX_SET_H
+
+#include "nfa.h"
+
+/** Memory budget of the lazy DFA of a regex set, in bytes. The state sets of a combined
+ * automaton are much wider than those of a single regex, so the cache needs more room */
+#ifndef REGEX_SET_CACHE_BUDGET
+#define REGEX_SET_CACHE_BUDGET (64 << 20)
+#endif
+
+/**
+ * @brief Struct to represent a set of regular expressions compiled into a single automaton.
+ * The patterns are numbered from 0 in the order they were given. Every state of the combined
+ * NFA except the start state belongs to one pattern, so the accept states that are active at
+ * the end of the input tell which patterns match it.
+ */
+struct regex_set
+{
+    /* Combined NFA of all the patterns */
+    nfa automaton;
+    /* Number of patterns in the set */
+    uint32_t count;
+    /* Pattern of each state of the automaton, or -1 for the start state */
+    int32_t *state_patterns;
+    /* Whether each pattern accepts the empty string */
+    bool *nullable;
+};
+typedef struct regex_set regex_set;
+
+/**
+ * @brief Compile several regular expressions into one regex set.
+ * @param patterns Array with the regexes, as regex structs
+ * @param count Number of regexes
+ * @return The regex set
+ */
+regex_set new_regex_set(const regex *patterns, uint32_t count);
+
+/**
+ * @brief Find every pattern of the set that accepts a given input string, in a single pass
+ * over the input.
+ * @param set Pointer to the regex set
+ * @param input The input string to check
+ * @param input_length The length of the input string
+ * @param matches Output array with room for set->count entries. It receives the indexes of
+ * the matching patterns, in increasing order
+ * @return The number of matching patterns
+ */
+uint32_t match_regex_set(const regex_set *set, const char *input, size_t input_length, uint32_t *matches);
+
+/**
+ * @brief Release the memory owned by a regex set.
+ * @param set Pointer to the regex set to free
+ */
+void free_regex_set(regex_set *set);
+
+#endif // REGEX_SET_H
@@ -0,0 +1,455 @@
+#include "search.h"
+#include "lazy_dfa.h"
+#include "glushkov.h"
+#include "prefilter.h"
+
+/**
+ * @brief Struct to skip the input where no match can start. When every match starts with
+ * the prefix literal of the prefilter, a search with no match in progress can jump straight
+ * to the next occurrence of the literal.
+ */
+struct search_skip
+{
+    /* Literal that every match starts with, or NULL to never skip */
+    const char *prefix;
+    /* Length of the prefix literal */
+    size_t prefix_length;
+    /* Offset of the next occurrence of the prefix found so far, or PREFILTER_NOT_FOUND */
+    size_t candidate;
+};
+typedef struct search_skip search_skip;
+
+/**
+ * @brief Create the skip state of a search, finding the first occurrence of the prefix literal.
+ * @param automaton Pointer to the NFA
+ * @param input The input string
+ * @param input_length The length of the input string
+ * @return The skip state
+ */
+static search_skip new_search_skip(const nfa *automaton, const char *input, size_t input_length)
+{
+    search_skip skip;
+    skip.prefix = NULL;
+    skip.prefix_length = 0;
+    skip.candidate = 0;
+
+    if (automaton->prefilter != NULL && automaton->prefilter->prefix_length > 0)
+    {
+        skip.prefix = automaton->prefilter->prefix;
+        skip.prefix_length = automaton->prefilter->prefix_length;
+        skip.candidate = prefilter_find(skip.prefix, skip.prefix_length, input, input_length, 0);
+    }
+    return skip;
+}
+
+/**
+ * @brief Offset where the search goes on when no match is in progress at a given offset.
+ * @param skip The skip state of the search
+ * @param input The input string
+ * @param input_length The length of the input string
+ * @param offset The current offset
+ * @return The first offset at or after `offset` where a match can start, or
+ * PREFILTER_NOT_FOUND if no match can start anymore
+ */
+static inline size_t skip_to_candidate(search_skip *skip, const char *input, size_t input_length, size_t offset)
+{
+    if (skip->prefix == NULL)
+    {
+        return offset;
+    }
+    if (skip->candidate != PREFILTER_NOT_FOUND && skip->candidate < offset)
+    {
+        skip->candidate = prefilter_find(skip->prefix, skip->prefix_length, input, input_length, offset);
+    }
+    return skip->candidate;
+}
+
+/**
+ * @brief Search with the bit-parallel Glushkov automaton. The initial position is added to the
+ * active positions before every byte, which is the implicit `.*` prefix.
+ */
+static size_t search_glushkov(const glushkov *automaton, search_skip *skip, const char *input,
+                              size_t input_length, match_callback on_match, void *user_data)
+{
+    const uint64_t shift_mask = automaton->shift_mask;
+    const int table_chunk_count = automaton->table_chunk_count;
+    size_t count = 0;
+    uint64_t active = 0;
+
+    for (size_t i = 0;; i++)
+    {
+        // Nothing is in progress, so jump to where the next match can start
+        if (active == 0)
+        {
+            i = skip_to_candidate(skip, input, input_length, i);
+            if (i == PREFILTER_NOT_FOUND)
+            {
+                return count;
+            }
+        }
+
+        // A match can start at this offset
+        uint64_t current = active | 1;
+
+        if ((current & automaton->accept_mask) != 0)
+        {
+            count++;
+            if (!on_match(SEARCH_NO_START, i, user_data))
+            {
+                return count;
+            }
+        }
+
+        if (i == input_length)
+        {
+            return count;
+        }
+
+        uint64_t next = (current & shift_mask) << 1;
+        for (int k = 0; k < table_chunk_count; k++)
+        {
+            int chunk = automaton->table_chunks[k];
+            next |= automaton->follow_tables[chunk][(current >> (chunk * 8)) & 0xFF];
+        }
+        active = next & automaton->byte_masks[(unsigned char)input[i]];
+    }
+}
+
+/**
+ * @brief Search with the plain NFA simulation, starting at a given offset.
+ * @param automaton Pointer to the NFA
+ * @param skip The skip state of the search
+ * @param initial_states The states active at `offset`, or NULL for the epsilon closure of the start state
+ * @param input The input string
+ * @param input_length The length of the input string
+ * @param offset The offset where the search starts
+ * @param report_offset false if the matches ending at `offset` were already reported
+ * @param on_match The callback called for each match
+ * @param user_data Pointer passed to the callback
+ * @return The number of matches reported
+ */
+static size_t search_simulation(const nfa *automaton, search_skip *skip, const uint64_t *initial_states,
+                                const char *input,
+                                size_t input_length, size_t offset, bool report_offset,
+                                match_callback on_match, void *user_data)
+{
+    const size_t words = automaton->words;
+    const uint64_t *start_closure = automaton->start_states;
+
+    uint64_t *block = malloc(2 * words * sizeof(uint64_t));
+    if (block == NULL)
+    {
+        fprintf(stderr, "Error: Out of memory while searching.\n");
+        exit(EXIT_FAILURE);
+    }
+    uint64_t *current_states = block;
+    uint64_t *next_states = block + words;
+
+    state_set_copy(current_states, initial_states != NULL ? initial_states : start_closure, words);
+
+    size_t count = 0;
+    for (size_t i = offset;; i++)
+    {
+        // Only the start states are active, so jump to where the next match can start
+        if (skip->prefix != NULL && state_set_equal(current_states, start_closure, words))
+        {
+            i = skip_to_candidate(skip, input, input_length, i);
+            if (i == PREFILTER_NOT_FOUND)
+            {
+                break;
+            }
+        }
+
+        if ((i != offset || report_offset) && state_set_intersects(current_states, automaton->accept_states, words))
+        {
+            count++;
+            if (!on_match(SEARCH_NO_START, i, user_data))
+            {
+                break;
+            }
+        }
+
+        if (i == input_length)
+        {
+            break;
+        }
+
+        int col = automaton->nfa_alphabet.char_to_col[(unsigned char)input[i]];
+        if (col == -1)
+        {
+            state_set_clear(next_states, words);
+        }
+        else
+        {
+            nfa_step(automaton, current_states, col, next_states);
+        }
+
+        // A match can start at the next offset
+        state_set_or(next_states, start_closure, words);
+
+        uint64_t *swap = current_states;
+        current_states = next_states;
+        next_states = swap;
+    }
+
+    free(block);
+    return count;
+}
+
+/**
+ * @brief Search with the unanchored lazy DFA of the NFA. Falls back to the plain simulation
+ * if the cache keeps overflowing, like match_lazy_dfa.
+ */
+static size_t search_lazy_dfa(lazy_dfa *cache, const nfa *automaton, search_skip *skip, const char *input,
+                              size_t input_length, match_callback on_match, void *user_data)
+{
+    const int *char_to_col = automaton->nfa_alphabet.char_to_col;
+    const int columns = cache->columns;
+    uint64_t flushes_at_start = cache->flushes;
+    size_t count = 0;
+
+    int32_t state = cache->start;
+
+    for (size_t i = 0;; i++)
+    {
+        // Nothing is in progress, so jump to where the next match can start
+        if (state == cache->start)
+        {
+            i = skip_to_candidate(skip, input, input_length, i);
+            if (i == PREFILTER_NOT_FOUND)
+            {
+                return count;
+            }
+        }
+
+        if (cache->accepting[state])
+        {
+            count++;
+            if (!on_match(SEARCH_NO_START, i, user_data))
+            {
+                return count;
+            }
+        }
+
+        if (i == input_length)
+        {
+            return count;
+        }
+
+        int col = char_to_col[(unsigned char)input[i]];
+
+        // No state survives a byte outside the alphabet, so only the start state is left
+        if (col == -1)
+        {
+            state = cache->start;
+            continue;
+        }
+
+        int32_t next = cache->next[(size_t)state * columns + col];
+        if (next == -1)
+        {
+            if (cache->flushes - flushes_at_start >= LAZY_DFA_MAX_FLUSHES)
+            {
+                return count + search_simulation(automaton, skip, cache->sets + (size_t)state * cache->words, input,
+                                                 input_length, i, false, on_match, user_data);
+            }
+            next = lazy_dfa_next(cache, automaton, &state, col);
+        }
+        state = next;
+    }
+}
+
+/**
+ * @brief Add a state to a set during a search that tracks start offsets, keeping the
+ * leftmost start when the state is already in the set.
+ */
+static void add_with_start(uint64_t *states, size_t *start_of, uint32_t state, size_t start)
+{
+    if (!state_set_contains(states, state))
+    {
+        state_set_add(states, state);
+        start_of[state] = start;
+    }
+    else if (start < start_of[state])
+    {
+        start_of[state] = start;
+    }
+}
+
+/**
+ * @brief Add the epsilon closure of a set of active states to it, each state reached with the
+ * leftmost start of the states it is reached from. Epsilon transitions lead to higher states,
+ * so the start of a state is final by the time the walk gets to it.
+ */
+static void close_with_starts(const nfa *automaton, uint64_t *states, size_t *start_of)
+{
+    for (size_t w = 0; w < automaton->words; w++)
+    {
+        uint64_t done = 0;
+        for (uint64_t bits = states[w]; bits != 0; bits = states[w] & ~done)
+        {
+            uint32_t state = (uint32_t)(w * STATE_SET_WORD_BITS + state_set_ctz(bits));
+            done |= bits & (~bits + 1);
+            for (uint32_t edge = automaton->edge_start[state];
+                 edge < automaton->edge_start[state + 1] && automaton->edge_columns[edge] == 0; edge++)
+            {
+                add_with_start(states, start_of, automaton->edge_targets[edge], start_of[state]);
+            }
+        }
+    }
+}
+
+/**
+ * @brief Search with a simulation that records, for every active state, the leftmost offset
+ * where a match leading to it started. It is still a single pass, with work proportional to
+ * the transitions of the active states.
+ */
+static size_t search_with_starts(const nfa *automaton, search_skip *skip, const char *input,
+                                 size_t input_length, match_callback on_match, void *user_data)
+{
+    const size_t words = automaton->words;
+    const uint32_t states = automaton->states > 0 ? automaton->states : 1;
+    const uint64_t *start_closure = automaton->start_states;
+
+    uint64_t *current_states = calloc(2 * words, sizeof(uint64_t));
+    size_t *start_of = malloc(2 * (size_t)states * sizeof(size_t));
+    if (current_states == NULL || start_of == NULL)
+    {
+        fprintf(stderr, "Error: Out of memory while searching.\n");
+        exit(EXIT_FAILURE);
+    }
+    uint64_t *next_states = current_states + words;
+    size_t *next_start_of = start_of + states;
+    uint64_t *sets_block = current_states;
+    size_t *starts_block = start_of;
+
+    size_t count = 0;
+    for (size_t i = 0;; i++)
+    {
+        // Nothing is in progress, so jump to where the next match can start
+        if (state_set_is_empty(current_states, words))
+        {
+            i = skip_to_candidate(skip, input, input_length, i);
+            if (i == PREFILTER_NOT_FOUND)
+            {
+                break;
+            }
+        }
+
+        // A match can start at this offset
+        for (size_t w = 0; w < words; w++)
+        {
+            for (uint64_t bits = start_closure[w]; bits != 0; bits &= bits - 1)
+            {
+                add_with_start(current_states, start_of, (uint32_t)(w * STATE_SET_WORD_BITS + state_set_ctz(bits)), i);
+            }
+        }
+
+        // Report the leftmost start among the accept states
+        size_t leftmost = SEARCH_NO_START;
+        for (size_t w = 0; w < words; w++)
+        {
+            for (uint64_t bits = current_states[w] & automaton->accept_states[w]; bits != 0; bits &= bits - 1)
+            {
+                size_t start = start_of[w * STATE_SET_WORD_BITS + state_set_ctz(bits)];
+                if (start < leftmost)
+                {
+                    leftmost = start;
+                }
+            }
+        }
+        if (leftmost != SEARCH_NO_START)
+        {
+            count++;
+            if (!on_match(leftmost, i, user_data))
+            {
+                break;
+            }
+        }
+
+        if (i == input_length)
+        {
+            break;
+        }
+
+        state_set_clear(next_states, words);
+        int col = automaton->nfa_alphabet.char_to_col[(unsigned char)input[i]];
+        if (col != -1)
+        {
+            for (size_t w = 0; w < words; w++)
+            {
+                for (uint64_t bits = current_states[w]; bits != 0; bits &= bits - 1)
+                {
+                    uint32_t state = (uint32_t)(w * STATE_SET_WORD_BITS + state_set_ctz(bits));
+                    if (automaton->transitions == NULL)
+                    {
+                        uint32_t end;
+                        for (uint32_t edge = nfa_edges(automaton, state, col, &end); edge < end; edge++)
+                        {
+                            add_with_start(next_states, next_start_of, automaton->edge_targets[edge],
+                                           start_of[state]);
+                        }
+                        continue;
+                    }
+
+                    const uint64_t *targets = nfa_transition(automaton, state, col);
+                    for (size_t tw = 0; tw < words; tw++)
+                    {
+                        for (uint64_t target_bits = targets[tw]; target_bits != 0; target_bits &= target_bits - 1)
+                        {
+                            add_with_start(next_states, next_start_of,
+                                           (uint32_t)(tw * STATE_SET_WORD_BITS + state_set_ctz(target_bits)),
+                                           start_of[state]);
+                        }
+                    }
+                }
+            }
+            if (!automaton->epsilon_free)
+            {
+                close_with_starts(automaton, next_states, next_start_of);
+            }
+        }
+
+        uint64_t *swap_states = current_states;
+        current_states = next_states;
+        next_states = swap_states;
+        size_t *swap_starts = start_of;
+        start_of = next_start_of;
+        next_start_of = swap_starts;
+    }
+
+    free(sets_block);
+    free(starts_block);
+    return count;
+}
+
+size_t search_nfa(const nfa *automaton, const char *input, size_t input_length, bool track_start,
+                  match_callback on_match, void *user_data)
+{
+    // No match is possible when the input lacks a literal that every match contains
+    const prefilter *filter = automaton->prefilter;
+    if (filter != NULL && filter->required_length > filter->prefix_length &&
+        prefilter_find(filter->required, filter->required_length, input, input_length, 0) == PREFILTER_NOT_FOUND)
+    {
+        return 0;
+    }
+
+    search_skip skip = new_search_skip(automaton, input, input_length);
+
+    if (track_start)
+    {
+        return search_with_starts(automaton, &skip, input, input_length, on_match, user_data);
+    }
+
+    if (automaton->bit_parallel != NULL)
+    {
+        return search_glushkov(automaton->bit_parallel, &skip, input, input_length, on_match, user_data);
+    }
+
+    if (automaton->search_cache != NULL)
+    {
+        return search_lazy_dfa(automaton->search_cache, automaton, &skip, input, input_length, on_match, user_data);
+    }
+
+    return search_simulation(automaton, &skip, NULL, input, input_length, 0, true, on_match, user_data);
+}
@@ -0,0 +1,35 @@
+#ifndef SEARCH_H
+#define SEARCH_H
+
+#include "nfa.h"
+
+/* Start offset reported when the search does not track where matches start */
+#define SEARCH_NO_START ((size_t)-1)
+
+/**
+ * @brief Callback called by search_nfa for every offset where a match ends.
+ * @param start Offset where the leftmost match ending at `end` starts, or SEARCH_NO_START
+ * @param end Offset one past the last byte of the match
+ * @param user_data The pointer given to search_nfa
+ * @return true to keep searching, false to stop
+ */
+typedef bool (*match_callback)(size_t start, size_t end, void *user_data);
+
+/**
+ * @brief Find the matches of the NFA inside an input string, in a single pass over it.
+ * The search behaves as if the regex had an implicit `.*` prefix: the start state is added
+ * back at every offset, so matches can begin anywhere. The callback is called once for each
+ * offset where at least one match ends, in increasing order. Empty matches are reported too,
+ * so a regex that accepts the empty string ends a match at every offset.
+ * @param automaton Pointer to the NFA
+ * @param input The input string to search
+ * @param input_length The length of the input string
+ * @param track_start true to also report where the leftmost match ending at each offset starts
+ * @param on_match The callback called for each match
+ * @param user_data Pointer passed to the callback
+ * @return The number of matches reported
+ */
+size_t search_nfa(const nfa *automaton, const char *input, size_t input_length, bool track_start,
+                  match_callback on_match, void *user_data);
+
+#endif // SEARCH_H
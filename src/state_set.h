@@ -0,0 +1,167 @@
+#ifndef STATE_SET_H
+#define STATE_SET_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+/* Number of states stored in each word of a state set */
+#define STATE_SET_WORD_BITS 64
+
+/**
+ * @brief State sets are stored as arrays of 64-bit words, where bit (state % 64) of word
+ * (state / 64) is set when the state belongs to the set. All the operations below work on
+ * whole words so the compiler can vectorize them, and every set of the same automaton uses
+ * the same number of words.
+ */
+
+/**
+ * @brief Number of 64-bit words needed to store a set over the given number of states.
+ * @param states Number of states in the automaton
+ * @return The number of words in each state set (at least 1)
+ */
+static inline size_t state_set_words(size_t states)
+{
+    size_t words = (states + STATE_SET_WORD_BITS - 1) / STATE_SET_WORD_BITS;
+    return words == 0 ? 1 : words;
+}
+
+/**
+ * @brief Index of the lowest set bit of a non-zero word, used to visit only the states
+ * that belong to a set: `state = w * STATE_SET_WORD_BITS + state_set_ctz(bits)`, then
+ * `bits &= bits - 1` to move on to the next one.
+ * @param word A non-zero word of a state set
+ * @return The index of the lowest set bit
+ */
+static inline int state_set_ctz(uint64_t word)
+{
+#if defined(__GNUC__) || defined(__clang__)
+    return __builtin_ctzll(word);
+#else
+    int index = 0;
+    while ((word & 1) == 0)
+    {
+        word >>= 1;
+        index++;
+    }
+    return index;
+#endif
+}
+
+/**
+ * @brief Remove every state from the set.
+ * @param set The state set to clear
+ * @param words Number of words in the set
+ */
+static inline void state_set_clear(uint64_t *set, size_t words)
+{
+    memset(set, 0, words * sizeof(uint64_t));
+}
+
+/**
+ * @brief Copy a state set into another one of the same width.
+ * @param dst The destination set
+ * @param src The source set
+ * @param words Number of words in each set
+ */
+static inline void state_set_copy(uint64_t *restrict dst, const uint64_t *restrict src, size_t words)
+{
+    memcpy(dst, src, words * sizeof(uint64_t));
+}
+
+/**
+ * @brief Add a state to the set.
+ * @param set The state set
+ * @param state The state to add
+ */
+static inline void state_set_add(uint64_t *set, uint32_t state)
+{
+    set[state / STATE_SET_WORD_BITS] |= (1ULL << (state % STATE_SET_WORD_BITS));
+}
+
+/**
+ * @brief Check whether a state belongs to the set.
+ * @param set The state set
+ * @param state The state to check
+ * @return true if the state is in the set, false otherwise
+ */
+static inline bool state_set_contains(const uint64_t *set, uint32_t state)
+{
+    return (set[state / STATE_SET_WORD_BITS] & (1ULL << (state % STATE_SET_WORD_BITS))) != 0;
+}
+
+/**
+ * @brief Union of two state sets, stored in the first one (dst |= src).
+ * @param dst The set that receives the union
+ * @param src The set to merge into dst
+ * @param words Number of words in each set
+ */
+static inline void state_set_or(uint64_t *restrict dst, const uint64_t *restrict src, size_t words)
+{
+    for (size_t w = 0; w < words; w++)
+    {
+        dst[w] |= src[w];
+    }
+}
+
+/**
+ * @brief Intersection of two state sets, stored in the first one (dst &= src).
+ * @param dst The set that receives the intersection
+ * @param src The set to intersect with dst
+ * @param words Number of words in each set
+ */
+static inline void state_set_and(uint64_t *restrict dst, const uint64_t *restrict src, size_t words)
+{
+    for (size_t w = 0; w < words; w++)
+    {
+        dst[w] &= src[w];
+    }
+}
+
+/**
+ * @brief Check whether two state sets have at least one state in common.
+ * @param a The first set
+ * @param b The second set
+ * @param words Number of words in each set
+ * @return true if the intersection is not empty, false otherwise
+ */
+static inline bool state_set_intersects(const uint64_t *a, const uint64_t *b, size_t words)
+{
+    uint64_t common = 0;
+    for (size_t w = 0; w < words; w++)
+    {
+        common |= a[w] & b[w];
+    }
+    return common != 0;
+}
+
+/**
+ * @brief Check whether a state set is empty.
+ * @param set The state set
+ * @param words Number of words in the set
+ * @return true if no state belongs to the set, false otherwise
+ */
+static inline bool state_set_is_empty(const uint64_t *set, size_t words)
+{
+    uint64_t any = 0;
+    for (size_t w = 0; w < words; w++)
+    {
+        any |= set[w];
+    }
+    return any == 0;
+}
+
+/**
+ * @brief Check whether two state sets contain exactly the same states.
+ * @param a The first set
+ * @param b The second set
+ * @param words Number of words in each set
+ * @return true if both sets are equal, false otherwise
+ */
+static inline bool state_set_equal(const uint64_t *a, const uint64_t *b, size_t words)
+{
+    return memcmp(a, b, words * sizeof(uint64_t)) == 0;
+}
+
+#endif // STATE_SET_H
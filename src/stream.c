@@ -0,0 +1,208 @@
+#include "stream.h"
+#include "lazy_dfa.h"
+#include "glushkov.h"
+
+void match_stream_begin(match_stream *stream, const nfa *automaton)
+{
+    const size_t words = automaton->words;
+
+    stream->automaton = automaton;
+    stream->rejected = false;
+    stream->positions = 1;
+    stream->dfa_state = -1;
+    stream->flushes = 0;
+
+    stream->states = malloc(2 * words * sizeof(uint64_t));
+    if (stream->states == NULL)
+    {
+        fprintf(stderr, "Error: Out of memory while matching.\n");
+        exit(EXIT_FAILURE);
+    }
+    state_set_copy(stream->states, automaton->start_states, words);
+
+    if (automaton->bit_parallel != NULL)
+    {
+        stream->engine = STREAM_GLUSHKOV;
+    }
+    else if (automaton->lazy_cache != NULL)
+    {
+        stream->engine = STREAM_LAZY_DFA;
+        stream->dfa_state = automaton->lazy_cache->start;
+        stream->flushes = automaton->lazy_cache->flushes;
+    }
+    else
+    {
+        stream->engine = STREAM_SIMULATION;
+    }
+}
+
+/**
+ * @brief Match a chunk with the Glushkov automaton.
+ */
+static void feed_glushkov(match_stream *stream, const char *chunk, size_t chunk_length)
+{
+    const glushkov *automaton = stream->automaton->bit_parallel;
+    const uint64_t shift_mask = automaton->shift_mask;
+    const int table_chunk_count = automaton->table_chunk_count;
+    uint64_t active = stream->positions;
+
+    for (size_t i = 0; i < chunk_length; i++)
+    {
+        uint64_t next = (active & shift_mask) << 1;
+        for (int k = 0; k < table_chunk_count; k++)
+        {
+            int table_chunk = automaton->table_chunks[k];
+            next |= automaton->follow_tables[table_chunk][(active >> (table_chunk * 8)) & 0xFF];
+        }
+        active = next & automaton->byte_masks[(unsigned char)chunk[i]];
+
+        if (active == 0)
+        {
+            stream->rejected = true;
+            break;
+        }
+    }
+
+    stream->positions = active;
+}
+
+/**
+ * @brief Match a chunk with the plain NFA simulation, starting from the current set.
+ */
+static void feed_simulation(match_stream *stream, const char *chunk, size_t chunk_length)
+{
+    const nfa *automaton = stream->automaton;
+    const size_t words = automaton->words;
+    uint64_t *current_states = stream->states;
+    uint64_t *next_states = stream->states + words;
+
+    for (size_t i = 0; i < chunk_length; i++)
+    {
+        int col = automaton->nfa_alphabet.char_to_col[(unsigned char)chunk[i]];
+        if (col == -1)
+        {
+            stream->rejected = true;
+            return;
+        }
+
+        nfa_step(automaton, current_states, col, next_states);
+        if (state_set_is_empty(next_states, words))
+        {
+            stream->rejected = true;
+            return;
+        }
+
+        uint64_t *swap = current_states;
+        current_states = next_states;
+        next_states = swap;
+    }
+
+    // The current set always lives at the start of the block between chunks
+    if (current_states != stream->states)
+    {
+        state_set_copy(stream->states, current_states, words);
+    }
+}
+
+/**
+ * @brief Match a chunk with the lazy DFA. The set of the current DFA state is copied back into
+ * the stream at the end of the chunk, so the stream survives flushes of the shared cache. If the
+ * cache keeps overflowing, the stream moves on to the plain simulation for good.
+ */
+static void feed_lazy_dfa(match_stream *stream, const char *chunk, size_t chunk_length)
+{
+    const nfa *automaton = stream->automaton;
+    lazy_dfa *cache = automaton->lazy_cache;
+    const int *char_to_col = automaton->nfa_alphabet.char_to_col;
+    const int columns = cache->columns;
+
+    // Someone else flushed the cache since the last chunk
+    if (cache->flushes != stream->flushes)
+    {
+        stream->dfa_state = lazy_dfa_state(cache, automaton, stream->states);
+    }
+
+    uint64_t flushes_at_start = cache->flushes;
+    int32_t state = stream->dfa_state;
+    size_t i = 0;
+
+    for (; i < chunk_length; i++)
+    {
+        int col = char_to_col[(unsigned char)chunk[i]];
+        if (col == -1)
+        {
+            stream->rejected = true;
+            return;
+        }
+
+        int32_t next = cache->next[(size_t)state * columns + col];
+        if (next == -1)
+        {
+            if (cache->flushes - flushes_at_start >= LAZY_DFA_MAX_FLUSHES)
+            {
+                break;
+            }
+            next = lazy_dfa_next(cache, automaton, &state, col);
+        }
+        state = next;
+
+        if (state == cache->dead)
+        {
+            stream->rejected = true;
+            return;
+        }
+    }
+
+    state_set_copy(stream->states, cache->sets + (size_t)state * cache->words, cache->words);
+    stream->dfa_state = state;
+    stream->flushes = cache->flushes;
+
+    if (i < chunk_length)
+    {
+        stream->engine = STREAM_SIMULATION;
+        feed_simulation(stream, chunk + i, chunk_length - i);
+    }
+}
+
+void match_stream_feed(match_stream *stream, const char *chunk, size_t chunk_length)
+{
+    if (stream->rejected)
+    {
+        return;
+    }
+
+    if (stream->engine == STREAM_GLUSHKOV)
+    {
+        feed_glushkov(stream, chunk, chunk_length);
+    }
+    else if (stream->engine == STREAM_LAZY_DFA)
+    {
+        feed_lazy_dfa(stream, chunk, chunk_length);
+    }
+    else
+    {
+        feed_simulation(stream, chunk, chunk_length);
+    }
+}
+
+bool match_stream_end(match_stream *stream)
+{
+    const nfa *automaton = stream->automaton;
+    bool accepted = false;
+
+    if (!stream->rejected)
+    {
+        if (stream->engine == STREAM_GLUSHKOV)
+        {
+            accepted = (stream->positions & automaton->bit_parallel->accept_mask) != 0;
+        }
+        else
+        {
+            accepted = state_set_intersects(stream->states, automaton->accept_states, automaton->words);
+        }
+    }
+
+    free(stream->states);
+    stream->states = NULL;
+    return accepted;
+}
@@ -0,0 +1,64 @@
+#ifndef STREAM_H
+#define STREAM_H
+
+#include "nfa.h"
+
+/**
+ * @brief Engines a match stream can run on, in the order match_nfa prefers them.
+ */
+enum Stream_Engine
+{
+    STREAM_GLUSHKOV,
+    STREAM_LAZY_DFA,
+    STREAM_SIMULATION,
+};
+typedef enum Stream_Engine stream_engine;
+
+/**
+ * @brief Struct to represent an input that is matched one chunk at a time. It keeps the active
+ * states of the automaton between chunks, so the input never needs to be contiguous and memory
+ * use does not depend on its length. The chunks are matched in place, without copying them.
+ */
+struct match_stream
+{
+    /* The NFA being matched */
+    const nfa *automaton;
+    /* Engine used for the chunks that are still to come */
+    stream_engine engine;
+    /* Active positions of the Glushkov automaton */
+    uint64_t positions;
+    /* Current state of the lazy DFA */
+    int32_t dfa_state;
+    /* Number of flushes of the lazy DFA cache when dfa_state was saved. If the cache was
+    flushed since then, dfa_state is stale and the state is found again from `states` */
+    uint64_t flushes;
+    /* Current set of NFA states, followed by one more set used as scratch space */
+    uint64_t *states;
+    /* True once no continuation of the input can be accepted */
+    bool rejected;
+};
+typedef struct match_stream match_stream;
+
+/**
+ * @brief Start matching an input against an NFA, before any chunk is read.
+ * @param stream Pointer to the stream to initialize
+ * @param automaton Pointer to the NFA. It must outlive the stream
+ */
+void match_stream_begin(match_stream *stream, const nfa *automaton);
+
+/**
+ * @brief Match the next chunk of the input.
+ * @param stream Pointer to the stream
+ * @param chunk The bytes of the chunk
+ * @param chunk_length The length of the chunk
+ */
+void match_stream_feed(match_stream *stream, const char *chunk, size_t chunk_length);
+
+/**
+ * @brief Finish matching the input and release the memory owned by the stream.
+ * @param stream Pointer to the stream
+ * @return true if the NFA accepts the whole input, false otherwise
+ */
+bool match_stream_end(match_stream *stream);
+
+#endif // STREAM_H
@@ -0,0 +1,320 @@
+#include "utf8.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* First and last surrogate code points. They have no UTF-8 encoding */
+#define SURROGATE_FIRST 0xD800
+#define SURROGATE_LAST 0xDFFF
+
+/**
+ * @brief Struct to represent a growable list of byte sequences.
+ */
+struct sequence_list
+{
+    utf8_sequence *items;
+    size_t count;
+    size_t capacity;
+};
+typedef struct sequence_list sequence_list;
+
+size_t utf8_decode(const char *input, size_t length, uint32_t *code_point)
+{
+    const unsigned char *bytes = (const unsigned char *)input;
+    if (length == 0)
+    {
+        return 0;
+    }
+    if (bytes[0] < 0x80)
+    {
+        *code_point = bytes[0];
+        return 1;
+    }
+
+    // Length of the encoding and smallest code point that needs it, to reject overlong forms
+    size_t needed;
+    uint32_t value;
+    uint32_t smallest;
+    if ((bytes[0] & 0xE0) == 0xC0)
+    {
+        needed = 2;
+        value = bytes[0] & 0x1F;
+        smallest = 0x80;
+    }
+    else if ((bytes[0] & 0xF0) == 0xE0)
+    {
+        needed = 3;
+        value = bytes[0] & 0x0F;
+        smallest = 0x800;
+    }
+    else if ((bytes[0] & 0xF8) == 0xF0)
+    {
+        needed = 4;
+        value = bytes[0] & 0x07;
+        smallest = 0x10000;
+    }
+    else
+    {
+        return 0;
+    }
+
+    if (length < needed)
+    {
+        return 0;
+    }
+    for (size_t i = 1; i < needed; i++)
+    {
+        if ((bytes[i] & 0xC0) != 0x80)
+        {
+            return 0;
+        }
+        value = (value << 6) | (bytes[i] & 0x3F);
+    }
+    if (value < smallest || value > UTF8_MAX_CODE_POINT || (value >= SURROGATE_FIRST && value <= SURROGATE_LAST))
+    {
+        return 0;
+    }
+
+    *code_point = value;
+    return needed;
+}
+
+size_t utf8_encode(uint32_t code_point, unsigned char *output)
+{
+    if (code_point < 0x80)
+    {
+        output[0] = (unsigned char)code_point;
+        return 1;
+    }
+    if (code_point < 0x800)
+    {
+        output[0] = (unsigned char)(0xC0 | (code_point >> 6));
+        output[1] = (unsigned char)(0x80 | (code_point & 0x3F));
+        return 2;
+    }
+    if (code_point < 0x10000)
+    {
+        output[0] = (unsigned char)(0xE0 | (code_point >> 12));
+        output[1] = (unsigned char)(0x80 | ((code_point >> 6) & 0x3F));
+        output[2] = (unsigned char)(0x80 | (code_point & 0x3F));
+        return 3;
+    }
+    output[0] = (unsigned char)(0xF0 | (code_point >> 18));
+    output[1] = (unsigned char)(0x80 | ((code_point >> 12) & 0x3F));
+    output[2] = (unsigned char)(0x80 | ((code_point >> 6) & 0x3F));
+    output[3] = (unsigned char)(0x80 | (code_point & 0x3F));
+    return 4;
+}
+
+code_point_set utf8_new_set(void)
+{
+    code_point_set set;
+    set.ranges = NULL;
+    set.count = 0;
+    set.capacity = 0;
+    return set;
+}
+
+void utf8_add_range(code_point_set *set, uint32_t first, uint32_t last)
+{
+    if (set->count == set->capacity)
+    {
+        size_t capacity = set->capacity == 0 ? 8 : set->capacity * 2;
+        code_point_range *ranges = realloc(set->ranges, capacity * sizeof(code_point_range));
+        if (ranges == NULL)
+        {
+            fprintf(stderr, "Error: Out of memory while parsing the regex.\n");
+            exit(EXIT_FAILURE);
+        }
+        set->ranges = ranges;
+        set->capacity = capacity;
+    }
+    set->ranges[set->count].first = first;
+    set->ranges[set->count].last = last;
+    set->count++;
+}
+
+/**
+ * @brief Order ranges by their first code point, for qsort.
+ */
+static int compare_ranges(const void *a, const void *b)
+{
+    const code_point_range *x = a;
+    const code_point_range *y = b;
+    return x->first < y->first ? -1 : (x->first > y->first ? 1 : 0);
+}
+
+void utf8_normalize_set(code_point_set *set)
+{
+    if (set->count == 0)
+    {
+        return;
+    }
+    qsort(set->ranges, set->count, sizeof(code_point_range), compare_ranges);
+
+    size_t kept = 0;
+    for (size_t i = 1; i < set->count; i++)
+    {
+        code_point_range *current = &set->ranges[kept];
+        if (set->ranges[i].first <= current->last + 1)
+        {
+            if (set->ranges[i].last > current->last)
+            {
+                current->last = set->ranges[i].last;
+            }
+        }
+        else
+        {
+            set->ranges[++kept] = set->ranges[i];
+        }
+    }
+    set->count = kept + 1;
+}
+
+void utf8_complement_set(code_point_set *set)
+{
+    utf8_normalize_set(set);
+
+    code_point_set complement = utf8_new_set();
+    uint32_t next = 0;
+    for (size_t i = 0; i < set->count; i++)
+    {
+        if (set->ranges[i].first > next)
+        {
+            utf8_add_range(&complement, next, set->ranges[i].first - 1);
+        }
+        next = set->ranges[i].last + 1;
+    }
+    if (next <= UTF8_MAX_CODE_POINT)
+    {
+        utf8_add_range(&complement, next, UTF8_MAX_CODE_POINT);
+    }
+
+    utf8_free_set(set);
+    *set = complement;
+}
+
+/**
+ * @brief Add a sequence to a list. When a sequence of the list has the same bytes after the
+ * first one, the first bytes are merged into it instead.
+ */
+static void add_sequence(sequence_list *list, const utf8_sequence *sequence)
+{
+    for (size_t i = 0; i < list->count; i++)
+    {
+        utf8_sequence *other = &list->items[i];
+        if (other->length == sequence->length &&
+            memcmp(&other->bytes[1], &sequence->bytes[1], (size_t)(sequence->length - 1) * sizeof(byte_set)) == 0)
+        {
+            for (int word = 0; word < 4; word++)
+            {
+                other->bytes[0].bits[word] |= sequence->bytes[0].bits[word];
+            }
+            return;
+        }
+    }
+
+    if (list->count == list->capacity)
+    {
+        size_t capacity = list->capacity == 0 ? 8 : list->capacity * 2;
+        utf8_sequence *items = realloc(list->items, capacity * sizeof(utf8_sequence));
+        if (items == NULL)
+        {
+            fprintf(stderr, "Error: Out of memory while parsing the regex.\n");
+            exit(EXIT_FAILURE);
+        }
+        list->items = items;
+        list->capacity = capacity;
+    }
+    list->items[list->count++] = *sequence;
+}
+
+/**
+ * @brief Split a range of code points without surrogates into byte sequences. The range is cut
+ * until both ends have the same encoding length and every byte after the first one that differs
+ * between the ends covers its whole range, so each byte of the sequence is a plain byte range.
+ */
+static void split_range(uint32_t first, uint32_t last, sequence_list *list)
+{
+    // Largest code point of each encoding length
+    static const uint32_t length_limits[] = {0x7F, 0x7FF, 0xFFFF};
+    for (int i = 0; i < 3; i++)
+    {
+        if (first <= length_limits[i] && last > length_limits[i])
+        {
+            split_range(first, length_limits[i], list);
+            split_range(length_limits[i] + 1, last, list);
+            return;
+        }
+    }
+
+    for (int i = 1; i < UTF8_MAX_LENGTH; i++)
+    {
+        // The code point bits held by the last i bytes
+        uint32_t mask = (1u << (6 * i)) - 1;
+        if ((first & ~mask) == (last & ~mask))
+        {
+            continue;
+        }
+        if ((first & mask) != 0)
+        {
+            split_range(first, first | mask, list);
+            split_range((first | mask) + 1, last, list);
+            return;
+        }
+        if ((last & mask) != mask)
+        {
+            split_range(first, (last & ~mask) - 1, list);
+            split_range(last & ~mask, last, list);
+            return;
+        }
+    }
+
+    unsigned char first_bytes[UTF8_MAX_LENGTH];
+    unsigned char last_bytes[UTF8_MAX_LENGTH];
+    utf8_sequence sequence;
+    sequence.length = (int)utf8_encode(first, first_bytes);
+    utf8_encode(last, last_bytes);
+    for (int i = 0; i < sequence.length; i++)
+    {
+        sequence.bytes[i] = empty_byte_set();
+        byte_set_add_range(&sequence.bytes[i], first_bytes[i], last_bytes[i]);
+    }
+    add_sequence(list, &sequence);
+}
+
+utf8_sequence *utf8_set_sequences(const code_point_set *set, size_t *count)
+{
+    sequence_list list = {NULL, 0, 0};
+    for (size_t i = 0; i < set->count; i++)
+    {
+        uint32_t first = set->ranges[i].first;
+        uint32_t last = set->ranges[i].last > UTF8_MAX_CODE_POINT ? UTF8_MAX_CODE_POINT : set->ranges[i].last;
+
+        // Leave the surrogates out
+        if (first < SURROGATE_FIRST && last >= SURROGATE_FIRST)
+        {
+            split_range(first, SURROGATE_FIRST - 1, &list);
+            first = SURROGATE_FIRST;
+        }
+        if (first <= SURROGATE_LAST && last >= SURROGATE_FIRST)
+        {
+            first = SURROGATE_LAST + 1;
+        }
+        if (first <= last)
+        {
+            split_range(first, last, &list);
+        }
+    }
+
+    *count = list.count;
+    return list.items;
+}
+
+void utf8_free_set(code_point_set *set)
+{
+    free(set->ranges);
+    set->ranges = NULL;
+    set->count = 0;
+    set->capacity = 0;
+}
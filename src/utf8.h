@@ -0,0 +1,113 @@
+#ifndef UTF8_H
+#define UTF8_H
+
+#include "byte_classes.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* Largest Unicode code point */
+#define UTF8_MAX_CODE_POINT 0x10FFFF
+/* Longest UTF-8 encoding of a code point, in bytes */
+#define UTF8_MAX_LENGTH 4
+
+/**
+ * @brief Struct to represent a range of code points, both ends included.
+ */
+struct code_point_range
+{
+    /* First code point of the range */
+    uint32_t first;
+    /* Last code point of the range */
+    uint32_t last;
+};
+typedef struct code_point_range code_point_range;
+
+/**
+ * @brief Struct to represent a set of code points as a growable list of ranges.
+ */
+struct code_point_set
+{
+    /* The ranges. After utf8_normalize_set they are sorted, disjoint and not adjacent */
+    code_point_range *ranges;
+    /* Number of ranges */
+    size_t count;
+    /* Number of ranges that fit in the list */
+    size_t capacity;
+};
+typedef struct code_point_set code_point_set;
+
+/**
+ * @brief Struct to represent a sequence of byte sets that matches the UTF-8 encodings of a
+ * range of code points: the n-th byte of the encoding is in the n-th set.
+ */
+struct utf8_sequence
+{
+    /* Number of bytes of the encodings */
+    int length;
+    /* Bytes allowed at each position */
+    byte_set bytes[UTF8_MAX_LENGTH];
+};
+typedef struct utf8_sequence utf8_sequence;
+
+/**
+ * @brief Decode the code point at the start of a string. Overlong encodings, surrogates and code
+ * points above UTF8_MAX_CODE_POINT are not valid UTF-8.
+ * @param input The string
+ * @param length The number of bytes available
+ * @param code_point Output for the code point
+ * @return The number of bytes of the code point, or 0 if the string does not start with valid UTF-8
+ */
+size_t utf8_decode(const char *input, size_t length, uint32_t *code_point);
+
+/**
+ * @brief Encode a code point in UTF-8.
+ * @param code_point The code point, at most UTF8_MAX_CODE_POINT
+ * @param output Output for the bytes, UTF8_MAX_LENGTH at most
+ * @return The number of bytes written
+ */
+size_t utf8_encode(uint32_t code_point, unsigned char *output);
+
+/**
+ * @brief Create an empty set of code points.
+ * @return The set. Release it with utf8_free_set
+ */
+code_point_set utf8_new_set(void);
+
+/**
+ * @brief Add a range of code points to a set.
+ * @param set Pointer to the set
+ * @param first The first code point of the range
+ * @param last The last code point of the range
+ */
+void utf8_add_range(code_point_set *set, uint32_t first, uint32_t last);
+
+/**
+ * @brief Sort the ranges of a set and merge the ones that overlap or touch.
+ * @param set Pointer to the set
+ */
+void utf8_normalize_set(code_point_set *set);
+
+/**
+ * @brief Replace a set with the code points that are not in it.
+ * @param set Pointer to the set
+ */
+void utf8_complement_set(code_point_set *set);
+
+/**
+ * @brief Split a set of code points into the byte sequences of their UTF-8 encodings. Surrogates
+ * have no encoding and are left out. Sequences that only differ in their first byte are merged,
+ * so the set takes as few sequences as the encoding allows.
+ * @param set Pointer to the set
+ * @param count Output for the number of sequences
+ * @return The sequences. The caller owns them
+ */
+utf8_sequence *utf8_set_sequences(const code_point_set *set, size_t *count);
+
+/**
+ * @brief Release the memory owned by a set of code points.
+ * @param set Pointer to the set
+ */
+void utf8_free_set(code_point_set *set);
+
+#endif // UTF8_H